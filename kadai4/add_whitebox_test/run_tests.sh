@@ -0,0 +1,253 @@
+#!/bin/sh
+# Regression tests for the kadai4 compiler.
+#
+# Each .mpl file here starts with comment lines giving its input and the
+# output expected from it, one line each:
+#   /* input: 1 2 */
+#   /* expect: TRUE */
+# or `/* error */` for programs the compiler must reject. Every program
+# is compiled at -O0, -O2 and -Os by a compiler built with
+# -fsanitize=address (override with SANITIZE=), so out-of-bounds reads in
+# the passes fail the test; with CASL_SIM set to a COMET II simulator
+# command taking the .csl file and an input file, the programs are also
+# run and their output compared.
+#
+# After the programs, the cross-reference features are checked on the
+# same files: --no-xref, --project at several -j, the .mxr index read
+# back by mxrdump, and the mxrquery corpus built from those indexes;
+# --edit-procedure is checked against full parses of an edited program.
+#
+#   sh run_tests.sh
+#   CASL_SIM="casl2sim" sh run_tests.sh
+
+dir=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+
+fail() {
+    echo "FAIL: $*"
+    failed=1
+}
+
+# The cross-reference table rows in mpplc's output, without the debug trace
+table() {
+    sed -n '/^-\{34\}$/,$p' "$1" | grep -e '^-\{34\}$' -e '|'
+}
+
+${CC:-gcc} -g ${SANITIZE--fsanitize=address} -pthread -o "$work/mpplc" "$dir"/../src/*.c || exit 1
+${CC:-gcc} -g ${SANITIZE--fsanitize=address} -I"$dir"/../src -o "$work/mxrdump" \
+    "$dir"/../tools/mxrdump.c "$dir"/../src/mxr.c || exit 1
+
+for src in "$dir"/*.mpl; do
+    name=$(basename "$src" .mpl)
+    sed -n 's|^/\* input: \(.*\) \*/$|\1|p' "$src" > "$work/$name.in"
+    sed -n 's|^/\* expect: \(.*\) \*/$|\1|p' "$src" > "$work/$name.expect"
+    for level in -O0 -O2 -Os; do
+        cp "$src" "$work/$name.mpl"
+        if grep -q '^/\* error \*/$' "$src"; then
+            "$work/mpplc" "$work/$name.mpl" --no-xref $level > /dev/null 2>&1 &&
+                fail "$name $level: compiled"
+            continue
+        fi
+        if ! "$work/mpplc" "$work/$name.mpl" --no-xref $level > /dev/null 2> "$work/err"; then
+            fail "$name $level: $(head -1 "$work/err")"
+            continue
+        fi
+        [ -n "$CASL_SIM" ] || continue
+        $CASL_SIM "$work/$name.csl" "$work/$name.in" > "$work/$name.out" 2> /dev/null
+        cmp -s "$work/$name.out" "$work/$name.expect" || fail "$name $level: wrong output"
+    done
+done
+
+# --no-xref drops the table and nothing else
+for src in "$dir"/*.mpl; do
+    grep -q '^/\* error \*/$' "$src" && continue
+    name=$(basename "$src" .mpl)
+    mkdir -p "$work/xref"
+    cp "$src" "$work/xref/$name.mpl"
+    "$work/mpplc" "$work/xref/$name.mpl" > "$work/xref/$name.out" 2>&1
+    cp "$work/xref/$name.csl" "$work/xref/$name.full.csl"
+    "$work/mpplc" "$work/xref/$name.mpl" --no-xref > "$work/xref/$name.noxref" 2>&1
+    [ -n "$(table "$work/xref/$name.out")" ] || fail "$name: no table"
+    [ -z "$(table "$work/xref/$name.noxref")" ] || fail "$name --no-xref: printed a table"
+    cmp -s "$work/xref/$name.csl" "$work/xref/$name.full.csl" || fail "$name --no-xref: different code"
+done
+
+# --mxr writes the same table mxrdump prints back, and every row can be
+# looked up by name[:proc]
+for src in "$dir"/*.mpl; do
+    grep -q '^/\* error \*/$' "$src" && continue
+    name=$(basename "$src" .mpl)
+    "$work/mpplc" "$work/xref/$name.mpl" --mxr > "$work/xref/$name.out" 2>&1
+    table "$work/xref/$name.out" > "$work/xref/$name.table"
+    if ! "$work/mxrdump" "$work/xref/$name.mxr" > "$work/xref/$name.dump"; then
+        fail "$name: mxrdump rejected the index"
+        continue
+    fi
+    cmp -s "$work/xref/$name.dump" "$work/xref/$name.table" || fail "$name: mxrdump table differs"
+    grep '|' "$work/xref/$name.table" | while IFS= read -r row; do
+        key=${row%%|*}
+        [ "$("$work/mxrdump" "$work/xref/$name.mxr" "$key")" = "$row" ] ||
+            echo "FAIL: $name: lookup of $key"
+    done | grep . && failed=1
+    "$work/mxrdump" "$work/xref/$name.mxr" no_such_name > /dev/null 2>&1 &&
+        fail "$name: lookup of a missing name succeeded"
+done
+
+# --project prints every file's own rows, and the same bytes whatever the
+# number of worker threads; each program is listed under four names so
+# the workers overlap
+set --
+for table in "$work"/xref/*.table; do
+    for copy in 1 2 3 4; do
+        mpl="${table%.table}.$copy.mpl"
+        cp "${table%.table}.mpl" "$mpl"
+        grep '|' "$table" | awk -v f="$mpl" '{ print f "|" $0 }' >> "$work/xref/project.rows"
+        set -- "$@" "$mpl"
+    done
+done
+LC_ALL=C sort "$work/xref/project.rows" > "$work/xref/project.expect"
+"$work/mpplc" --project -j 1 "$@" > "$work/xref/project.1" 2> "$work/err" ||
+    fail "--project -j 1: $(head -1 "$work/err")"
+grep '|' "$work/xref/project.1" | LC_ALL=C sort | cmp -s - "$work/xref/project.expect" ||
+    fail "--project: rows differ from the per-file tables"
+for jobs in 2 4 8; do
+    "$work/mpplc" --project -j $jobs "$@" > "$work/xref/project.n" 2> "$work/err" ||
+        fail "--project -j $jobs: $(head -1 "$work/err")"
+    cmp -s "$work/xref/project.1" "$work/xref/project.n" || fail "--project -j $jobs: differs from -j 1"
+done
+
+# --edit-procedure re-parses only p (lines 7-12 of edit.mpl) and must give
+# the table, or the syntax error line, of a full parse of the edited file
+mkdir -p "$work/edit"
+cat > "$work/edit/edit.mpl" << 'EOF'
+program EditProc;
+var g, h : integer;
+procedure q(x : integer);
+begin
+    g := g + x
+end;
+procedure p(y : integer);
+var t : integer;
+begin
+    t := y * 2;
+    call q(t)
+end;
+procedure r;
+begin
+    call p(h);
+    h := g
+end;
+begin
+    g := 1; h := 2;
+    call r;
+    call p(g);
+    writeln(g, h)
+end.
+EOF
+cat > "$work/edit/grow.mpl" << 'EOF'
+procedure p(y : integer);
+var t, u : integer;
+begin
+    t := y * 2;
+    u := t + h;
+    call q(t);
+    call q(u);
+    g := g + u
+end;
+EOF
+cat > "$work/edit/shrink.mpl" << 'EOF'
+procedure p(y : integer);
+begin call q(y) end;
+EOF
+cat > "$work/edit/syntax.mpl" << 'EOF'
+procedure p(y : integer);
+var t : integer;
+begin
+    t := y * ;
+    call q(t)
+end;
+EOF
+printf 'procedure p(y : integer);\nbegin\n    zz := y\nend;\n' > "$work/edit/undefined.mpl"
+for edit in grow shrink syntax undefined; do
+    { head -n 6 "$work/edit/edit.mpl"; cat "$work/edit/$edit.mpl"; tail -n +13 "$work/edit/edit.mpl"; } \
+        > "$work/edit/$edit.full.mpl"
+    "$work/mpplc" "$work/edit/$edit.full.mpl" --no-xref > /dev/null 2> "$work/edit/$edit.full.err"
+    full=$?
+    "$work/mpplc" "$work/edit/$edit.full.mpl" > "$work/edit/$edit.full.out" 2> /dev/null
+    "$work/mpplc" --edit-procedure "$work/edit/edit.mpl" p "$work/edit/$edit.mpl" \
+        > "$work/edit/$edit.out" 2> "$work/edit/$edit.err"
+    status=$?
+    if [ $full -eq 0 ]; then
+        [ $status -eq 0 ] || fail "--edit-procedure $edit: $(head -1 "$work/edit/$edit.err")"
+        table "$work/edit/$edit.full.out" | cmp -s - "$work/edit/$edit.out" ||
+            fail "--edit-procedure $edit: table differs from a full parse"
+    else
+        [ $status -ne 0 ] || fail "--edit-procedure $edit: accepted"
+        line=$(sed -n 's/^Syntax error at line \([0-9]*\):.*/\1/p' "$work/edit/$edit.full.err")
+        grep -q "does not parse from line $line\$" "$work/edit/$edit.err" ||
+            fail "--edit-procedure $edit: error line differs from a full parse ($line)"
+    fi
+done
+"$work/mpplc" --edit-procedure "$work/edit/edit.mpl" no_such_proc "$work/edit/grow.mpl" \
+    > /dev/null 2>&1 && fail "--edit-procedure of a missing procedure succeeded"
+
+# mxrquery merges those indexes: '*' gives back every row of every table,
+# exact and prefix queries the matching ones, and a rebuild re-reads only
+# the file whose mtime moved, even by less than a second
+${CC:-gcc} -g ${SANITIZE--fsanitize=address} -I"$dir"/../src -pthread -o "$work/mxrquery" \
+    "$dir"/../tools/mxrquery.c "$dir"/../src/mxr.c || exit 1
+corpus="$work/xref/corpus.mxq"
+set -- "$work"/xref/*.mxr
+touch -d @1700000000.1 "$@"
+for mxr; do
+    grep '|' "${mxr%.mxr}.table" | awk -v f="$mxr" '{ print f "|" $0 }'
+done | LC_ALL=C sort > "$work/xref/all.expect"
+cut -d'|' -f2 "$work/xref/all.expect" | sort -u > "$work/xref/keys"
+
+build_corpus() {
+    "$work/mxrquery" build "$corpus" -j 4 "$@" 2> "$work/err" || fail "mxrquery build: $(head -1 "$work/err")"
+}
+query_all() {
+    "$work/mxrquery" query "$corpus" '*' | LC_ALL=C sort | cmp -s - "$work/xref/all.expect" ||
+        fail "mxrquery '*' $1: rows differ from the tables"
+}
+
+build_corpus "$@"
+grep -q ": $# files indexed, 0 reused, 0 skipped" "$work/err" || fail "mxrquery build: $(cat "$work/err")"
+query_all "after a full build"
+while IFS= read -r key; do
+    "$work/mxrquery" query "$corpus" "$key" > "$work/xref/hits"
+    awk -F'|' -v k="$key" '$2 == k' "$work/xref/all.expect" | grep -qvxFf "$work/xref/hits" &&
+        echo "FAIL: mxrquery $key: rows missing"
+    cut -d'|' -f2 "$work/xref/hits" | grep -v -e "^${key%%:*}\$" -e "^${key%%:*}:" &&
+        echo "FAIL: mxrquery $key: other names matched"
+    prefix=$(printf '%.1s' "$key")
+    "$work/mxrquery" query "$corpus" "$prefix*" | LC_ALL=C sort > "$work/xref/hits"
+    awk -F'|' -v p="$prefix" 'index($2, p) == 1' "$work/xref/all.expect" | cmp -s - "$work/xref/hits" ||
+        echo "FAIL: mxrquery $prefix*: wrong rows"
+done < "$work/xref/keys" | grep . && failed=1
+
+build_corpus "$@"
+grep -q ": 0 files indexed, $# reused" "$work/err" || fail "mxrquery rebuild: $(cat "$work/err")"
+touch -d @1700000000.2 "$1"
+build_corpus "$@"
+grep -q ": 1 files indexed, $(($# - 1)) reused" "$work/err" || fail "mxrquery touched rebuild: $(cat "$work/err")"
+query_all "after a partial rebuild"
+
+# A posting naming a file past the file table makes the corpus invalid
+postings=$(od -An -t u4 -j 20 -N 4 "$corpus" | tr -d ' ')
+printf '\377\377\377\377' | dd of="$corpus" bs=1 seek=$((postings + 16)) conv=notrunc 2> /dev/null
+"$work/mxrquery" query "$corpus" '*' > /dev/null 2> "$work/err"
+grep -q 'not a valid' "$work/err" || fail "corrupt corpus posting accepted"
+
+# A byname entry past the symbol table makes the index invalid
+mxr="$work/xref/$(ls "$work/xref" | sed -n 's/\.mxr$//p' | head -1).mxr"
+byname=$(od -An -t u4 -j 24 -N 4 "$mxr" | tr -d ' ')
+printf '\377\377\377\377' | dd of="$mxr" bs=1 seek="$byname" conv=notrunc 2> /dev/null
+"$work/mxrdump" "$mxr" > /dev/null 2> "$work/err"
+grep -q 'not a valid' "$work/err" || fail "corrupt byname entry accepted"
+
+[ $failed -eq 0 ] && echo "all tests passed"
+exit $failed
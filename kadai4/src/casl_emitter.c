@@ -0,0 +1,1142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "casl_emitter.h"
+#include "regalloc.h"
+#include "peephole.h"
+#include "overlay.h"
+#include "token.h"
+
+// CASL backend for the IR.
+//
+// Temporaries live in the registers chosen by regalloc.c (GR3-GR7) or,
+// when spilled, in words T0001, T0002, ... GR1 and GR2 are scratch:
+//   GR1  spilled results and operands, library arguments
+//   GR2  array index or parameter address, library arguments
+// Library routines (WRITEINT, READINT, ...) take their arguments in GR1
+// and GR2 and may change any general register, as may user procedures;
+// the allocator keeps nothing in a register across a call.
+//
+// Globals are words $x; the locals and parameters of procedures share one
+// region laid out by overlay.c, whose words are F0001, F0002, ...
+
+typedef struct {
+    const IrModule *m;
+    const IrFunc *f;
+    RegAlloc *ra;       // locations of the current function's temps
+    const IrInsn **folded;  // per temp: its LOAD, merged into the one use
+    char **labels;      // per var: its label in the program text
+    char *used;         // per var: referenced at all
+    Overlay *overlay;
+    CaslCode code;      // program text, written after the peephole pass
+    FILE *out;
+    int next_label;     // labels local to the emitter, after the module's
+    int temp_base;      // slot of t0 in the current function
+    int ntemp_slots;
+    int nargcells;
+} Emitter;
+
+static void emit_label(Emitter *e, const char *format, ...) {
+    char label[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(label, sizeof(label), format, args);
+    va_end(args);
+    casl_code_label(&e->code, label);
+}
+
+static void emit_insn(Emitter *e, const char *opc, const char *format, ...) {
+    char operands[128] = "";
+    if (format && format[0]) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(operands, sizeof(operands), format, args);
+        va_end(args);
+    }
+    casl_code_insn(&e->code, NULL, opc, operands);
+}
+
+static void emit_comment(Emitter *e, const char *format, ...) {
+    char text[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    casl_code_comment(&e->code, text);
+}
+
+static int new_local_label(Emitter *e) {
+    return e->next_label++;
+}
+
+// Operands
+
+static const char *reg_names[8] = {
+    "GR0", "GR1", "GR2", "GR3", "GR4", "GR5", "GR6", "GR7"
+};
+
+static int is_folded(Emitter *e, IrValue v) {
+    return v.kind == IR_TEMP && e->folded[v.value] != NULL;
+}
+
+// Register holding v, 0 for constants, spilled and folded temps
+static int reg_of(Emitter *e, IrValue v) {
+    return v.kind == IR_TEMP && !is_folded(e, v) ? e->ra->reg[v.value] : 0;
+}
+
+static int spill_slot(Emitter *e, int t) {
+    return e->temp_base + e->ra->slot[t] + 1;
+}
+
+// v as the second operand of an instruction: GRn, a spill word or a literal
+static const char* operand(Emitter *e, IrValue v, char *buf) {
+    if (v.kind == IR_TEMP && reg_of(e, v)) {
+        return reg_names[reg_of(e, v)];
+    }
+    if (v.kind == IR_TEMP) {
+        sprintf(buf, "T%04d", spill_slot(e, v.value));
+    } else {
+        sprintf(buf, "=%d", v.value);
+    }
+    return buf;
+}
+
+// Copy v into register r
+static void load_into(Emitter *e, IrValue v, int r) {
+    if (v.kind == IR_TEMP) {
+        int src = reg_of(e, v);
+        if (src == r) return;
+        if (src) {
+            emit_insn(e, "LD", "%s,%s", reg_names[r], reg_names[src]);
+        } else {
+            emit_insn(e, "LD", "%s,T%04d", reg_names[r], spill_slot(e, v.value));
+        }
+    } else {
+        emit_insn(e, "LAD", "%s,%d", reg_names[r], v.value);
+    }
+}
+
+// Register holding v, loading it into `scratch` when it has none
+static int value_in_reg(Emitter *e, IrValue v, int scratch) {
+    int r = reg_of(e, v);
+    if (r) return r;
+    load_into(e, v, scratch);
+    return scratch;
+}
+
+// Register to compute temp t in: its own, or GR1 when it is spilled
+static int dst_reg(Emitter *e, int t) {
+    int r = e->ra->reg[t];
+    return r ? r : 1;
+}
+
+// Move a result computed in r to where temp t lives
+static void finish_dst(Emitter *e, int t, int r) {
+    int home = e->ra->reg[t];
+    if (home == r) return;
+    if (home) {
+        emit_insn(e, "LD", "%s,%s", reg_names[home], reg_names[r]);
+    } else {
+        emit_insn(e, "ST", "%s,T%04d", reg_names[r], spill_slot(e, t));
+    }
+}
+
+static const IrVar* var_of(Emitter *e, int var) {
+    return &e->m->vars[var];
+}
+
+static const char* var_label(Emitter *e, int var) {
+    return e->labels[var];
+}
+
+// r = var or var[index]
+static void load_var(Emitter *e, int var, IrValue index, int r) {
+    const IrVar *v = var_of(e, var);
+    if (v->size > 0) {
+        int x = value_in_reg(e, index, 2);
+        emit_insn(e, "LD", "%s,%s,%s", reg_names[r], var_label(e, var), reg_names[x]);
+    } else if (v->kind == IRV_PARAM) {
+        emit_insn(e, "LD", "GR2,%s", var_label(e, var));
+        emit_insn(e, "LD", "%s,0,GR2", reg_names[r]);
+    } else {
+        emit_insn(e, "LD", "%s,%s", reg_names[r], var_label(e, var));
+    }
+}
+
+// var or var[index] = r
+static void store_var(Emitter *e, int var, IrValue index, int r) {
+    const IrVar *v = var_of(e, var);
+    if (v->size > 0) {
+        int x = value_in_reg(e, index, 2);
+        emit_insn(e, "ST", "%s,%s,%s", reg_names[r], var_label(e, var), reg_names[x]);
+    } else if (v->kind == IRV_PARAM) {
+        emit_insn(e, "LD", "GR2,%s", var_label(e, var));
+        emit_insn(e, "ST", "%s,0,GR2", reg_names[r]);
+    } else {
+        emit_insn(e, "ST", "%s,%s", reg_names[r], var_label(e, var));
+    }
+}
+
+// GR1 = address of var or var[index]
+static void address_var(Emitter *e, int var, IrValue index) {
+    const IrVar *v = var_of(e, var);
+    if (v->size > 0) {
+        int x = value_in_reg(e, index, 2);
+        emit_insn(e, "LAD", "GR1,%s,%s", var_label(e, var), reg_names[x]);
+    } else if (v->kind == IRV_PARAM) {
+        emit_insn(e, "LD", "GR1,%s", var_label(e, var));
+    } else {
+        emit_insn(e, "LAD", "GR1,%s", var_label(e, var));
+    }
+}
+
+// The variable a folded LOAD reads, as the address field of an
+// instruction. An index in register `clobbered`, which the instruction's
+// first operand is loaded into before it runs, goes through GR2.
+static const char* memory_operand(Emitter *e, const IrInsn *load, int clobbered, char *buf) {
+    const IrVar *v = var_of(e, load->var);
+    if (v->size > 0) {
+        int x = reg_of(e, load->a);
+        if (!x || x == clobbered) {
+            load_into(e, load->a, 2);
+            x = 2;
+        }
+        sprintf(buf, "%s,%s", var_label(e, load->var), reg_names[x]);
+    } else if (v->kind == IRV_PARAM) {
+        emit_insn(e, "LD", "GR2,%s", var_label(e, load->var));
+        sprintf(buf, "0,GR2");
+    } else {
+        sprintf(buf, "%s", var_label(e, load->var));
+    }
+    return buf;
+}
+
+// operand(), or the memory operand of a folded load
+static const char* source_operand(Emitter *e, IrValue v, int clobbered, char *buf) {
+    if (is_folded(e, v)) return memory_operand(e, e->folded[v.value], clobbered, buf);
+    return operand(e, v, buf);
+}
+
+// Conditional jumps taken when the last CPA found `relation` true
+static void emit_relation_jumps(Emitter *e, int relation, int label) {
+    switch (relation) {
+        case IR_EQ: emit_insn(e, "JZE", "L%04d", label); break;
+        case IR_NE: emit_insn(e, "JNZ", "L%04d", label); break;
+        case IR_LT: emit_insn(e, "JMI", "L%04d", label); break;
+        case IR_GT: emit_insn(e, "JPL", "L%04d", label); break;
+        case IR_LE:
+            emit_insn(e, "JMI", "L%04d", label);
+            emit_insn(e, "JZE", "L%04d", label);
+            break;
+        case IR_GE:
+            emit_insn(e, "JPL", "L%04d", label);
+            emit_insn(e, "JZE", "L%04d", label);
+            break;
+    }
+}
+
+// a relation b is b mirror(relation) a
+static int mirror(int relation) {
+    switch (relation) {
+        case IR_LT: return IR_GT;
+        case IR_GT: return IR_LT;
+        case IR_LE: return IR_GE;
+        case IR_GE: return IR_LE;
+        default:    return relation;
+    }
+}
+
+// Set the flags for a relation b; returns the relation to test, which
+// is mirrored when the operands had to be swapped. OR r,r sets the flags
+// as CPA with 0 would; LD r,r would too, but the peephole drops it as a
+// self move when a LAD sits between it and the jump.
+static int emit_compare(Emitter *e, IrValue a, IrValue b, int relation) {
+    char buf[128];
+    if (b.kind == IR_CONST && b.value == 0 && a.kind == IR_TEMP) {
+        if (is_folded(e, a)) {
+            const IrInsn *load = e->folded[a.value];
+            load_var(e, load->var, load->a, 1);
+            return relation;
+        }
+        int ra = reg_of(e, a);
+        if (ra) {
+            emit_insn(e, "OR", "%s,%s", reg_names[ra], reg_names[ra]);
+        } else {
+            load_into(e, a, 1);
+        }
+        return relation;
+    }
+    if (is_folded(e, a)) {
+        IrValue t = a;
+        a = b;
+        b = t;
+        relation = mirror(relation);
+    }
+    const char *src = source_operand(e, b, 0, buf);
+    int ra = value_in_reg(e, a, 1);
+    emit_insn(e, "CPA", "%s,%s", reg_names[ra], src);
+    return relation;
+}
+
+static void emit_arith(Emitter *e, const IrInsn *insn, const char *opc, int commutative) {
+    char buf[128];
+    IrValue a = insn->a, b = insn->b;
+    if (commutative && is_folded(e, a)) {
+        a = b;
+        b = insn->a;
+    }
+    int r = dst_reg(e, insn->dst);
+    // Loading a into r must not overwrite b
+    if (reg_of(e, b) == r && reg_of(e, a) != r) {
+        if (commutative) {
+            IrValue t = a;
+            a = b;
+            b = t;
+        } else {
+            r = 1;
+        }
+    }
+    const char *src = source_operand(e, b, r, buf);
+    load_into(e, a, r);
+    emit_insn(e, opc, "%s,%s", reg_names[r], src);
+    if (insn->flags & IRF_OVERFLOW) emit_insn(e, "JOV", "EOVF");
+    finish_dst(e, insn->dst, r);
+}
+
+// dst = x + c without an overflow check: LAD adds its address field to
+// the index register, with no literal word and, when x is in a register
+// of its own, no copy
+static void emit_add_const(Emitter *e, const IrInsn *insn, IrValue x, int c) {
+    int r = dst_reg(e, insn->dst);
+    int rx = reg_of(e, x);
+    if (!rx) {
+        load_into(e, x, r);
+        rx = r;
+    }
+    emit_insn(e, "LAD", "%s,%d,%s", reg_names[r], c, reg_names[rx]);
+    finish_dst(e, insn->dst, r);
+}
+
+static void emit_add(Emitter *e, const IrInsn *insn) {
+    if (!(insn->flags & IRF_OVERFLOW)) {
+        if (insn->a.kind == IR_TEMP && insn->b.kind == IR_CONST) {
+            emit_add_const(e, insn, insn->a, insn->b.value);
+            return;
+        }
+        if (insn->a.kind == IR_CONST && insn->b.kind == IR_TEMP) {
+            emit_add_const(e, insn, insn->b, insn->a.value);
+            return;
+        }
+    }
+    emit_arith(e, insn, "ADDA", 1);
+}
+
+static void emit_sub(Emitter *e, const IrInsn *insn) {
+    if (!(insn->flags & IRF_OVERFLOW) && insn->a.kind == IR_TEMP &&
+        insn->b.kind == IR_CONST && insn->b.value != -32768) {
+        emit_add_const(e, insn, insn->a, -insn->b.value);
+        return;
+    }
+    emit_arith(e, insn, "SUBA", 0);
+}
+
+// Multiply and divide by constants without MULA/DIVA, which COMET II
+// lacks and the assembler turns into library calls.
+
+#define MAX_MUL_STEPS 5
+
+static int power_of_two(int c) {
+    int k = 0;
+    if (c <= 0 || (c & (c - 1)) != 0) return -1;
+    while ((1 << k) != c) k++;
+    return k;
+}
+
+// Number of ADDA steps in the shift-and-add expansion of x * c, c > 0
+static int mul_steps(int c) {
+    int bits = 0, ones = 0;
+    for (int v = c; v; v >>= 1) {
+        bits++;
+        ones += v & 1;
+    }
+    return bits - 1 + ones - 1;
+}
+
+// r = 0 - x, with the overflow check of -(-32768) if asked for
+static void emit_negate_into(Emitter *e, IrValue x, int r, int check) {
+    char buf[16];
+    emit_insn(e, "LAD", "%s,0", reg_names[r]);
+    emit_insn(e, "SUBA", "%s,%s", reg_names[r], operand(e, x, buf));
+    if (check) emit_insn(e, "JOV", "EOVF");
+}
+
+// dst = x * c by doubling and adding. Every partial product lies between
+// 0 and the full product, so a JOV after each step reports overflow
+// exactly when MULA would.
+static int emit_multiply_const(Emitter *e, const IrInsn *insn, IrValue x, int c) {
+    int check = (insn->flags & IRF_OVERFLOW) != 0;
+    int r = dst_reg(e, insn->dst);
+    if (reg_of(e, x) == r && c != 1) r = 1;
+    if (c == 0) {
+        emit_insn(e, "LAD", "%s,0", reg_names[r]);
+    } else if (c == 1) {
+        load_into(e, x, r);
+    } else if (c == -1) {
+        emit_negate_into(e, x, r, check);
+    } else if (c < 0 || mul_steps(c) > MAX_MUL_STEPS) {
+        return 0;
+    } else if (!check && power_of_two(c) > 0) {
+        load_into(e, x, r);
+        emit_insn(e, "SLA", "%s,%d", reg_names[r], power_of_two(c));
+    } else {
+        // x stays in its own register, or a copy in GR2
+        int rx = reg_of(e, x);
+        load_into(e, x, r);
+        if (!rx || rx == r) {
+            rx = 2;
+            emit_insn(e, "LD", "GR2,%s", reg_names[r]);
+        }
+        int top = 0;
+        while ((c >> (top + 1)) != 0) top++;
+        for (int bit = top - 1; bit >= 0; bit--) {
+            emit_insn(e, "ADDA", "%s,%s", reg_names[r], reg_names[r]);
+            if (check) emit_insn(e, "JOV", "EOVF");
+            if ((c >> bit) & 1) {
+                emit_insn(e, "ADDA", "%s,%s", reg_names[r], reg_names[rx]);
+                if (check) emit_insn(e, "JOV", "EOVF");
+            }
+        }
+    }
+    finish_dst(e, insn->dst, r);
+    return 1;
+}
+
+// dst = x div 2^k, rounding toward zero like DIVA: negative dividends get
+// 2^k - 1 added before the arithmetic shift
+static void emit_divide_power(Emitter *e, const IrInsn *insn, int k) {
+    int r = dst_reg(e, insn->dst);
+    load_into(e, insn->a, r);
+    emit_insn(e, "LD", "GR2,%s", reg_names[r]);
+    emit_insn(e, "SRA", "GR2,15");
+    emit_insn(e, "SRL", "GR2,%d", 16 - k);
+    emit_insn(e, "ADDA", "%s,GR2", reg_names[r]);
+    emit_insn(e, "SRA", "%s,%d", reg_names[r], k);
+    finish_dst(e, insn->dst, r);
+}
+
+static void emit_divide(Emitter *e, const IrInsn *insn) {
+    char buf[16];
+    IrValue b = insn->b;
+    if (b.kind == IR_CONST && b.value != 0) {
+        // A non-zero constant divisor needs no zero-divide check
+        int r = dst_reg(e, insn->dst);
+        if (b.value == 1) {
+            load_into(e, insn->a, r);
+            finish_dst(e, insn->dst, r);
+            return;
+        }
+        if (b.value == -1) {
+            if (reg_of(e, insn->a) == r) r = 1;
+            emit_negate_into(e, insn->a, r, (insn->flags & IRF_OVERFLOW) != 0);
+            finish_dst(e, insn->dst, r);
+            return;
+        }
+        if (power_of_two(b.value) > 0) {
+            emit_divide_power(e, insn, power_of_two(b.value));
+            return;
+        }
+    }
+    int r = dst_reg(e, insn->dst);
+    if (reg_of(e, b) == r && reg_of(e, insn->a) != r) r = 1;
+    load_into(e, insn->a, r);
+    const char *divisor = operand(e, b, buf);
+    if (insn->flags & IRF_ZERODIV) {
+        // The zero-divide handler expects ZF set by the divisor
+        if (b.kind == IR_CONST) {
+            if (b.value == 0) {
+                emit_insn(e, "LAD", "GR2,0");
+                emit_insn(e, "OR", "GR2,GR2");
+                emit_insn(e, "JZE", "E0DIV");
+            }
+        } else if (reg_of(e, b)) {
+            emit_insn(e, "OR", "%s,%s", divisor, divisor);
+            emit_insn(e, "JZE", "E0DIV");
+        } else {
+            load_into(e, b, 2);
+            emit_insn(e, "JZE", "E0DIV");
+            divisor = "GR2";
+        }
+    }
+    emit_insn(e, "DIVA", "%s,%s", reg_names[r], divisor);
+    if (insn->flags & IRF_OVERFLOW) emit_insn(e, "JOV", "EOVF");
+    finish_dst(e, insn->dst, r);
+}
+
+static void emit_multiply(Emitter *e, const IrInsn *insn) {
+    if (insn->b.kind == IR_CONST && emit_multiply_const(e, insn, insn->a, insn->b.value)) return;
+    if (insn->a.kind == IR_CONST && emit_multiply_const(e, insn, insn->b, insn->a.value)) return;
+    emit_arith(e, insn, "MULA", 1);
+}
+
+static void emit_call(Emitter *e, const IrInsn *insn) {
+    for (int i = 0; i < insn->nargs; i++) {
+        const IrArg *arg = &insn->args[i];
+        const IrVar *v = var_of(e, arg->var);
+        if (arg->kind == IR_ARG_VALUE) {
+            int cell = ++e->nargcells;
+            int r = value_in_reg(e, arg->value, 1);
+            emit_insn(e, "ST", "%s,A%04d", reg_names[r], cell);
+            emit_insn(e, "PUSH", "A%04d", cell);
+        } else if (arg->kind == IR_ARG_ELEM) {
+            int x = value_in_reg(e, arg->value, 2);
+            emit_insn(e, "PUSH", "%s,%s", var_label(e, arg->var), reg_names[x]);
+        } else if (v->kind == IRV_PARAM) {
+            emit_insn(e, "LD", "GR1,%s", var_label(e, arg->var));
+            emit_insn(e, "PUSH", "0,GR1");
+        } else {
+            emit_insn(e, "PUSH", "%s", var_label(e, arg->var));
+        }
+    }
+    emit_insn(e, "CALL", "$%s", e->m->funcs[insn->callee]->name);
+}
+
+static void emit_write(Emitter *e, const IrInsn *insn) {
+    load_into(e, insn->a, 1);
+    emit_insn(e, "LAD", "GR2,%d", insn->imm);
+    switch (insn->mode) {
+        case TCHAR:    emit_insn(e, "CALL", "WRITECHAR"); break;
+        case TBOOLEAN: emit_insn(e, "CALL", "WRITEBOOL"); break;
+        default:       emit_insn(e, "CALL", "WRITEINT"); break;
+    }
+}
+
+static void emit_insn_ir(Emitter *e, const IrInsn *insn) {
+    char buf[16];
+    switch (insn->op) {
+        case IR_NOP:
+            break;
+        case IR_MOV: {
+            int home = e->ra->reg[insn->dst];
+            if (home) {
+                load_into(e, insn->a, home);
+            } else {
+                int r = value_in_reg(e, insn->a, 1);
+                finish_dst(e, insn->dst, r);
+            }
+            break;
+        }
+        case IR_LOAD: {
+            if (e->folded[insn->dst]) break;
+            int r = dst_reg(e, insn->dst);
+            load_var(e, insn->var, insn->a, r);
+            finish_dst(e, insn->dst, r);
+            break;
+        }
+        case IR_STORE:
+            store_var(e, insn->var, insn->a, value_in_reg(e, insn->b, 1));
+            break;
+        case IR_ADD: emit_add(e, insn); break;
+        case IR_SUB: emit_sub(e, insn); break;
+        case IR_MUL: emit_multiply(e, insn); break;
+        case IR_AND: emit_arith(e, insn, "AND", 1); break;
+        case IR_OR:  emit_arith(e, insn, "OR", 1); break;
+        case IR_DIV: emit_divide(e, insn); break;
+        case IR_NEG: {
+            int r = dst_reg(e, insn->dst);
+            if (reg_of(e, insn->a) == r) r = 1;
+            emit_insn(e, "LAD", "%s,0", reg_names[r]);
+            emit_insn(e, "SUBA", "%s,%s", reg_names[r], operand(e, insn->a, buf));
+            if (insn->flags & IRF_OVERFLOW) emit_insn(e, "JOV", "EOVF");
+            finish_dst(e, insn->dst, r);
+            break;
+        }
+        case IR_NOT: {
+            int r = dst_reg(e, insn->dst);
+            load_into(e, insn->a, r);
+            emit_insn(e, "XOR", "%s,=1", reg_names[r]);
+            finish_dst(e, insn->dst, r);
+            break;
+        }
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE: {
+            // LAD leaves the flags of the CPA alone
+            int done = new_local_label(e);
+            int r = dst_reg(e, insn->dst);
+            int relation = emit_compare(e, insn->a, insn->b, insn->op);
+            emit_insn(e, "LAD", "%s,1", reg_names[r]);
+            emit_relation_jumps(e, relation, done);
+            emit_insn(e, "LAD", "%s,0", reg_names[r]);
+            emit_label(e, "L%04d", done);
+            finish_dst(e, insn->dst, r);
+            break;
+        }
+        case IR_CHECK: {
+            // Unsigned compare also catches negative indices
+            int r = value_in_reg(e, insn->a, 1);
+            emit_insn(e, "CPL", "%s,=%d", reg_names[r], insn->imm);
+            emit_insn(e, "JPL", "EROV");
+            emit_insn(e, "JZE", "EROV");
+            break;
+        }
+        case IR_CALL:
+            emit_call(e, insn);
+            break;
+        case IR_READ:
+            address_var(e, insn->var, insn->a);
+            emit_insn(e, "CALL", var_of(e, insn->var)->type == TCHAR ? "READCHAR" : "READINT");
+            break;
+        case IR_READLN:
+            emit_insn(e, "CALL", "READLINE");
+            break;
+        case IR_WRITE:
+            emit_write(e, insn);
+            break;
+        case IR_WRITESTR:
+            emit_insn(e, "LAD", "GR1,STR%d", insn->imm);
+            emit_insn(e, "LAD", "GR2,%d", (int)strlen(e->m->strings[insn->imm]));
+            emit_insn(e, "CALL", "WRITESTR");
+            break;
+        case IR_WRITELN:
+            emit_insn(e, "CALL", "WRITELINE");
+            break;
+        case IR_JUMP:
+            emit_insn(e, "JUMP", "L%04d", insn->target);
+            break;
+        case IR_BRANCH:
+            emit_relation_jumps(e, emit_compare(e, insn->a, insn->b, insn->mode), insn->target);
+            emit_insn(e, "JUMP", "L%04d", insn->target2);
+            break;
+        case IR_RET:
+            if (e->f->is_main) emit_insn(e, "CALL", "FLUSH");
+            emit_insn(e, "RET", "");
+            break;
+        default:
+            break;
+    }
+}
+
+// Instruction selection.
+//
+// The IR is a sequence of trees cut at the temps; a temp loaded from a
+// variable and used once is the leaf load(v) of its user's tree, and
+// matching the tree as a whole picks a cheaper form than emitting each
+// node on its own (steps / words, beyond the operation itself):
+//
+//   op(x, load v)       LD t,v / OP r,t          2 / 3
+//                       OP r,v                   1 / 2
+//   op(x, load a[i])    LD t,a,i / OP r,t        2 / 3
+//                       OP r,a,i                 1 / 2
+//   cmp(load v, 0)      LD t,v / CPA t,=0        2 / 5
+//                       LD GR1,v                 1 / 2
+//   cmp(x, 0)           CPA x,=0                 1 / 3
+//                       LD x,x                   1 / 1
+//   add(x, c)           LD r,x / ADDA r,=c       2 / 4
+//                       LAD r,c,x                1 / 2
+//
+// for OP in ADDA, SUBA, AND, OR, CPA (MULA and DIVA are library calls
+// taking registers). The last two need no selection: emit_compare() and
+// emit_add() always use them. A load is folded into its user only if no
+// store, read or call comes between them, and a load of an element only
+// if they are adjacent, so that the index is still in its register.
+
+// The LOAD defining v, if v is used once and nothing between it and
+// insns[j] can change what it reads
+static const IrInsn* foldable(Emitter *e, const IrBlock *b, int j, IrValue v, const int *uses) {
+    if (v.kind != IR_TEMP || uses[v.value] != 1) return NULL;
+    int adjacent = 1;
+    for (int i = j - 1; i >= 0; i--) {
+        const IrInsn *insn = &b->insns[i];
+        if (insn->dst == v.value) {
+            if (insn->op != IR_LOAD) return NULL;
+            if (var_of(e, insn->var)->size > 0 && !adjacent) return NULL;
+            return insn;
+        }
+        if (insn->op == IR_STORE || insn->op == IR_READ || insn->op == IR_CALL) return NULL;
+        if (insn->op != IR_NOP) adjacent = 0;
+    }
+    return NULL;
+}
+
+static int try_fold(Emitter *e, const IrBlock *b, int j, IrValue v, const int *uses) {
+    const IrInsn *load = foldable(e, b, j, v, uses);
+    if (load) e->folded[v.value] = load;
+    return load != NULL;
+}
+
+static void select_operands(Emitter *e, const IrFunc *f) {
+    int *uses = calloc(f->ntemps + 1, sizeof(int));
+    int *defs = calloc(f->ntemps + 1, sizeof(int));
+    e->folded = calloc(f->ntemps + 1, sizeof(IrInsn *));
+    if (!uses || !defs || !e->folded) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < f->nblocks; i++) {
+        IrBlock *b = f->blocks[i];
+        for (int j = 0; j < b->ninsns; j++) {
+            IrValue *used[64];
+            int n = ir_uses(&b->insns[j], used, 64);
+            for (int k = 0; k < n; k++) {
+                if (used[k]->kind == IR_TEMP) uses[used[k]->value]++;
+            }
+            if (b->insns[j].dst > 0) defs[b->insns[j].dst]++;
+        }
+    }
+    for (int t = 1; t <= f->ntemps; t++) {
+        if (defs[t] != 1) uses[t] = 0;
+    }
+
+    for (int i = 0; i < f->nblocks; i++) {
+        const IrBlock *b = f->blocks[i];
+        for (int j = 0; j < b->ninsns; j++) {
+            const IrInsn *insn = &b->insns[j];
+            switch (insn->op) {
+                case IR_ADD: case IR_AND: case IR_OR:
+                    // A constant partner has its immediate form already
+                    if (insn->a.kind == IR_CONST || insn->b.kind == IR_CONST) break;
+                    if (!try_fold(e, b, j, insn->b, uses)) try_fold(e, b, j, insn->a, uses);
+                    break;
+                case IR_SUB:
+                    if (insn->a.kind != IR_CONST) try_fold(e, b, j, insn->b, uses);
+                    break;
+                case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+                case IR_BRANCH:
+                    if (insn->b.kind == IR_CONST) {
+                        if (insn->b.value == 0) try_fold(e, b, j, insn->a, uses);
+                    } else if (!try_fold(e, b, j, insn->b, uses) && reg_of(e, insn->b)) {
+                        try_fold(e, b, j, insn->a, uses);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    free(uses);
+    free(defs);
+}
+
+static void emit_function(Emitter *e, const IrFunc *f) {
+    e->f = f;
+    e->ra = regalloc_function(f);
+    select_operands(e, f);
+    e->temp_base = e->ntemp_slots;
+    e->ntemp_slots += e->ra->nslots;
+
+    if (!f->is_main) {
+        emit_comment(e, "; procedure %s", f->name);
+        emit_label(e, "$%s", f->name);
+        // Pop the return address, then the argument addresses (last first)
+        if (f->nparams > 0) {
+            emit_insn(e, "POP", "GR2");
+            for (int i = f->nparams - 1; i >= 0; i--) {
+                emit_insn(e, "POP", "GR1");
+                emit_insn(e, "ST", "GR1,%s", var_label(e, f->params[i]));
+            }
+            emit_insn(e, "PUSH", "0,GR2");
+        }
+    }
+    for (int i = 0; i < f->nblocks; i++) {
+        const IrBlock *b = f->blocks[i];
+        emit_label(e, "L%04d", b->label);
+        for (int j = 0; j < b->ninsns; j++) {
+            emit_insn_ir(e, &b->insns[j]);
+        }
+    }
+    emit_comment(e, "");
+    regalloc_free(e->ra);
+    e->ra = NULL;
+    free(e->folded);
+    e->folded = NULL;
+}
+
+static void emit_string_constant(Emitter *e, int index) {
+    fprintf(e->out, "STR%d\tDC\t'", index);
+    for (const char *s = e->m->strings[index]; *s; s++) {
+        if (*s == '\'') fputc('\'', e->out);
+        fputc(*s, e->out);
+    }
+    fprintf(e->out, "'\n");
+}
+
+// Variables the optimizer left unreferenced (locals of inlined
+// procedures, constants propagated away) get no storage
+static char* referenced_vars(const IrModule *m) {
+    char *used = calloc(m->nvars ? m->nvars : 1, 1);
+    if (!used) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < m->nfuncs; i++) {
+        const IrFunc *f = m->funcs[i];
+        for (int p = 0; p < f->nparams; p++) used[f->params[p]] = 1;
+        for (int b = 0; b < f->nblocks; b++) {
+            const IrBlock *block = f->blocks[b];
+            for (int j = 0; j < block->ninsns; j++) {
+                const IrInsn *insn = &block->insns[j];
+                if (insn->var >= 0) used[insn->var] = 1;
+                for (int k = 0; k < insn->nargs; k++) {
+                    if (insn->args[k].kind != IR_ARG_VALUE) used[insn->args[k].var] = 1;
+                }
+            }
+        }
+    }
+    return used;
+}
+
+// F, up to 11 characters of an int and the terminator
+#define OVERLAY_LABEL_SIZE 13
+
+// Labels of the variables: their own, or the word of the overlay region
+// they start at
+static void lay_out_vars(Emitter *e) {
+    const IrModule *m = e->m;
+    e->used = referenced_vars(m);
+    e->overlay = overlay_layout(m, e->used);
+    e->labels = calloc(m->nvars ? m->nvars : 1, sizeof(char *));
+    if (!e->labels) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < m->nvars; i++) {
+        if (e->overlay->offset[i] < 0) {
+            e->labels[i] = m->vars[i].label;
+            continue;
+        }
+        e->labels[i] = malloc(OVERLAY_LABEL_SIZE);
+        if (!e->labels[i]) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+        snprintf(e->labels[i], OVERLAY_LABEL_SIZE, "F%04d", e->overlay->offset[i] + 1);
+    }
+}
+
+// The overlay region, with a label wherever a variable starts
+static void emit_overlay(Emitter *e) {
+    const IrModule *m = e->m;
+    const Overlay *o = e->overlay;
+    if (o->size == 0) return;
+    char *starts = calloc(o->size, 1);
+    if (!starts) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < m->nvars; i++) {
+        if (o->offset[i] >= 0) starts[o->offset[i]] = 1;
+    }
+    fprintf(e->out, "; procedure variables: %d words overlaid in %d\n", o->words, o->size);
+    for (int at = 0; at < o->size; ) {
+        int end = at + 1;
+        while (end < o->size && !starts[end]) end++;
+        if (end - at == 1) {
+            fprintf(e->out, "F%04d\tDC\t0\n", at + 1);
+        } else {
+            fprintf(e->out, "F%04d\tDS\t%d\n", at + 1, end - at);
+        }
+        at = end;
+    }
+    free(starts);
+}
+
+static void emit_data(Emitter *e) {
+    const IrModule *m = e->m;
+    const char *used = e->used;
+    fprintf(e->out, "; variables\n");
+    for (int i = 0; i < m->nvars; i++) {
+        const IrVar *v = &m->vars[i];
+        if (!used[i] || e->overlay->offset[i] >= 0) continue;
+        if (v->size > 0) {
+            fprintf(e->out, "%s\tDS\t%d\n", v->label, v->size);
+        } else {
+            fprintf(e->out, "%s\tDC\t0\n", v->label);
+        }
+    }
+    emit_overlay(e);
+    for (int i = 1; i <= e->ntemp_slots; i++) {
+        fprintf(e->out, "T%04d\tDC\t0\n", i);
+    }
+    for (int i = 1; i <= e->nargcells; i++) {
+        fprintf(e->out, "A%04d\tDC\t0\n", i);
+    }
+    for (int i = 0; i < m->nstrings; i++) {
+        emit_string_constant(e, i);
+    }
+    fprintf(e->out, "\n");
+}
+
+static void emit_error_handlers(Emitter *e) {
+    FILE *out = e->out;
+    fprintf(out, "; Error handlers\n");
+
+    // Overflow handler
+    fprintf(out, "EOVF\n");
+    fprintf(out, "    CALL WRITELINE\n");
+    fprintf(out, "    LAD GR1, EOVF1\n");
+    fprintf(out, "    CALL WRITESTR\n");
+    fprintf(out, "    CALL WRITELINE\n");
+    fprintf(out, "    SVC 1\n");
+    fprintf(out, "EOVF1    DC    '***** Run-Time Error: Overflow *****'\n\n");
+
+    // Zero-Divide handler
+    fprintf(out, "; Zero-Divide error handling\n");
+    fprintf(out, "E0DIV\n");
+    fprintf(out, "    JNZ EOVF\n");
+    fprintf(out, "    CALL WRITELINE\n");
+    fprintf(out, "    LAD GR1, E0DIV1\n");
+    fprintf(out, "    LD GR2, GR0\n");
+    fprintf(out, "    CALL WRITESTR\n");
+    fprintf(out, "    CALL WRITELINE\n");
+    fprintf(out, "    SVC 2\n");
+    fprintf(out, "E0DIV1  DC '***** Run-Time Error: Zero-Divide *****'\n\n");
+
+    // Range-Over handler
+    fprintf(out, "; Range-Over error handling\n");
+    fprintf(out, "EROV\n");
+    fprintf(out, "    CALL WRITELINE\n");
+    fprintf(out, "    LAD GR1, EROV1\n");
+    fprintf(out, "    LD GR2, GR0\n");
+    fprintf(out, "    CALL WRITESTR\n");
+    fprintf(out, "    CALL WRITELINE\n");
+    fprintf(out, "    SVC 3\n");
+    fprintf(out, "EROV1  DC '***** Run-Time Error: Range-Over in Array Index *****'\n\n");
+}
+
+void emit_casl(const IrModule *m, FILE *out) {
+    Emitter e;
+    memset(&e, 0, sizeof(e));
+    e.m = m;
+    e.out = out;
+    e.next_label = m->nlabels + 1;
+    casl_code_init(&e.code);
+
+    char program[128];
+    snprintf(program, sizeof(program), "%%%s", m->name);
+    casl_code_insn(&e.code, program, "START", "L0001");
+    emit_comment(&e, "; program %s;", m->name);
+    emit_comment(&e, "");
+    lay_out_vars(&e);
+
+    // Main program first so that START falls into L0001
+    emit_function(&e, m->funcs[0]);
+    for (int i = 1; i < m->nfuncs; i++) {
+        emit_function(&e, m->funcs[i]);
+    }
+    peephole_optimize(&e.code);
+    casl_code_write(&e.code, out);
+    casl_code_free(&e.code);
+
+    emit_data(&e);
+    emit_error_handlers(&e);
+    fprintf(out, "\tEND\n");
+
+    for (int i = 0; i < m->nvars; i++) {
+        if (e.overlay->offset[i] >= 0) free(e.labels[i]);
+    }
+    free(e.labels);
+    free(e.used);
+    overlay_free(e.overlay);
+}
+
+// Label index
+
+static size_t hash_label(const char *label) {
+    size_t h = 5381;
+    while (*label) h = h * 33 + (unsigned char)*label++;
+    return h;
+}
+
+static CaslLabelEntry* label_entry(const CaslLabelIndex *x, const char *label) {
+    for (int e = x->buckets[hash_label(label) & (x->nbuckets - 1)]; e >= 0; e = x->entries[e].next) {
+        if (strcmp(x->entries[e].label, label) == 0) return &x->entries[e];
+    }
+    return NULL;
+}
+
+// Drop the entry of the label line at index; its string goes with it
+static void unindex_label(CaslLabelIndex *x, const char *label, int index) {
+    int *link = &x->buckets[hash_label(label) & (x->nbuckets - 1)];
+    while (*link >= 0 && strcmp(x->entries[*link].label, label) != 0) link = &x->entries[*link].next;
+    if (*link < 0 || x->entries[*link].line != index) return;
+    x->entries[*link].line = -1;
+    *link = x->entries[*link].next;
+}
+
+static void free_label_index(CaslCode *c) {
+    if (!c->index) return;
+    free(c->index->entries);
+    free(c->index->buckets);
+    free(c->index);
+    c->index = NULL;
+}
+
+// Count the operands of line in the index, by +1 or -1
+static void count_uses(CaslCode *c, const CaslLine *line, int delta) {
+    if (!c->index) return;
+    for (int k = 0; k < line->nops; k++) {
+        CaslLabelEntry *entry = label_entry(c->index, line->ops[k]);
+        if (entry) entry->uses += delta;
+    }
+}
+
+void casl_code_index_labels(CaslCode *c) {
+    free_label_index(c);
+    int labels = 0;
+    for (int i = 0; i < c->n; i++) {
+        if (c->lines[i].kind == CASL_LABEL) labels++;
+    }
+    CaslLabelIndex *x = calloc(1, sizeof(CaslLabelIndex));
+    int nbuckets = 256;
+    while (nbuckets < labels * 2) nbuckets *= 2;
+    if (x) {
+        x->entries = malloc((labels ? labels : 1) * sizeof(CaslLabelEntry));
+        x->buckets = malloc(nbuckets * sizeof(int));
+    }
+    if (!x || !x->entries || !x->buckets) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    x->nbuckets = nbuckets;
+    for (int b = 0; b < nbuckets; b++) x->buckets[b] = -1;
+    // The first line of a label wins, as a forward scan would find it
+    for (int i = 0; i < c->n; i++) {
+        const CaslLine *line = &c->lines[i];
+        if (line->kind != CASL_LABEL || label_entry(x, line->label)) continue;
+        size_t b = hash_label(line->label) & (nbuckets - 1);
+        x->entries[x->n] = (CaslLabelEntry){ line->label, i, 0, x->buckets[b] };
+        x->buckets[b] = x->n++;
+    }
+    c->index = x;
+    for (int i = 0; i < c->n; i++) count_uses(c, &c->lines[i], 1);
+}
+
+int casl_code_find_label(const CaslCode *c, const char *label) {
+    const CaslLabelEntry *entry = label_entry(c->index, label);
+    return entry ? entry->line : -1;
+}
+
+int casl_code_label_uses(const CaslCode *c, const char *label) {
+    const CaslLabelEntry *entry = label_entry(c->index, label);
+    return entry ? entry->uses : 0;
+}
+
+// Line buffer
+
+static char* copy_string(const char *s) {
+    char *p = malloc(strlen(s) + 1);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    strcpy(p, s);
+    return p;
+}
+
+void casl_code_init(CaslCode *c) {
+    c->lines = NULL;
+    c->n = 0;
+    c->cap = 0;
+    c->index = NULL;
+}
+
+static void free_line(CaslLine *line) {
+    free(line->label);
+    free(line->text);
+    for (int i = 0; i < line->nops; i++) free(line->ops[i]);
+}
+
+void casl_code_free(CaslCode *c) {
+    for (int i = 0; i < c->n; i++) free_line(&c->lines[i]);
+    free(c->lines);
+    free_label_index(c);
+    casl_code_init(c);
+}
+
+static CaslLine* new_line(CaslCode *c, CaslLineKind kind) {
+    if (c->n == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 256;
+        c->lines = realloc(c->lines, c->cap * sizeof(CaslLine));
+        if (!c->lines) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+    }
+    CaslLine *line = &c->lines[c->n++];
+    memset(line, 0, sizeof(*line));
+    line->kind = kind;
+    return line;
+}
+
+void casl_code_label(CaslCode *c, const char *label) {
+    new_line(c, CASL_LABEL)->label = copy_string(label);
+}
+
+// Operands are split at commas; code operands never contain quotes
+void casl_code_set_ops(CaslCode *c, CaslLine *line, const char *operands) {
+    count_uses(c, line, -1);
+    for (int i = 0; i < line->nops; i++) free(line->ops[i]);
+    line->nops = 0;
+    const char *p = operands;
+    while (*p && line->nops < CASL_MAX_OPS) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        char *op = malloc(len + 1);
+        if (!op) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+        memcpy(op, p, len);
+        op[len] = '\0';
+        line->ops[line->nops++] = op;
+        p += len;
+        if (*p == ',') p++;
+    }
+    count_uses(c, line, 1);
+}
+
+void casl_code_insn(CaslCode *c, const char *label, const char *opc, const char *operands) {
+    CaslLine *line = new_line(c, CASL_INSN);
+    if (label) line->label = copy_string(label);
+    snprintf(line->opc, sizeof(line->opc), "%s", opc);
+    casl_code_set_ops(c, line, operands);
+}
+
+void casl_code_comment(CaslCode *c, const char *text) {
+    new_line(c, CASL_COMMENT)->text = copy_string(text);
+}
+
+void casl_code_remove(CaslCode *c, int index) {
+    if (c->index) {
+        const CaslLine *line = &c->lines[index];
+        count_uses(c, line, -1);
+        if (line->kind == CASL_LABEL) unindex_label(c->index, line->label, index);
+        for (int e = 0; e < c->index->n; e++) {
+            CaslLabelEntry *entry = &c->index->entries[e];
+            if (entry->line > index) entry->line--;
+        }
+    }
+    free_line(&c->lines[index]);
+    memmove(&c->lines[index], &c->lines[index + 1], (c->n - index - 1) * sizeof(CaslLine));
+    c->n--;
+}
+
+void casl_code_write(const CaslCode *c, FILE *out) {
+    for (int i = 0; i < c->n; i++) {
+        const CaslLine *line = &c->lines[i];
+        switch (line->kind) {
+            case CASL_LABEL:
+                fprintf(out, "%s\n", line->label);
+                break;
+            case CASL_COMMENT:
+                fprintf(out, "%s\n", line->text);
+                break;
+            case CASL_INSN:
+                fprintf(out, "%s\t%s", line->label ? line->label : "", line->opc);
+                for (int j = 0; j < line->nops; j++) {
+                    fprintf(out, "%c%s", j == 0 ? '\t' : ',', line->ops[j]);
+                }
+                fprintf(out, "\n");
+                break;
+        }
+    }
+}
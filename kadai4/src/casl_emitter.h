@@ -0,0 +1,69 @@
+#ifndef CASL_EMITTER_H
+#define CASL_EMITTER_H
+
+#include <stdio.h>
+#include "ir.h"
+
+// Program text is collected as a list of lines before it is written, so
+// that the peephole optimizer (peephole.c) can rewrite it.
+typedef enum {
+    CASL_INSN,      // [label] OPC op1,op2,op3
+    CASL_LABEL,     // a label on a line of its own
+    CASL_COMMENT    // text written as is, "" for a blank line
+} CaslLineKind;
+
+#define CASL_MAX_OPS 3
+
+typedef struct {
+    CaslLineKind kind;
+    char *label;    // CASL_LABEL, or the label field of an instruction
+    char *text;     // CASL_COMMENT
+    char opc[8];
+    char *ops[CASL_MAX_OPS];
+    int nops;
+} CaslLine;
+
+// Where each label line is and how many operands name it, kept up to
+// date by casl_code_remove() and casl_code_set_ops() while it exists
+typedef struct {
+    const char *label;  // the label line's own string
+    int line;           // index of the label line, -1 once it is removed
+    int uses;
+    int next;           // next entry in the same bucket, -1 at the end
+} CaslLabelEntry;
+
+typedef struct {
+    CaslLabelEntry *entries;
+    int n;
+    int *buckets;
+    int nbuckets;       // a power of two
+} CaslLabelIndex;
+
+typedef struct {
+    CaslLine *lines;
+    int n;
+    int cap;
+    CaslLabelIndex *index;  // NULL unless casl_code_index_labels() was called
+} CaslCode;
+
+void casl_code_init(CaslCode *c);
+void casl_code_free(CaslCode *c);
+void casl_code_label(CaslCode *c, const char *label);
+void casl_code_insn(CaslCode *c, const char *label, const char *opc, const char *operands);
+void casl_code_comment(CaslCode *c, const char *text);
+void casl_code_remove(CaslCode *c, int index);
+void casl_code_set_ops(CaslCode *c, CaslLine *line, const char *operands);
+
+// (Re)build the label index of the program as it is now
+void casl_code_index_labels(CaslCode *c);
+// Index of the label line for label, -1 if none (needs the index)
+int casl_code_find_label(const CaslCode *c, const char *label);
+// Operands naming label, on any line (needs the index)
+int casl_code_label_uses(const CaslCode *c, const char *label);
+
+void casl_code_write(const CaslCode *c, FILE *out);
+
+// Write the CASL program for a verified IR module
+void emit_casl(const IrModule *m, FILE *out);
+
+#endif
@@ -3,15 +3,41 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include "codegenerator.h"
+#include "casl_emitter.h"
+#include "optimizer.h"
 #include "compiler.h"
+#include "scan.h"
 #include "token.h"
 #include "debug.h"
 
+#define MAX_VALUE_STACK 256
+#define MAX_CALL_ARGS   MAX_PARAMS
+
 // Define caslfp here (not just declare)
-FILE* caslfp = NULL;
-static int temp_var_count = 0;
-static int label_counter = 1;
-static char current_proc[256] = "";
+THREAD_LOCAL FILE* caslfp = NULL;
+int dump_ir = 0;
+
+// Builder state for the module being parsed
+static THREAD_LOCAL IrModule *module = NULL;
+static THREAD_LOCAL IrFunc *func = NULL;        // function being built
+static THREAD_LOCAL IrBlock *block = NULL;      // NULL after a terminator
+static THREAD_LOCAL IrBlock *main_block = NULL; // main program block while in a procedure
+static THREAD_LOCAL int exit_label = 0;         // RET block of func
+static THREAD_LOCAL int main_exit_label = 0;
+static THREAD_LOCAL char current_proc[256] = "";
+
+// Accumulator and saved operands
+static THREAD_LOCAL IrValue acc;
+static THREAD_LOCAL IrValue value_stack[MAX_VALUE_STACK];
+static THREAD_LOCAL int value_sp = 0;
+
+// Variable the accumulator was loaded from, for by-reference arguments
+static THREAD_LOCAL int acc_var = -1;
+static THREAD_LOCAL IrValue acc_index;
+
+// Arguments of the call being parsed
+static THREAD_LOCAL IrArg call_args[MAX_CALL_ARGS];
+static THREAD_LOCAL int call_nargs = 0;
 
 static void debug_codegen_printf(const char *format, ...) {
     if (debug_codegen) {
@@ -23,408 +49,485 @@ static void debug_codegen_printf(const char *format, ...) {
     }
 }
 
-int get_label_num(void) {
-    return label_counter++;
+static void ensure_module(void) {
+    if (module) return;
+    // A procedure parsed on its own (see parse_procedure_fragment)
+    module = ir_module_new("");
+    func = ir_add_func(module, "", 1);
+    block = ir_add_block(func, ir_new_label(module));
+    main_exit_label = exit_label = ir_new_label(module);
 }
 
-void gen_label(const char* label) {
-    fprintf(caslfp, "L%04d\n", label_counter++);
+// Current block, opening an unreachable one after a terminator
+static IrBlock* current_block(void) {
+    ensure_module();
+    if (!block) block = ir_add_block(func, ir_new_label(module));
+    return block;
 }
 
-void gen_code(const char* opc, const char* opr) {
-    fprintf(caslfp, "\t%s\t%s\n", opc, opr);
+static IrInsn* emit(IrOp op) {
+    IrInsn *insn = ir_append(current_block(), op);
+    insn->line = get_linenum();
+    if (ir_is_terminator(op)) block = NULL;
+    return insn;
 }
 
-void gen_code_label(char *opc, char *opr, int label) {
-    fprintf(caslfp, "\t%s\t%sL%04d\n", opc, opr, label);
+static void set_acc(IrValue v) {
+    acc = v;
+    acc_var = -1;
 }
 
-// Add variable allocation
-void gen_variable_allocation(const char* name, int size) {
-    if (current_proc[0] == '\0') {
-        // Global variable
-        fprintf(caslfp, "$%s  DC 0\n", name);
-        fprintf(caslfp, "; %s : integer;\n\n", name);
-    } else {
-        // Local variable
-        fprintf(caslfp, "$%s%%%s  DC 0\n", name, current_proc);
-        fprintf(caslfp, "; %s : integer;\n\n", name);
+static IrValue pop_value(void) {
+    if (value_sp == 0) {
+        error("Internal error: expression stack underflow");
     }
+    return value_stack[--value_sp];
 }
 
-// Add array allocation
-void gen_array_allocation(const char* name, int size) {
-    if (current_proc[0] == '\0') {
-        fprintf(caslfp, "$%s  DS %d\n", name, size);
-    } else {
-        fprintf(caslfp, "$%s%%%s  DS %d\n", name, current_proc, size);
-    }
-    fprintf(caslfp, "; %s : array[%d] of integer;\n\n", name, size);
+// Resolve a name the way MPL scopes it: locals and parameters, then globals
+static int lookup_var(const char* name) {
+    ensure_module();
+    int var = -1;
+    if (current_proc[0] != '\0') var = ir_find_var(module, name, current_proc);
+    if (var < 0) var = ir_find_var(module, name, NULL);
+    return var;
 }
 
-// Add stack operations
-void gen_push(void) {
-    gen_code("PUSH", "0,GR1");
+static int require_var(const char* name) {
+    int var = lookup_var(name);
+    if (var < 0) {
+        char msg[300];
+        snprintf(msg, sizeof(msg), "Undefined variable %s", name);
+        error(msg);
+    }
+    return var;
 }
 
-void gen_pop(const char* reg) {
-    gen_code("POP", reg);
+const IrVar* gen_lookup_variable(const char* name) {
+    int var = lookup_var(name);
+    return var < 0 ? NULL : &module->vars[var];
 }
 
-// Add arithmetic operations
-void gen_add(void) {
-    gen_code("POP", "GR2");
-    gen_code("ADDA", "GR1,GR2");
+// Program structure
+
+void gen_program_start(const char* name) {
+    debug_codegen_printf("Generating program start for '%s'\n", name);
+    ir_module_free(module);
+    module = ir_module_new(name);
+    func = ir_add_func(module, name, 1);
+    // The entry label is L0001, the START operand
+    block = ir_add_block(func, ir_new_label(module));
+    main_exit_label = exit_label = ir_new_label(module);
+    current_proc[0] = '\0';
+    value_sp = 0;
+    set_acc(ir_empty());
 }
 
-void gen_multiply(void) {
-    gen_code("POP", "GR2");
-    gen_code("MULA", "GR1,GR2");
+static void finish_function(void) {
+    gen_label(exit_label);
+    emit(IR_RET);
 }
 
-// Add array access
-void gen_array_access(const char* array_name, const char* index_reg) {
-    fprintf(caslfp, "\tLD\tGR1,$%s,%s\n", array_name, index_reg);
+void gen_program_end(void) {
+    // Symbol-only parses (--project) have no output; the IR was only
+    // built for its scope, so skip optimizing and emitting it
+    if (!caslfp) {
+        gen_discard();
+        return;
+    }
+    finish_function();
+    optimize_module(module);
+
+    int problems = ir_verify(module, stderr);
+    if (problems > 0) {
+        error("Internal error: invalid IR");
+    }
+    if (dump_ir) {
+        ir_dump(module, stdout);
+    }
+    emit_casl(module, caslfp);
+    gen_discard();
 }
 
-// Program structure
-void gen_data_section(void) {
-    fprintf(caslfp, "\tSTART\n");
-    fprintf(caslfp, "LIBBUF\tDS\t256\n");  // Buffer for library routines
+// Drop the module without emitting anything (parse errors, symbol-only parses)
+void gen_discard(void) {
+    ir_module_free(module);
+    module = NULL;
+    func = NULL;
+    block = main_block = NULL;
+    current_proc[0] = '\0';
+    value_sp = 0;
+    call_nargs = 0;
 }
 
-// Implement proper memory sections
 void gen_data_section_start(void) {
     debug_codegen_printf("Starting data section\n");
-    // Empty implementation - don't generate START and LIBBUF
 }
 
 void gen_data_section_end(void) {
     debug_codegen_printf("Ending data section\n");
-    // Empty implementation - don't generate END
 }
 
-void gen_program_start(const char* name) {
-    debug_codegen_printf("Generating program start for '%s'\n", name);
-    fprintf(caslfp, "%%%s START L0001\n\n", name);
-    fprintf(caslfp, "; program %s;\n\n", name);
-    
-    // Add start label
-    fprintf(caslfp, "L0001\n");
+void gen_variable_allocation(const char* name, int type) {
+    ensure_module();
+    ir_add_var(module, name, current_proc[0] ? current_proc : NULL,
+               current_proc[0] ? IRV_LOCAL : IRV_GLOBAL, type, 0);
 }
 
-void gen_program_end(void) {
-    fprintf(caslfp, "    CALL FLUSH\n");
-    fprintf(caslfp, "    RET\n");
-    fprintf(caslfp, "    ; end.\n\n");
-    // Add runtime error handlers at the very end
-    gen_runtime_error_handlers();
+void gen_array_allocation(const char* name, int size, int elem_type) {
+    ensure_module();
+    ir_add_var(module, name, current_proc[0] ? current_proc : NULL,
+               current_proc[0] ? IRV_LOCAL : IRV_GLOBAL, elem_type, size);
 }
 
-// Register management
-void gen_save_registers(void) {
-    fprintf(caslfp, "\tPUSH\t0,GR1\n");
-    fprintf(caslfp, "\tPUSH\t0,GR2\n");
-    fprintf(caslfp, "\tPUSH\t0,GR3\n");
+// Procedure handling
+
+void gen_procedure_entry(const char* name) {
+    ensure_module();
+    strncpy(current_proc, name, sizeof(current_proc) - 1);
+    current_proc[sizeof(current_proc) - 1] = '\0';
+    main_block = block;
+    func = ir_add_func(module, name, 0);
+    block = ir_add_block(func, ir_new_label(module));
+    exit_label = ir_new_label(module);
 }
 
-void gen_restore_registers(void) {
-    fprintf(caslfp, "\tPOP\tGR3\n");
-    fprintf(caslfp, "\tPOP\tGR2\n");
-    fprintf(caslfp, "\tPOP\tGR1\n");
+void gen_procedure_param(const char* proc_name, const char* param_name, int type) {
+    ensure_module();
+    int var = ir_add_var(module, param_name, proc_name, IRV_PARAM, type, 0);
+    func->params = realloc(func->params, (size_t)(func->nparams + 1) * sizeof(int));
+    func->params[func->nparams++] = var;
 }
 
-// Arithmetic operations
-void gen_load(const char* var) {
-    if (var[0] == '=') {
-        fprintf(caslfp, "    LAD GR1, %s\n", var);
-    } else {
-        fprintf(caslfp, "    LD GR1, $%s\n", var);
-    }
+void gen_procedure_exit(void) {
+    finish_function();
+    current_proc[0] = '\0';
+    func = module->funcs[0];
+    block = main_block;
+    exit_label = main_exit_label;
 }
 
-void gen_store(const char* var) {
-    fprintf(caslfp, "\tST\tGR1,$%s\n", var);
+// Control flow
+
+int get_label_num(void) {
+    ensure_module();
+    return ir_new_label(module);
 }
 
-void gen_subtract(void) {
-    fprintf(caslfp, "\tPOP\tGR2\n");
-    fprintf(caslfp, "\tSUBA\tGR1,GR2\n");
+// Start block `label`; the open block falls through to it
+void gen_label(int label) {
+    ensure_module();
+    if (block) {
+        IrInsn *jump = emit(IR_JUMP);
+        jump->target = label;
+    }
+    block = ir_add_block(func, label);
 }
 
-void gen_divide(void) {
-    fprintf(caslfp, "\tPOP\tGR2\n");
-    fprintf(caslfp, "\tDIVA\tGR2,GR1\n");
-    fprintf(caslfp, "\tLD\tGR1,GR2\n");
+void gen_jump(int label) {
+    IrInsn *jump = emit(IR_JUMP);
+    jump->target = label;
 }
 
-// Boolean operations
-void gen_and(void) {
-    fprintf(caslfp, "\tPOP\tGR2\n");
-    fprintf(caslfp, "\tAND\tGR1,GR2\n");
+void gen_jump_if_false(int label) {
+    int next = get_label_num();
+    IrInsn *branch = emit(IR_BRANCH);
+    branch->mode = IR_NE;
+    branch->a = acc;
+    branch->b = ir_const(0);
+    branch->target = next;
+    branch->target2 = label;
+    block = ir_add_block(func, next);
 }
 
-void gen_or(void) {
-    fprintf(caslfp, "\tPOP\tGR2\n");
-    fprintf(caslfp, "\tOR\tGR1,GR2\n");
+void gen_return(void) {
+    gen_jump(exit_label);
 }
 
-void gen_not(void) {
-    fprintf(caslfp, "\tXOR\tGR1,=#FFFF\n");
+// Expressions
+
+void gen_push(void) {
+    if (value_sp == MAX_VALUE_STACK) {
+        error("Expression too deeply nested");
+    }
+    value_stack[value_sp++] = acc;
+}
+
+void gen_load(const char* var_name) {
+    int var = require_var(var_name);
+    IrInsn *insn = emit(IR_LOAD);
+    insn->dst = ir_new_temp(func);
+    insn->var = var;
+    set_acc(ir_temp(insn->dst));
+    acc_var = var;
+    acc_index = ir_empty();
+}
+
+void gen_load_constant(int value) {
+    set_acc(ir_const(value));
+}
+
+// Value of `op` on constant operands, as CASL would compute it. Overflow
+// and division by zero are reported now, so no JOV check is needed.
+static int fold_constant(IrOp op, int a, int b) {
+    switch (op) {
+        case IR_ADD: check_arithmetic_overflow(TPLUS, a, b); return a + b;
+        case IR_SUB: check_arithmetic_overflow(TMINUS, a, b); return a - b;
+        case IR_MUL: check_arithmetic_overflow(TSTAR, a, b); return a * b;
+        case IR_DIV:
+            check_division_by_zero(b);
+            check_arithmetic_overflow(TDIV, a, b);
+            return a / b;  // truncates toward zero like DIVA
+        case IR_NEG: check_arithmetic_overflow(TMINUS, 0, a); return -a;
+        case IR_AND: return a & b;
+        case IR_OR:  return a | b;
+        case IR_NOT: return a ^ 1;
+        case IR_EQ:  return a == b;
+        case IR_NE:  return a != b;
+        case IR_LT:  return a < b;
+        case IR_LE:  return a <= b;
+        case IR_GT:  return a > b;
+        case IR_GE:  return a >= b;
+        default:     return 0;
+    }
 }
 
-void gen_compare(int op) {
-    fprintf(caslfp, "\tCPA\tGR1,GR2\n");
-    switch(op) {
-        case TEQUAL:  fprintf(caslfp, "\tJZE\t"); break;
-        case TNOTEQ:  fprintf(caslfp, "\tJNZ\t"); break;
-        case TLE:     fprintf(caslfp, "\tJMI\t"); break;
-        case TLEEQ:   fprintf(caslfp, "\tJLE\t"); break;
-        case TGR:     fprintf(caslfp, "\tJPL\t"); break;
-        case TGREQ:   fprintf(caslfp, "\tJGE\t"); break;
+static void gen_binary(IrOp op) {
+    IrValue left = pop_value();
+    if (left.kind == IR_CONST && acc.kind == IR_CONST) {
+        set_acc(ir_const(fold_constant(op, left.value, acc.value)));
+        return;
     }
+    IrInsn *insn = emit(op);
+    insn->dst = ir_new_temp(func);
+    insn->a = left;
+    insn->b = acc;
+    set_acc(ir_temp(insn->dst));
 }
 
-// Procedure handling
-void gen_procedure_entry(const char* name) {
-    strncpy(current_proc, name, sizeof(current_proc) - 1);
-    fprintf(caslfp, "\n$%s\n", name);
-    // Add parameter handling
-    fprintf(caslfp, "    POP GR2\n");
-    fprintf(caslfp, "    POP GR1\n");
-    // Store parameters as needed
-    fprintf(caslfp, "    PUSH 0, GR2\n\n");
-    fprintf(caslfp, "    ; begin\n");
+static void gen_unary(IrOp op) {
+    if (acc.kind == IR_CONST) {
+        set_acc(ir_const(fold_constant(op, acc.value, 0)));
+        return;
+    }
+    IrInsn *insn = emit(op);
+    insn->dst = ir_new_temp(func);
+    insn->a = acc;
+    set_acc(ir_temp(insn->dst));
 }
 
-void gen_procedure_exit(void) {
-    fprintf(caslfp, "    RET\n");
-    fprintf(caslfp, "    ; end;\n\n");
-    current_proc[0] = '\0';
+void gen_add(void) {
+    gen_binary(IR_ADD);
 }
 
-void gen_procedure_call(const char* name, int param_count) {
-    fprintf(caslfp, "    LAD GR1, $%s\n", name);
-    fprintf(caslfp, "    PUSH 0, GR1\n");
-    fprintf(caslfp, "    CALL $%s\n", name);
-    fprintf(caslfp, "    ; call %s", name);
-    if (param_count > 0) {
-        fprintf(caslfp, " (");
-        // Add parameter handling
-        fprintf(caslfp, ")");
-    }
-    fprintf(caslfp, ";\n\n");
+void gen_subtract(void) {
+    gen_binary(IR_SUB);
 }
 
-void gen_procedure_param(const char* proc_name, const char* param_name) {
-    fprintf(caslfp, "$$%s%%%s  DC 0\n", param_name, proc_name);
-    fprintf(caslfp, "; procedure %s ( %s : integer );\n\n", proc_name, param_name);
+void gen_multiply(void) {
+    gen_binary(IR_MUL);
 }
 
-// Call-by-reference parameter handling
-void gen_push_address(const char* var) {
-    fprintf(caslfp, "\tLAD\tGR1,$%s\n", var);
-    fprintf(caslfp, "\tPUSH\t0,GR1\n");
+void gen_divide(void) {
+    gen_binary(IR_DIV);
 }
 
-void gen_push_expression_address(void) {
-    // Stub for pushing an expression address
-    char temp_name[32];
-    snprintf(temp_name, sizeof(temp_name), "temp%d", temp_var_count++);
-    
-    // Allocate temporary storage
-    fprintf(caslfp, "$%s\tDS\t1\n", temp_name);
-    
-    // Store expression result
-    fprintf(caslfp, "\tST\tGR1,$%s\n", temp_name);
-    
-    // Push address
-    fprintf(caslfp, "\tLAD\tGR1,$%s\n", temp_name);
-    fprintf(caslfp, "\tPUSH\t0,GR1\n");
+void gen_and(void) {
+    gen_binary(IR_AND);
 }
 
-void gen_formal_parameter(const char* param_name, const char* proc_name) {
-    fprintf(caslfp, "$$%s%%%s\tDC\t0\n", param_name, proc_name);
+void gen_or(void) {
+    gen_binary(IR_OR);
 }
 
-void gen_local_variable(const char* var_name, const char* proc_name) {
-    fprintf(caslfp, "$%s%%%s\tDC\t0\n", var_name, proc_name);
+void gen_not(void) {
+    gen_unary(IR_NOT);
 }
 
-// Input/Output
-void gen_read(const char* var) {
-    // Instead of "IN #0001" etc., call READINT and READLINE
-    fprintf(caslfp, "\tLAD\tGR1,$%s\n", var);
-    fprintf(caslfp, "\tCALL\tREADINT\n");
-    fprintf(caslfp, "\tCALL\tREADLINE\n");
-}
-
-void gen_write(const char* var, int width) {
-    // Load variable and call WRITEINT
-    fprintf(caslfp, "\tLD\tGR1,$%s\n", var);
-    fprintf(caslfp, "\tLAD\tGR2,=%d\n", width);
-    fprintf(caslfp, "\tCALL\tWRITEINT\n");
-    // Optionally write a line break
-    fprintf(caslfp, "\tCALL\tWRITELINE\n");
-}
-
-// Example helper for writing a string literal
-void gen_write_string(const char* msg) {
-    static int str_counter = 0;
-    fprintf(caslfp, "STR%d\tDC\t'%s'\n", str_counter, msg);
-    fprintf(caslfp, "\tLAD\tGR1,STR%d\n", str_counter);
-    fprintf(caslfp, "\tCALL\tWRITESTR\n");
-    fprintf(caslfp, "\tCALL\tWRITELINE\n");
-    str_counter++;
-}
-
-// Runtime error handlers
-void gen_runtime_error_handlers(void) {
-    fprintf(caslfp, "\n; Error handlers\n");
-    
-    // Overflow handler
-    fprintf(caslfp, "EOVF\n");
-    fprintf(caslfp, "    CALL WRITELINE\n");
-    fprintf(caslfp, "    LAD GR1, EOVF1\n");
-    fprintf(caslfp, "    CALL WRITESTR\n");
-    fprintf(caslfp, "    CALL WRITELINE\n");
-    fprintf(caslfp, "    SVC 1\n");
-    fprintf(caslfp, "EOVF1    DC    '***** Run-Time Error: Overflow *****'\n\n");
-
-    // Zero-Divide handler
-    fprintf(caslfp, "; Zero-Divide error handling\n");
-    fprintf(caslfp, "E0DIV\n");
-    fprintf(caslfp, "    JNZ EOVF\n");
-    fprintf(caslfp, "    CALL WRITELINE\n");
-    fprintf(caslfp, "    LAD GR1, E0DIV1\n");
-    fprintf(caslfp, "    LD GR2, GR0\n");
-    fprintf(caslfp, "    CALL WRITESTR\n");
-    fprintf(caslfp, "    CALL WRITELINE\n");
-    fprintf(caslfp, "    SVC 2\n");
-    fprintf(caslfp, "E0DIV1  DC '***** Run-Time Error: Zero-Divide *****'\n\n");
-
-    // Range-Over handler
-    fprintf(caslfp, "; Range-Over error handling\n");
-    fprintf(caslfp, "EROV\n");
-    fprintf(caslfp, "    CALL WRITELINE\n");
-    fprintf(caslfp, "    LAD GR1, EROV1\n");
-    fprintf(caslfp, "    LD GR2, GR0\n");
-    fprintf(caslfp, "    CALL WRITESTR\n");
-    fprintf(caslfp, "    CALL WRITELINE\n");
-    fprintf(caslfp, "    SVC 3\n");
-    fprintf(caslfp, "EROV1  DC '***** Run-Time Error: Range-Over in Array Index *****'\n\n");
-    
-    fprintf(caslfp, "END\n");
-}
-
-void gen_bounds_check(void) {
-    fprintf(caslfp, "\tCPA\tGR1,=0\n");   // Check lower bound
-    fprintf(caslfp, "\tJMI\tEBOUND\n");    // Jump if negative
-    fprintf(caslfp, "\tCPA\tGR1,GR2\n");   // Compare with array size
-    fprintf(caslfp, "\tJGE\tEBOUND\n");    // Jump if >= size
+void gen_negate(void) {
+    gen_unary(IR_NEG);
+    gen_overflow_check();  // -(-32768)
+}
+
+void gen_compare(int op) {
+    switch (op) {
+        case TEQUAL: gen_binary(IR_EQ); break;
+        case TNOTEQ: gen_binary(IR_NE); break;
+        case TLE:    gen_binary(IR_LT); break;
+        case TLEEQ:  gen_binary(IR_LE); break;
+        case TGR:    gen_binary(IR_GT); break;
+        case TGREQ:  gen_binary(IR_GE); break;
+    }
+}
+
+// Flag the instruction that computed the accumulator; a folded constant
+// has no instruction and needs no check
+static void flag_acc_insn(int flags) {
+    if (!block || acc.kind != IR_TEMP) return;
+    for (int i = block->ninsns - 1; i >= 0; i--) {
+        if (block->insns[i].dst == acc.value) {
+            block->insns[i].flags |= flags;
+            return;
+        }
+    }
 }
 
 void gen_div_check(void) {
-    fprintf(caslfp, "\tCPA\tGR1,=0\n");
-    fprintf(caslfp, "\tJZE\tEDIVZ\n");
+    flag_acc_insn(IRF_ZERODIV);
 }
 
 void gen_overflow_check(void) {
-    fprintf(caslfp, "\tJOV\tEOVF\n");  // Jump on overflow
+    flag_acc_insn(IRF_OVERFLOW);
 }
 
-// Type conversion implementations
 void gen_type_conversion(int from_type, int to_type) {
-    switch (from_type) {
-        case TINTEGER:
-            if (to_type == TBOOLEAN) {
-                // Convert to boolean (0 = false, non-zero = true)
-                fprintf(caslfp, "\tCPA\tGR1,=0\n");
-                fprintf(caslfp, "\tLD\tGR1,=0\n");
-                fprintf(caslfp, "\tJZE\t$+2\n");
-                fprintf(caslfp, "\tLD\tGR1,=1\n");
-            } else if (to_type == TCHAR) {
-                // Keep only lowest 7 bits
-                fprintf(caslfp, "\tAND\tGR1,=127\n");
-            }
-            break;
-            
-        case TBOOLEAN:
-            if (to_type == TINTEGER) {
-                // Already 0 or 1
-                break;
-            } else if (to_type == TCHAR) {
-                // Convert to character code (0 or 1)
-                fprintf(caslfp, "\tAND\tGR1,=1\n");
-            }
-            break;
-            
-        case TCHAR:
-            if (to_type == TINTEGER) {
-                // Character code is already an integer
-                break;
-            } else if (to_type == TBOOLEAN) {
-                // Convert to boolean (0 = false, non-zero = true)
-                fprintf(caslfp, "\tCPA\tGR1,=0\n");
-                fprintf(caslfp, "\tLD\tGR1,=0\n");
-                fprintf(caslfp, "\tJZE\t$+2\n");
-                fprintf(caslfp, "\tLD\tGR1,=1\n");
-            }
-            break;
+    if (from_type == to_type) return;
+    if (to_type == TBOOLEAN) {
+        // Non-zero is true
+        gen_push();
+        set_acc(ir_const(0));
+        gen_binary(IR_NE);
+    } else if (to_type == TCHAR && from_type == TINTEGER) {
+        // Keep only the lowest 7 bits
+        gen_push();
+        set_acc(ir_const(127));
+        gen_binary(IR_AND);
     }
 }
 
-// Temporary variable handling
+// Arrays
 
-void gen_temp_var_section(void) {
-    fprintf(caslfp, "\t.DATA\n");  // Start data section
+void gen_bounds_check(const char* array_name) {
+    int var = require_var(array_name);
+    IrInsn *insn = emit(IR_CHECK);
+    insn->a = acc;
+    insn->var = var;
+    insn->imm = module->vars[var].size;
 }
 
-void gen_temp_var(const char* prefix) {
-    fprintf(caslfp, "$%s%d\tDS\t1\n", prefix, temp_var_count++);
+void gen_array_access(const char* array_name) {
+    int var = require_var(array_name);
+    IrValue index = acc;
+    IrInsn *insn = emit(IR_LOAD);
+    insn->dst = ir_new_temp(func);
+    insn->var = var;
+    insn->a = index;
+    set_acc(ir_temp(insn->dst));
+    acc_var = var;
+    acc_index = index;
 }
 
-// Add definitions for READINT, READLINE, WRITESTR, WRITEINT, WRITELINE, ERRPRT, etc.
-void gen_lib_subroutines(void) {
-    fprintf(caslfp, "; Standard library routines\n");
-    fprintf(caslfp, "WRITESTR\tSTART\n");
-    fprintf(caslfp, "\tRET\n");
-    fprintf(caslfp, "\tEND\n");
+void gen_store(const char* var_name) {
+    IrInsn *insn = emit(IR_STORE);
+    insn->var = require_var(var_name);
+    insn->b = acc;
+}
 
-    fprintf(caslfp, "WRITEINT\tSTART\n");
-    fprintf(caslfp, "\tRET\n");
-    fprintf(caslfp, "\tEND\n");
+// Index was saved with gen_push() before the value was computed
+void gen_store_element(const char* array_name) {
+    IrValue index = pop_value();
+    IrInsn *insn = emit(IR_STORE);
+    insn->var = require_var(array_name);
+    insn->a = index;
+    insn->b = acc;
+}
 
-    fprintf(caslfp, "WRITELINE\tSTART\n");
-    fprintf(caslfp, "\tOUT\tDC,='\n'\n");
-    fprintf(caslfp, "\tRET\n");
-    fprintf(caslfp, "\tEND\n");
+// Procedure calls
 
-    fprintf(caslfp, "READINT\tSTART\n");
-    fprintf(caslfp, "\tIN\t,GR1\n");
-    fprintf(caslfp, "\tRET\n");
-    fprintf(caslfp, "\tEND\n");
+static IrArg* new_call_arg(int kind) {
+    if (call_nargs == MAX_CALL_ARGS) {
+        error("Too many arguments");
+    }
+    IrArg *arg = &call_args[call_nargs++];
+    arg->kind = kind;
+    arg->var = -1;
+    arg->value = ir_empty();
+    return arg;
+}
+
+void gen_push_address(const char* var_name) {
+    IrArg *arg = new_call_arg(IR_ARG_VAR);
+    arg->var = require_var(var_name);
+}
+
+void gen_push_element_address(const char* array_name) {
+    IrArg *arg = new_call_arg(IR_ARG_ELEM);
+    arg->var = require_var(array_name);
+    arg->value = acc;
+}
+
+// An argument that is just a variable is passed by reference; any other
+// expression is passed as the address of a cell holding its value
+void gen_push_expression_address(void) {
+    if (acc_var >= 0 && block && block->ninsns > 0) {
+        IrInsn *last = &block->insns[block->ninsns - 1];
+        if (last->op == IR_LOAD && acc.kind == IR_TEMP && last->dst == acc.value) {
+            IrArg *arg = new_call_arg(acc_index.kind == IR_EMPTY ? IR_ARG_VAR : IR_ARG_ELEM);
+            arg->var = acc_var;
+            arg->value = acc_index;
+            ir_remove(block, block->ninsns - 1);
+            set_acc(ir_empty());
+            return;
+        }
+    }
+    IrArg *arg = new_call_arg(IR_ARG_VALUE);
+    arg->value = acc;
+}
+
+void gen_procedure_call(const char* name, int param_count) {
+    ensure_module();
+    int callee = ir_find_func(module, name);
+    if (callee < 0) {
+        char msg[300];
+        snprintf(msg, sizeof(msg), "Undefined procedure %s", name);
+        error(msg);
+    }
+    if (module->funcs[callee]->nparams != param_count || call_nargs != param_count) {
+        char msg[300];
+        snprintf(msg, sizeof(msg), "Procedure %s expects %d parameters but got %d",
+                 name, module->funcs[callee]->nparams, param_count);
+        error(msg);
+    }
+    IrInsn *insn = emit(IR_CALL);
+    insn->callee = callee;
+    insn->nargs = call_nargs;
+    if (call_nargs > 0) {
+        insn->args = malloc((size_t)call_nargs * sizeof(IrArg));
+        memcpy(insn->args, call_args, (size_t)call_nargs * sizeof(IrArg));
+    }
+    call_nargs = 0;
+}
 
-    fprintf(caslfp, "READLINE\tSTART\n");
-    fprintf(caslfp, "\tIN\t,GR1\n");
-    fprintf(caslfp, "\tRET\n");
-    fprintf(caslfp, "\tEND\n");
+// Input/Output
 
-    fprintf(caslfp, "ERRPRT\tSTART\n");
-    fprintf(caslfp, "\tRET\n");
-    fprintf(caslfp, "\tEND\n");
+void gen_read(const char* var_name) {
+    IrInsn *insn = emit(IR_READ);
+    insn->var = require_var(var_name);
 }
 
-void gen_comment(const char* comment) {
-    fprintf(caslfp, "    ; %s\n", comment);
+void gen_read_element(const char* array_name) {
+    IrInsn *insn = emit(IR_READ);
+    insn->var = require_var(array_name);
+    insn->a = acc;
 }
 
-void gen_pascal_comment(const char* comment) {
-    fprintf(caslfp, "; %s\n", comment);
+void gen_readln(void) {
+    emit(IR_READLN);
 }
 
-// Add this new function
-void gen_string_constant(const char* str) {
-    fprintf(caslfp, "    LAD GR1, ='%s'\n", str);
-    fprintf(caslfp, "    CALL WRITESTR\n");
-}
\ No newline at end of file
+void gen_write_value(int type, int width) {
+    IrInsn *insn = emit(IR_WRITE);
+    insn->a = acc;
+    insn->mode = type;
+    insn->imm = width;
+}
+
+void gen_write_string(const char* str) {
+    ensure_module();
+    IrInsn *insn = emit(IR_WRITESTR);
+    insn->imm = ir_add_string(module, str);
+}
+
+void gen_writeln(void) {
+    emit(IR_WRITELN);
+}
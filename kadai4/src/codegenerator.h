@@ -4,48 +4,87 @@
 #include <stdio.h>
 
 #include "parser.h"
+#include "ir.h"
+#include "tls.h"
 
-// File pointer for CASL output
-extern FILE* caslfp;
+// File pointer for CASL output; NULL makes gen_program_end() emit nothing
+extern THREAD_LOCAL FILE* caslfp;
+
+// Where caslfp points when a parse is only wanted for its symbols
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+// The gen_* functions build the IR of the program being parsed (see ir.h);
+// gen_program_end() hands the finished module to the CASL emitter.
+//
+// Expressions use an accumulator: every gen_* call that computes a value
+// leaves it in the accumulator, gen_push() saves the accumulator, and the
+// binary operators combine the most recently pushed value (left operand)
+// with the accumulator (right operand).
 
 // Program structure
 void gen_program_start(const char* name);
 void gen_program_end(void);
+void gen_discard(void);
 void gen_data_section_start(void);
 void gen_data_section_end(void);
 
 // Variable and procedure handling
-void gen_variable_allocation(const char* name, int size);
-void gen_array_allocation(const char* name, int size);
+void gen_variable_allocation(const char* name, int type);
+void gen_array_allocation(const char* name, int size, int elem_type);
 void gen_procedure_entry(const char* name);
 void gen_procedure_exit(void);
-void gen_procedure_param(const char* proc_name, const char* param_name);
-void gen_procedure_local_var(const char* proc_name, const char* var_name);
+void gen_procedure_param(const char* proc_name, const char* param_name, int type);
+const IrVar* gen_lookup_variable(const char* name);
 
-// Code generation helpers
-void gen_label(const char* label);
-void gen_comment(const char* comment);
-void gen_pascal_comment(const char* comment);
+// Control flow
+int get_label_num(void);
+void gen_label(int label);
+void gen_jump(int label);
+void gen_jump_if_false(int label);
+void gen_return(void);
 
-// Error handlers
-void gen_runtime_error_handlers(void);
-
-// Add these declarations
-void gen_code(const char* opc, const char* opr);
+// Expressions
 void gen_push(void);
+void gen_load(const char* var_name);
+void gen_load_constant(int value);
 void gen_add(void);
 void gen_subtract(void);
+void gen_multiply(void);
+void gen_divide(void);
+void gen_and(void);
 void gen_or(void);
+void gen_not(void);
+void gen_negate(void);
+void gen_compare(int op);
 void gen_div_check(void);
-void gen_multiply(void);
 void gen_overflow_check(void);
-void gen_and(void);
+void gen_type_conversion(int from_type, int to_type);
+
+// Arrays: the index is in the accumulator
+void gen_bounds_check(const char* array_name);
+void gen_array_access(const char* array_name);
+void gen_store(const char* var_name);
+void gen_store_element(const char* array_name);
+
+// Procedure calls
 void gen_push_address(const char* var_name);
+void gen_push_element_address(const char* array_name);
 void gen_push_expression_address(void);
-void gen_procedure_call(const char* name, int param_count);  // Modified signature
-void gen_array_access(const char* array_name, const char* index_reg);
-void gen_bounds_check(void);
-void gen_load(const char* var_name);
-void gen_store(const char* var_name);
+void gen_procedure_call(const char* name, int param_count);
+
+// Input/Output
+void gen_read(const char* var_name);
+void gen_read_element(const char* array_name);
+void gen_readln(void);
+void gen_write_value(int type, int width);
+void gen_write_string(const char* str);
+void gen_writeln(void);
+
+// Dump the IR to stdout before emitting CASL (--dump-ir)
+extern int dump_ir;
 
-#endif
\ No newline at end of file
+#endif
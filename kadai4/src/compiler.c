@@ -9,6 +9,7 @@
 #include "scan.h"
 #include "codegenerator.h"
 #include "error.h"
+#include "cross_referencer.h"
 
 // Add debug print function at the top
 static void debug_compiler_printf(const char *format, ...) {
@@ -21,10 +22,16 @@ static void debug_compiler_printf(const char *format, ...) {
     }
 }
 
+THREAD_LOCAL jmp_buf *error_recovery = NULL;
+
 // Error handling
 void error(const char* message) {
     debug_compiler_printf("Error encountered: %s at line %d\n", message, get_linenum());
     fprintf(stderr, "Error: %s at line %d\n", message, get_linenum());
+    if (error_recovery) {
+        scanner.has_error = 1;
+        longjmp(*error_recovery, 1);
+    }
     exit(1);
 }
 
@@ -118,7 +125,6 @@ void check_parameter_types(const char* proc_name, int* expected_types,
 // Symbol table implementation (simplified for now)
 static SymbolEntry symbol_table[1000];
 static int symbol_count = 0;
-static char current_procedure[256] = "";
 
 SymbolEntry* lookup_symbol(const char* name) {
     for (int i = 0; i < symbol_count; i++) {
@@ -130,7 +136,8 @@ SymbolEntry* lookup_symbol(const char* name) {
 }
 
 int is_current_procedure(const char* name) {
-    return strcmp(current_procedure, name) == 0;
+    const char* proc = get_current_procedure();
+    return proc != NULL && strcmp(proc, name) == 0;
 }
 
 int get_procedure_param_count(const char* name) {
@@ -156,6 +163,7 @@ void check_arithmetic_overflow(int op, int val1, int val2) {
         case TPLUS: result = (long)val1 + val2; break;
         case TMINUS: result = (long)val1 - val2; break;
         case TSTAR: result = (long)val1 * val2; break;
+        case TDIV: result = (long)val1 / val2; break;  // -32768 div -1
         default: return;
     }
     if (result > 32767 || result < -32768) {
@@ -3,10 +3,15 @@
 
 #include "parser.h"
 #include "codegenerator.h"
+#include <setjmp.h>
+#include "tls.h"
 
 // Error handling
 void error(const char* message);
 
+// When set, error() longjmps here instead of exiting (project mode workers)
+extern THREAD_LOCAL jmp_buf *error_recovery;
+
 // Type checking and semantic validation
 void check_type_compatibility(int left_type, int right_type);
 void check_array_bounds(int index, int size);
@@ -25,6 +30,6 @@ int* get_procedure_param_types(const char* name);
 int convert_type(int value, int from_type, int to_type);
 
 // File pointer for CASL output
-extern FILE* caslfp;
+extern THREAD_LOCAL FILE* caslfp;
 
 #endif
\ No newline at end of file
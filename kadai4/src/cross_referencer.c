@@ -6,6 +6,7 @@
 #include "compiler.h"
 #include "scan.h"
 #include "debug.h"
+#include "mxr.h"
 
 extern int debug_cross_referencer;
 
@@ -19,11 +20,20 @@ static void debug_xref_printf(const char *format, ...) {
 }
 
 // Global state management for symbol processing
-static ID *symbol_table = NULL;
-static char *current_procedure = NULL;
-static ID *current_procedure_id = NULL;
-static Type* current_symbol_type = NULL;
-static int error_state = 0;
+static THREAD_LOCAL ID *symbol_table = NULL;
+static THREAD_LOCAL char *current_procedure = NULL;
+static THREAD_LOCAL ID *current_procedure_id = NULL;
+static THREAD_LOCAL Type* current_symbol_type = NULL;
+static THREAD_LOCAL int error_state = 0;
+static THREAD_LOCAL ProcFragment *fragments = NULL;
+
+// Name index over symbol_table; entry names are unique
+static THREAD_LOCAL ID **name_index = NULL;
+static THREAD_LOCAL size_t name_index_size = 0;
+static THREAD_LOCAL size_t name_index_count = 0;
+
+// Reference recording is on by default so the table keeps working
+int xref_consumers = XREF_NEED_TABLE;
 
 // Parameter type tracking for procedures
 struct ParamType {
@@ -32,8 +42,8 @@ struct ParamType {
 };
 
 // Array type construction state
-extern int current_array_size;  // Declare it here as extern
-static int current_base_type = 0;
+extern THREAD_LOCAL int current_array_size;  // Declare it here as extern
+static THREAD_LOCAL int current_base_type = 0;
 
 void set_array_info(int size, int base_type) {
     debug_xref_printf("Setting array info: size=%d, base_type=%d\n", size, base_type);
@@ -60,6 +70,7 @@ Type* create_array_type(int size, int base_type) {
     array_type->etp->ttype = base_type;
     array_type->etp->arraysize = 0;
     array_type->etp->etp = NULL;
+    array_type->etp->paratp = NULL;
     array_type->paratp = NULL;
     
     return array_type;
@@ -69,9 +80,62 @@ void init_cross_referencer(void) {
     symbol_table = NULL;
 }
 
+static size_t hash_name(const char *name) {
+    size_t h = 5381;
+    while (*name) h = h * 33 + (unsigned char)*name++;
+    return h;
+}
+
+static ID* find_symbol(const char *name) {
+    if (!name_index) return NULL;
+    for (ID *id = name_index[hash_name(name) & (name_index_size - 1)]; id; id = id->hashp) {
+        if (strcmp(id->name, name) == 0) return id;
+    }
+    return NULL;
+}
+
+static void index_symbol(ID *id) {
+    if ((name_index_count + 1) * 2 > name_index_size) {
+        size_t size = name_index_size ? name_index_size * 2 : 256;
+        ID **buckets = calloc(size, sizeof(ID *));
+        if (!buckets) return;
+        for (size_t i = 0; i < name_index_size; i++) {
+            ID *entry = name_index[i];
+            while (entry) {
+                ID *next = entry->hashp;
+                size_t b = hash_name(entry->name) & (size - 1);
+                entry->hashp = buckets[b];
+                buckets[b] = entry;
+                entry = next;
+            }
+        }
+        free(name_index);
+        name_index = buckets;
+        name_index_size = size;
+    }
+    size_t b = hash_name(id->name) & (name_index_size - 1);
+    id->hashp = name_index[b];
+    name_index[b] = id;
+    name_index_count++;
+}
+
+static void unindex_symbol(ID *id) {
+    if (!name_index) return;
+    ID **link = &name_index[hash_name(id->name) & (name_index_size - 1)];
+    while (*link && *link != id) link = &(*link)->hashp;
+    if (*link) {
+        *link = id->hashp;
+        name_index_count--;
+    }
+}
+
+void set_xref_consumers(int consumers) {
+    xref_consumers = consumers;
+}
+
 // Modify type_to_string to use stored info directly
 const char* type_to_string(int type) {
-    static char array_type[256];  // Static buffer for array type string
+    static THREAD_LOCAL char array_type[256];  // Static buffer for array type string
     switch(type) {
         case TINTEGER: return "integer";
         case TBOOLEAN: return "boolean";
@@ -161,12 +225,7 @@ void add_symbol(char *name, int type, int linenum, int is_definition) {
     }
 
     // First look for existing symbol with exact name match
-    for (ID *id = symbol_table; id != NULL; id = id->nextp) {
-        if (strcmp(id->name, lookup_name) == 0) {
-            existing = id;
-            break;
-        }
-    }
+    existing = find_symbol(lookup_name);
 
     if (is_definition) {
         if (!existing) {
@@ -190,6 +249,7 @@ void add_symbol(char *name, int type, int linenum, int is_definition) {
             new_id->irefp = NULL;
             new_id->nextp = symbol_table;
             symbol_table = new_id;
+            index_symbol(new_id);
             
             if (type == TPROCEDURE) {
                 current_procedure_id = new_id;
@@ -198,15 +258,15 @@ void add_symbol(char *name, int type, int linenum, int is_definition) {
             free(scoped_name);
         }
     } else {
+        if (!XREF_RECORDING()) {
+            if (scoped_name) free(scoped_name);
+            return;
+        }
+
         // For references, try scoped name first, then global
         if (!existing) {
             // Try global lookup if scoped lookup failed
-            for (ID *id = symbol_table; id != NULL; id = id->nextp) {
-                if (strcmp(id->name, name) == 0) {
-                    existing = id;
-                    break;
-                }
-            }
+            existing = find_symbol(name);
         }
         
         if (existing) {
@@ -238,8 +298,15 @@ void add_procedure_parameter(int type) {
 }
 
 void add_reference(char *name, int linenum) {
+    // Without consumers only the recursion check below matters, and that
+    // can only trigger when the name matches the enclosing procedure
+    if (!XREF_RECORDING() &&
+        (!current_procedure || strcmp(name, current_procedure) != 0)) {
+        return;
+    }
+
     // First check if this reference is to a variable in current scope
-    ID *id = symbol_table;
+    ID *id = NULL;
     char *scoped_name = NULL;
     int found_as_variable = 0;
     
@@ -250,12 +317,9 @@ void add_reference(char *name, int linenum) {
         snprintf(scoped_name, len, "%s:%s", name, current_procedure);
         
         // Look for scoped variable first
-        while (id != NULL) {
-            if (strcmp(id->name, scoped_name) == 0 && id->itp->ttype != TPROCEDURE) {
-                found_as_variable = 1;
-                break;
-            }
-            id = id->nextp;
+        id = find_symbol(scoped_name);
+        if (id && id->itp->ttype != TPROCEDURE) {
+            found_as_variable = 1;
         }
     }
 
@@ -268,9 +332,8 @@ void add_reference(char *name, int linenum) {
         return;  // Return immediately, don't try to add reference
     }
 
-    // Reset id for normal reference handling
-    id = symbol_table;
     if (scoped_name) free(scoped_name);  // Fixed missing parenthesis
+    if (!XREF_RECORDING()) return;
     
     // Rest of existing add_reference code...
     debug_xref_printf("add_reference: name=%s, line=%d, current_proc=%s\n", 
@@ -286,63 +349,30 @@ void add_reference(char *name, int linenum) {
         snprintf(scoped_name, len, "%s:%s", name, current_procedure);
     }
 
-    // First look for scoped version
-    while (id != NULL) {
-        if (scoped_name && strcmp(id->name, scoped_name) == 0) {
-            Line *new_line = (Line *)malloc(sizeof(Line));
-            new_line->reflinenum = linenum;
-            new_line->nextlinep = NULL;
-            
-            // Insert in sorted order
-            if (!id->irefp || id->irefp->reflinenum > linenum) {
-                // Insert at start
-                new_line->nextlinep = id->irefp;
-                id->irefp = new_line;
-            } else {
-                // Find insertion point
-                Line *current = id->irefp;
-                while (current->nextlinep && current->nextlinep->reflinenum < linenum) {
-                    current = current->nextlinep;
-                }
-                new_line->nextlinep = current->nextlinep;
-                current->nextlinep = new_line;
-            }
-            
-            found = 1;
-            break;
-        }
-        id = id->nextp;
-    }
-
-    // If not found in scope, look for global
-    if (!found) {
-        id = symbol_table;
-        while (id != NULL) {
-            if (strcmp(id->name, global_name) == 0) {
-                Line *new_line = (Line *)malloc(sizeof(Line));
-                new_line->reflinenum = linenum;
-                new_line->nextlinep = NULL;
-                
-                // Insert in sorted order
-                if (!id->irefp || id->irefp->reflinenum > linenum) {
-                    // Insert at start
-                    new_line->nextlinep = id->irefp;
-                    id->irefp = new_line;
-                } else {
-                    // Find insertion point
-                    Line *current = id->irefp;
-                    while (current->nextlinep && current->nextlinep->reflinenum < linenum) {
-                        current = current->nextlinep;
-                    }
-                    new_line->nextlinep = current->nextlinep;
-                    current->nextlinep = new_line;
-                }
-                
-                found = 1;
-                break;
+    // First look for scoped version, then global
+    id = scoped_name ? find_symbol(scoped_name) : NULL;
+    if (!id) id = find_symbol(global_name);
+    if (id) {
+        Line *new_line = (Line *)malloc(sizeof(Line));
+        new_line->reflinenum = linenum;
+        new_line->nextlinep = NULL;
+        
+        // Insert in sorted order
+        if (!id->irefp || id->irefp->reflinenum > linenum) {
+            // Insert at start
+            new_line->nextlinep = id->irefp;
+            id->irefp = new_line;
+        } else {
+            // Find insertion point
+            Line *current = id->irefp;
+            while (current->nextlinep && current->nextlinep->reflinenum < linenum) {
+                current = current->nextlinep;
             }
-            id = id->nextp;
+            new_line->nextlinep = current->nextlinep;
+            current->nextlinep = new_line;
         }
+        
+        found = 1;
     }
 
     if (!found) {
@@ -517,13 +547,8 @@ static char* get_display_name(const ID* id) {
     return result;
 }
 
-// Modified print_cross_reference_table to handle procedure parameters
-void print_cross_reference_table(void) {
-    // Don't print anything if there was an error
-    if (scanner.has_error || error_state) {
-        return;
-    }
-
+// Collect symbols into an array in table order (see compare_ids)
+static ID** collect_sorted_symbols(int *count_out) {
     // Count symbols and create array
     int count = 0;
     for (ID *id = symbol_table; id != NULL; id = id->nextp) {
@@ -531,7 +556,7 @@ void print_cross_reference_table(void) {
     }
     
     ID **id_array = (ID **)malloc(count * sizeof(ID *));
-    if (!id_array) return;
+    if (!id_array) return NULL;
     
     // Fill array
     ID *id = symbol_table;
@@ -543,12 +568,27 @@ void print_cross_reference_table(void) {
     // Sort array
     qsort(id_array, count, sizeof(ID *), compare_ids);
 
+    *count_out = count;
+    return id_array;
+}
+
+// Modified print_cross_reference_table to handle procedure parameters
+void print_cross_reference_table(void) {
+    // Don't print anything if there was an error
+    if (scanner.has_error || error_state) {
+        return;
+    }
+
+    int count = 0;
+    ID **id_array = collect_sorted_symbols(&count);
+    if (!id_array) return;
+
     // Print header line
     printf("----------------------------------\n");
 
     // Print sorted symbols
     for (int i = 0; i < count; i++) {
-        id = id_array[i];
+        ID *id = id_array[i];
         char* display_name = get_display_name(id);
         
         current_symbol_type = id->itp;
@@ -573,4 +613,359 @@ void print_cross_reference_table(void) {
     }
 
     free(id_array);
-}
\ No newline at end of file
+}
+
+// Context for sorting the by-name permutation
+static THREAD_LOCAL const MxrSymbol *byname_symbols;
+static THREAD_LOCAL const char *byname_strings;
+
+static int compare_byname(const void *a, const void *b) {
+    const MxrSymbol *s1 = &byname_symbols[*(const uint32_t *)a];
+    const MxrSymbol *s2 = &byname_symbols[*(const uint32_t *)b];
+    int c = strcmp(byname_strings + s1->name, byname_strings + s2->name);
+    if (c != 0) return c;
+    if (s1->scope == s2->scope) return 0;
+    if (s1->scope == MXR_NO_SCOPE) return -1;
+    if (s2->scope == MXR_NO_SCOPE) return 1;
+    return strcmp(byname_strings + s1->scope, byname_strings + s2->scope);
+}
+
+// Write the table as a memory-mappable index (see mxr.h for the layout)
+int write_cross_reference_index(const char *path) {
+    if (scanner.has_error || error_state) {
+        return -1;
+    }
+
+    int count = 0;
+    ID **id_array = collect_sorted_symbols(&count);
+    if (!id_array && count > 0) return -1;
+
+    MxrStringPool pool = {0};
+    MxrBuf refs = {0};
+    MxrSymbol *symbols = calloc(count > 0 ? count : 1, sizeof(MxrSymbol));
+    uint32_t *byname = calloc(count > 0 ? count : 1, sizeof(uint32_t));
+    int result = -1;
+    if (!symbols || !byname) goto cleanup;
+
+    mxr_pool_intern(&pool, "");
+    for (int i = 0; i < count; i++) {
+        ID *id = id_array[i];
+        MxrSymbol *sym = &symbols[i];
+        char *base = get_base_name(id->name);
+
+        current_symbol_type = id->itp;
+        sym->name = mxr_pool_intern(&pool, base);
+        sym->scope = id->procname ? mxr_pool_intern(&pool, id->procname) : MXR_NO_SCOPE;
+        sym->type_name = mxr_pool_intern(&pool, type_to_string(id->itp->ttype));
+        sym->ttype = (uint32_t)id->itp->ttype;
+        sym->deflinenum = (uint32_t)id->deflinenum;
+        sym->ref_offset = (uint32_t)refs.size;
+        free(base);
+
+        // Delta-encode the Line list in its printed order
+        int previous = 0;
+        for (Line *line = id->irefp; line; line = line->nextlinep) {
+            unsigned char tmp[8];
+            mxr_buf_append(&refs, tmp, mxr_put_varint(tmp, line->reflinenum - previous));
+            previous = line->reflinenum;
+            sym->ref_count++;
+        }
+        byname[i] = (uint32_t)i;
+    }
+    if (pool.strtab.failed || refs.failed) goto cleanup;
+
+    byname_symbols = symbols;
+    byname_strings = (const char *)pool.strtab.data;
+    qsort(byname, count, sizeof(uint32_t), compare_byname);
+
+    MxrBuf out = {0};
+    MxrHeader header = {0};
+    mxr_buf_append(&out, &header, sizeof(header));
+    header.magic = MXR_MAGIC;
+    header.version = MXR_VERSION;
+    header.symbol_count = (uint32_t)count;
+    header.strtab_offset = (uint32_t)out.size;
+    header.strtab_size = (uint32_t)pool.strtab.size;
+    mxr_buf_append(&out, pool.strtab.data, pool.strtab.size);
+    mxr_buf_pad(&out);
+    header.symtab_offset = (uint32_t)out.size;
+    mxr_buf_append(&out, symbols, count * sizeof(MxrSymbol));
+    header.byname_offset = (uint32_t)out.size;
+    mxr_buf_append(&out, byname, count * sizeof(uint32_t));
+    header.refdata_offset = (uint32_t)out.size;
+    header.refdata_size = (uint32_t)refs.size;
+    mxr_buf_append(&out, refs.data, refs.size);
+
+    if (!out.failed) {
+        memcpy(out.data, &header, sizeof(header));
+        FILE *fp = fopen(path, "wb");
+        if (fp) {
+            if (fwrite(out.data, 1, out.size, fp) == out.size) result = 0;
+            if (fclose(fp) != 0) result = -1;
+        }
+    }
+    free(out.data);
+
+cleanup:
+    mxr_pool_free(&pool);
+    free(refs.data);
+    free(symbols);
+    free(byname);
+    free(id_array);
+    return result;
+}
+
+// Copy the table out in print order so it outlives this thread's symbols
+XrefRow* export_cross_reference_table(int *count_out) {
+    *count_out = 0;
+    if (scanner.has_error || error_state) {
+        return NULL;
+    }
+
+    int count = 0;
+    ID **id_array = collect_sorted_symbols(&count);
+    if (!id_array) return NULL;
+
+    XrefRow *rows = calloc(count > 0 ? count : 1, sizeof(XrefRow));
+    if (!rows) {
+        free(id_array);
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        ID *id = id_array[i];
+        XrefRow *row = &rows[i];
+
+        current_symbol_type = id->itp;
+        row->display_name = get_display_name(id);
+        row->type_name = strdup(type_to_string(id->itp->ttype));
+        row->ttype = id->itp->ttype;
+        row->deflinenum = id->deflinenum;
+        for (Line *line = id->irefp; line; line = line->nextlinep) {
+            row->ref_count++;
+        }
+        row->refs = malloc((row->ref_count > 0 ? row->ref_count : 1) * sizeof(int));
+        int n = 0;
+        for (Line *line = id->irefp; line && row->refs; line = line->nextlinep) {
+            row->refs[n++] = line->reflinenum;
+        }
+    }
+
+    free(id_array);
+    *count_out = count;
+    return rows;
+}
+
+void free_cross_reference_rows(XrefRow *rows, int count) {
+    if (!rows) return;
+    for (int i = 0; i < count; i++) {
+        free(rows[i].display_name);
+        free(rows[i].type_name);
+        free(rows[i].refs);
+    }
+    free(rows);
+}
+
+static void free_type(Type *type) {
+    if (!type) return;
+    struct ParamType *param = type->paratp;
+    while (param) {
+        struct ParamType *next = param->next;
+        free(param);
+        param = next;
+    }
+    free_type(type->etp);
+    free(type);
+}
+
+// Release the symbol table and scope state of the current thread
+void free_cross_referencer(void) {
+    ID *id = symbol_table;
+    while (id) {
+        ID *next = id->nextp;
+        Line *line = id->irefp;
+        while (line) {
+            Line *next_line = line->nextlinep;
+            free(line);
+            line = next_line;
+        }
+        free_type(id->itp);
+        free(id->name);
+        free(id->procname);
+        free(id);
+        id = next;
+    }
+    symbol_table = NULL;
+    free(name_index);
+    name_index = NULL;
+    name_index_size = name_index_count = 0;
+    if (current_procedure) free(current_procedure);
+    current_procedure = NULL;
+    current_procedure_id = NULL;
+    current_symbol_type = NULL;
+    error_state = 0;
+
+    while (fragments) {
+        ProcFragment *next = fragments->next;
+        free(fragments->name);
+        free(fragments);
+        fragments = next;
+    }
+}
+
+void record_procedure_fragment(const char *name, int start_line, int end_line) {
+    ProcFragment *frag = malloc(sizeof(ProcFragment));
+    if (!frag) return;
+    frag->name = strdup(name);
+    frag->start_line = start_line;
+    frag->end_line = end_line;
+    frag->next = fragments;
+    fragments = frag;
+    debug_xref_printf("Procedure fragment %s: lines %d-%d\n", name, start_line, end_line);
+}
+
+static void free_lines(Line *line) {
+    while (line) {
+        Line *next = line->nextlinep;
+        free(line);
+        line = next;
+    }
+}
+
+// Drop references inside [start, end] and move later ones by delta
+static Line* splice_lines(Line *head, int start, int end, int delta) {
+    Line **link = &head;
+    while (*link) {
+        Line *line = *link;
+        if (line->reflinenum >= start && line->reflinenum <= end) {
+            *link = line->nextlinep;
+            free(line);
+            continue;
+        }
+        if (line->reflinenum > end) line->reflinenum += delta;
+        link = &line->nextlinep;
+    }
+    return head;
+}
+
+static int count_lines(const char *text) {
+    int lines = 1;
+    for (const char *p = text; *p; p++) {
+        if (*p == '\n' && p[1] != '\0') lines++;
+    }
+    return lines;
+}
+
+// The code generator resolves names itself; give it the program's globals
+// and procedure signatures before a procedure is parsed on its own
+static void declare_globals_for_codegen(void) {
+    gen_discard();
+    for (ID *id = symbol_table; id; id = id->nextp) {
+        if (id->procname) continue;
+        if (id->itp->ttype == TPROCEDURE) {
+            gen_procedure_entry(id->name);
+            int n = 0;
+            for (struct ParamType *p = id->itp->paratp; p; p = p->next) {
+                char param[16];
+                snprintf(param, sizeof(param), "%%%d", ++n);
+                gen_procedure_param(id->name, param, p->type);
+            }
+            gen_procedure_exit();
+        } else if (id->itp->ttype == TARRAY) {
+            gen_array_allocation(id->name, id->itp->arraysize, id->itp->etp->ttype);
+        } else {
+            gen_variable_allocation(id->name, id->itp->ttype);
+        }
+    }
+}
+
+// Replace one procedure's declaration with new text and re-parse only that
+// procedure. Its locals, parameters and the Line nodes inside its span are
+// rebuilt; everything after the span is shifted by the change in line
+// count. Returns 0 on success, -1 if there is no such procedure, or the
+// line of the first syntax error in text; then the table is left in the
+// error state and the caller should fall back to a full parse.
+int update_procedure_cross_reference(const char *name, const char *text) {
+    ProcFragment **fraglink = &fragments;
+    while (*fraglink && strcmp((*fraglink)->name, name) != 0) {
+        fraglink = &(*fraglink)->next;
+    }
+    if (!*fraglink) return -1;
+
+    ProcFragment *frag = *fraglink;
+    int start = frag->start_line;
+    int end = frag->end_line;
+    int delta = count_lines(text) - (end - start + 1);
+    *fraglink = frag->next;
+    free(frag->name);
+    free(frag);
+
+    // References to the procedure from outside its own span survive
+    Line *outside_refs = NULL;
+    ID **link = &symbol_table;
+    while (*link) {
+        ID *id = *link;
+        int is_proc = id->itp->ttype == TPROCEDURE && strcmp(id->name, name) == 0;
+        int is_local = !is_proc && id->procname && strcmp(id->procname, name) == 0;
+
+        id->irefp = splice_lines(id->irefp, start, end, delta);
+        if (is_proc || is_local) {
+            *link = id->nextp;
+            unindex_symbol(id);
+            if (is_proc) {
+                outside_refs = id->irefp;
+            } else {
+                free_lines(id->irefp);
+            }
+            free_type(id->itp);
+            free(id->name);
+            free(id->procname);
+            free(id);
+            continue;
+        }
+        if (id->deflinenum > end) id->deflinenum += delta;
+        link = &id->nextp;
+    }
+    for (ProcFragment *f = fragments; f; f = f->next) {
+        if (f->start_line > end) {
+            f->start_line += delta;
+            f->end_line += delta;
+        }
+    }
+
+    // Re-parse the new text with code generation discarded
+    FILE *saved_caslfp = caslfp;
+    caslfp = fopen(NULL_DEVICE, "w");
+    current_procedure_id = NULL;
+    error_state = 0;
+
+    int result = -1;
+    if (caslfp && init_scan_string(text, start) == 0) {
+        declare_globals_for_codegen();
+        init_parser();
+        result = parse_procedure_fragment();
+        end_scan();
+    }
+    gen_discard();
+    if (caslfp) fclose(caslfp);
+    caslfp = saved_caslfp;
+    exit_procedure();
+
+    // Reattach the outside references to the re-created procedure entry
+    for (ID *id = symbol_table; id; id = id->nextp) {
+        if (id->itp->ttype == TPROCEDURE && strcmp(id->name, name) == 0) {
+            while (outside_refs) {
+                Line *line = outside_refs;
+                outside_refs = line->nextlinep;
+                Line **pos = &id->irefp;
+                while (*pos && (*pos)->reflinenum < line->reflinenum) pos = &(*pos)->nextlinep;
+                line->nextlinep = *pos;
+                *pos = line;
+            }
+            break;
+        }
+    }
+    free_lines(outside_refs);
+
+    if (result != 0) error_state = 1;
+    return result;
+}
@@ -30,15 +30,51 @@ typedef struct ID {
     int deflinenum;   
     Line *irefp;      
     struct ID *nextp;
+    struct ID *hashp;  // next entry in the same name-index bucket
 } ID;
 
+// Consumers of reference lists. Definitions are always tracked; Line nodes
+// are only recorded while at least one consumer is enabled.
+#define XREF_NEED_NONE   0x00
+#define XREF_NEED_TABLE  0x01  // print_cross_reference_table()
+#define XREF_NEED_INDEX  0x02  // write_cross_reference_index()
+
+extern int xref_consumers;
+#define XREF_RECORDING() (xref_consumers != XREF_NEED_NONE)
+
+// Line span of one procedure declaration. Procedures cannot nest, so every
+// reference inside the span was made from that procedure's body.
+typedef struct PROCFRAG {
+    char *name;
+    int start_line;
+    int end_line;
+    struct PROCFRAG *next;
+} ProcFragment;
+
+// Flattened table row, used to merge the tables of several files
+typedef struct {
+    char *display_name;
+    char *type_name;
+    int ttype;
+    int deflinenum;
+    int *refs;
+    int ref_count;
+} XrefRow;
+
 // Core functionality
 void init_cross_referencer(void);
+void set_xref_consumers(int consumers);
 void add_symbol(char *name, int type, int linenum, int is_definition);
 void add_reference(char *name, int linenum);
 void print_cross_reference_table(void);
+int write_cross_reference_index(const char *path);
+XrefRow* export_cross_reference_table(int *count);
+void free_cross_reference_rows(XrefRow *rows, int count);
+void free_cross_referencer(void);
 
 // Procedure handling
+void record_procedure_fragment(const char *name, int start_line, int end_line);
+int update_procedure_cross_reference(const char *name, const char *text);
 const char* get_current_procedure(void);
 void enter_procedure(const char *name);
 void exit_procedure(void);
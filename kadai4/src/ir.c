@@ -0,0 +1,670 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ir.h"
+#include "token.h"
+
+static void* grow(void *p, int *cap, int need, size_t size) {
+    if (need <= *cap) return p;
+    int n = *cap ? *cap * 2 : 8;
+    while (n < need) n *= 2;
+    p = realloc(p, (size_t)n * size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    *cap = n;
+    return p;
+}
+
+IrModule* ir_module_new(const char *name) {
+    IrModule *m = calloc(1, sizeof(IrModule));
+    m->name = strdup(name ? name : "");
+    return m;
+}
+
+static void free_insn(IrInsn *insn) {
+    free(insn->args);
+}
+
+static void free_block(IrBlock *b) {
+    for (int i = 0; i < b->ninsns; i++) free_insn(&b->insns[i]);
+    free(b->insns);
+    free(b);
+}
+
+static void free_func(IrFunc *f) {
+    for (int j = 0; j < f->nblocks; j++) free_block(f->blocks[j]);
+    free(f->blocks);
+    free(f->params);
+    free(f->name);
+    free(f);
+}
+
+void ir_module_free(IrModule *m) {
+    if (!m) return;
+    for (int i = 0; i < m->nfuncs; i++) free_func(m->funcs[i]);
+    for (int i = 0; i < m->nvars; i++) {
+        free(m->vars[i].name);
+        free(m->vars[i].proc);
+        free(m->vars[i].label);
+    }
+    for (int i = 0; i < m->nstrings; i++) free(m->strings[i]);
+    free(m->funcs);
+    free(m->vars);
+    free(m->strings);
+    free(m->label_blocks);
+    free(m->name);
+    free(m);
+}
+
+int ir_add_var(IrModule *m, const char *name, const char *proc, int kind, int type, int size) {
+    m->vars = grow(m->vars, &m->vcap, m->nvars + 1, sizeof(IrVar));
+    IrVar *v = &m->vars[m->nvars];
+    v->name = strdup(name);
+    v->proc = proc ? strdup(proc) : NULL;
+    v->kind = kind;
+    v->type = type;
+    v->size = size;
+
+    size_t len = strlen(name) + (proc ? strlen(proc) : 0) + 4;
+    v->label = malloc(len);
+    if (kind == IRV_PARAM) {
+        snprintf(v->label, len, "$$%s%%%s", name, proc);
+    } else if (proc) {
+        snprintf(v->label, len, "$%s%%%s", name, proc);
+    } else {
+        snprintf(v->label, len, "$%s", name);
+    }
+    return m->nvars++;
+}
+
+// Exact scope match; proc NULL finds globals only
+int ir_find_var(const IrModule *m, const char *name, const char *proc) {
+    for (int i = m->nvars - 1; i >= 0; i--) {
+        const IrVar *v = &m->vars[i];
+        if (strcmp(v->name, name) != 0) continue;
+        if (proc == NULL ? v->proc == NULL : (v->proc && strcmp(v->proc, proc) == 0)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ir_add_string(IrModule *m, const char *text) {
+    for (int i = 0; i < m->nstrings; i++) {
+        if (strcmp(m->strings[i], text) == 0) return i;
+    }
+    m->strings = grow(m->strings, &m->scap, m->nstrings + 1, sizeof(char *));
+    m->strings[m->nstrings] = strdup(text);
+    return m->nstrings++;
+}
+
+IrFunc* ir_add_func(IrModule *m, const char *name, int is_main) {
+    IrFunc *f = ir_insert_func(m, m->nfuncs, name);
+    f->is_main = is_main;
+    return f;
+}
+
+// Calls to functions at or after `from` move by delta
+static void renumber_callees(IrModule *m, int from, int delta) {
+    for (int i = 0; i < m->nfuncs; i++) {
+        IrFunc *g = m->funcs[i];
+        for (int j = 0; j < g->nblocks; j++) {
+            IrBlock *b = g->blocks[j];
+            for (int k = 0; k < b->ninsns; k++) {
+                if (b->insns[k].op == IR_CALL && b->insns[k].callee >= from) b->insns[k].callee += delta;
+            }
+        }
+    }
+}
+
+IrFunc* ir_insert_func(IrModule *m, int index, const char *name) {
+    renumber_callees(m, index, 1);
+    IrFunc *f = calloc(1, sizeof(IrFunc));
+    f->module = m;
+    f->name = strdup(name);
+    m->funcs = grow(m->funcs, &m->fcap, m->nfuncs + 1, sizeof(IrFunc *));
+    memmove(&m->funcs[index + 1], &m->funcs[index],
+            (size_t)(m->nfuncs - index) * sizeof(IrFunc *));
+    m->funcs[index] = f;
+    m->nfuncs++;
+    return f;
+}
+
+// Remove a procedure nothing calls any more
+void ir_remove_func(IrModule *m, int index) {
+    IrFunc *f = m->funcs[index];
+    for (int j = 0; j < f->nblocks; j++) {
+        int label = f->blocks[j]->label;
+        if (label > 0 && label <= m->nlabels) m->label_blocks[label] = NULL;
+    }
+    free_func(f);
+    memmove(&m->funcs[index], &m->funcs[index + 1],
+            (size_t)(m->nfuncs - index - 1) * sizeof(IrFunc *));
+    m->nfuncs--;
+    renumber_callees(m, index + 1, -1);
+}
+
+int ir_find_func(const IrModule *m, const char *name) {
+    for (int i = 0; i < m->nfuncs; i++) {
+        if (!m->funcs[i]->is_main && strcmp(m->funcs[i]->name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int ir_new_label(IrModule *m) {
+    m->label_blocks = grow(m->label_blocks, &m->lcap, m->nlabels + 2, sizeof(IrBlock *));
+    m->nlabels++;
+    m->label_blocks[m->nlabels] = NULL;
+    return m->nlabels;
+}
+
+int ir_new_temp(IrFunc *f) {
+    return ++f->ntemps;
+}
+
+IrBlock* ir_add_block(IrFunc *f, int label) {
+    return ir_insert_block(f, f->nblocks, label);
+}
+
+IrBlock* ir_insert_block(IrFunc *f, int index, int label) {
+    IrBlock *b = calloc(1, sizeof(IrBlock));
+    b->label = label;
+    f->blocks = grow(f->blocks, &f->cap, f->nblocks + 1, sizeof(IrBlock *));
+    memmove(&f->blocks[index + 1], &f->blocks[index],
+            (size_t)(f->nblocks - index) * sizeof(IrBlock *));
+    f->blocks[index] = b;
+    f->nblocks++;
+    if (label > 0 && label <= f->module->nlabels) {
+        f->module->label_blocks[label] = b;
+    }
+    return b;
+}
+
+IrInsn* ir_insert(IrBlock *b, int pos, IrOp op) {
+    b->insns = grow(b->insns, &b->cap, b->ninsns + 1, sizeof(IrInsn));
+    memmove(&b->insns[pos + 1], &b->insns[pos], (size_t)(b->ninsns - pos) * sizeof(IrInsn));
+    b->ninsns++;
+    IrInsn *insn = &b->insns[pos];
+    memset(insn, 0, sizeof(IrInsn));
+    insn->op = op;
+    insn->var = -1;
+    insn->callee = -1;
+    return insn;
+}
+
+IrInsn* ir_append(IrBlock *b, IrOp op) {
+    return ir_insert(b, b->ninsns, op);
+}
+
+void ir_remove(IrBlock *b, int pos) {
+    free_insn(&b->insns[pos]);
+    memmove(&b->insns[pos], &b->insns[pos + 1], (size_t)(b->ninsns - pos - 1) * sizeof(IrInsn));
+    b->ninsns--;
+}
+
+void ir_remove_block(IrFunc *f, int index) {
+    IrBlock *b = f->blocks[index];
+    if (b->label > 0 && b->label <= f->module->nlabels &&
+        f->module->label_blocks[b->label] == b) {
+        f->module->label_blocks[b->label] = NULL;
+    }
+    free_block(b);
+    memmove(&f->blocks[index], &f->blocks[index + 1],
+            (size_t)(f->nblocks - index - 1) * sizeof(IrBlock *));
+    f->nblocks--;
+}
+
+// Wrap to a signed 16-bit word
+static int word(long v) {
+    return (int)(((v + 32768) & 0xFFFF) - 32768);
+}
+
+int ir_fold(IrOp op, int a, int b, int flags, int *result) {
+    long r;
+    switch (op) {
+        case IR_MOV: r = a; break;
+        case IR_ADD: r = (long)a + b; break;
+        case IR_SUB: r = (long)a - b; break;
+        case IR_MUL: r = (long)a * b; break;
+        case IR_DIV:
+            if (b == 0) return 0;
+            r = (long)a / b;
+            break;
+        case IR_NEG: r = -(long)a; break;
+        case IR_AND: r = a & b; break;
+        case IR_OR:  r = a | b; break;
+        case IR_NOT: r = a ^ 1; break;
+        case IR_EQ:  r = a == b; break;
+        case IR_NE:  r = a != b; break;
+        case IR_LT:  r = a < b; break;
+        case IR_LE:  r = a <= b; break;
+        case IR_GT:  r = a > b; break;
+        case IR_GE:  r = a >= b; break;
+        default: return 0;
+    }
+    if ((flags & IRF_OVERFLOW) && word(r) != r) return 0;
+    *result = word(r);
+    return 1;
+}
+
+// Rewrite an instruction in place, keeping its destination and line
+static void reset_insn(IrInsn *insn, IrOp op) {
+    int dst = insn->dst, line = insn->line;
+    free_insn(insn);
+    memset(insn, 0, sizeof(IrInsn));
+    insn->op = op;
+    insn->dst = dst;
+    insn->line = line;
+    insn->var = -1;
+    insn->callee = -1;
+}
+
+void ir_make_mov(IrInsn *insn, IrValue v) {
+    reset_insn(insn, IR_MOV);
+    insn->a = v;
+}
+
+void ir_make_jump(IrInsn *insn, int target) {
+    reset_insn(insn, IR_JUMP);
+    insn->dst = 0;
+    insn->target = target;
+}
+
+void ir_make_nop(IrInsn *insn) {
+    reset_insn(insn, IR_NOP);
+    insn->dst = 0;
+}
+
+IrValue ir_temp(int t) {
+    IrValue v = { IR_TEMP, t };
+    return v;
+}
+
+IrValue ir_const(int c) {
+    IrValue v = { IR_CONST, c };
+    return v;
+}
+
+IrValue ir_empty(void) {
+    IrValue v = { IR_EMPTY, 0 };
+    return v;
+}
+
+IrBlock* ir_block(const IrFunc *f, int label) {
+    if (label <= 0 || label > f->module->nlabels) return NULL;
+    return f->module->label_blocks[label];
+}
+
+int ir_block_index(const IrFunc *f, int label) {
+    for (int i = 0; i < f->nblocks; i++) {
+        if (f->blocks[i]->label == label) return i;
+    }
+    return -1;
+}
+
+int ir_is_terminator(IrOp op) {
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RET;
+}
+
+IrInsn* ir_terminator(IrBlock *b) {
+    if (b->ninsns == 0 || !ir_is_terminator(b->insns[b->ninsns - 1].op)) return NULL;
+    return &b->insns[b->ninsns - 1];
+}
+
+int ir_successors(const IrBlock *b, int labels[2]) {
+    if (b->ninsns == 0) return 0;
+    const IrInsn *t = &b->insns[b->ninsns - 1];
+    switch (t->op) {
+        case IR_JUMP:
+            labels[0] = t->target;
+            return 1;
+        case IR_BRANCH:
+            labels[0] = t->target;
+            labels[1] = t->target2;
+            return t->target == t->target2 ? 1 : 2;
+        default:
+            return 0;
+    }
+}
+
+// Operands read by insn, as pointers so passes can rewrite them in place
+int ir_uses(IrInsn *insn, IrValue **out, int max) {
+    int n = 0;
+    if (insn->a.kind != IR_EMPTY && n < max) out[n++] = &insn->a;
+    if (insn->b.kind != IR_EMPTY && n < max) out[n++] = &insn->b;
+    for (int i = 0; i < insn->nargs && n < max; i++) {
+        if (insn->args[i].kind != IR_ARG_VAR) out[n++] = &insn->args[i].value;
+    }
+    return n;
+}
+
+int ir_count_insns(const IrModule *m) {
+    int n = 0;
+    for (int i = 0; i < m->nfuncs; i++) {
+        for (int j = 0; j < m->funcs[i]->nblocks; j++) {
+            n += m->funcs[i]->blocks[j]->ninsns;
+        }
+    }
+    return n;
+}
+
+static const char *op_names[IR_OPCOUNT] = {
+    "nop", "mov", "load", "store", "add", "sub", "mul", "div", "and", "or",
+    "neg", "not", "eq", "ne", "lt", "le", "gt", "ge", "check", "call",
+    "read", "readln", "write", "writestr", "writeln", "jump", "branch", "ret"
+};
+
+const char* ir_op_name(IrOp op) {
+    return op < IR_OPCOUNT ? op_names[op] : "?";
+}
+
+// Dump
+
+static void dump_value(IrValue v, FILE *out) {
+    if (v.kind == IR_TEMP) fprintf(out, "t%d", v.value);
+    else if (v.kind == IR_CONST) fprintf(out, "%d", v.value);
+    else fprintf(out, "_");
+}
+
+static void dump_var(const IrModule *m, int var, IrValue index, FILE *out) {
+    if (var < 0 || var >= m->nvars) {
+        fprintf(out, "?");
+        return;
+    }
+    const IrVar *v = &m->vars[var];
+    fprintf(out, "%s", v->name);
+    if (v->proc) fprintf(out, "%%%s", v->proc);
+    if (index.kind != IR_EMPTY) {
+        fprintf(out, "[");
+        dump_value(index, out);
+        fprintf(out, "]");
+    }
+}
+
+static void dump_string(const char *s, FILE *out) {
+    fputc('\'', out);
+    for (; *s; s++) {
+        if (*s == '\'') fputc('\'', out);
+        fputc(*s, out);
+    }
+    fputc('\'', out);
+}
+
+static void dump_insn(const IrModule *m, const IrInsn *insn, FILE *out) {
+    fprintf(out, "    ");
+    if (insn->dst) fprintf(out, "t%d = ", insn->dst);
+    fprintf(out, "%s", ir_op_name(insn->op));
+
+    switch (insn->op) {
+        case IR_LOAD:
+        case IR_READ:
+            fprintf(out, " ");
+            dump_var(m, insn->var, insn->a, out);
+            break;
+        case IR_STORE:
+            fprintf(out, " ");
+            dump_var(m, insn->var, insn->a, out);
+            fprintf(out, ", ");
+            dump_value(insn->b, out);
+            break;
+        case IR_CHECK:
+            fprintf(out, " ");
+            dump_value(insn->a, out);
+            fprintf(out, " < %d", insn->imm);
+            break;
+        case IR_CALL:
+            fprintf(out, " %s(", insn->callee >= 0 && insn->callee < m->nfuncs
+                                 ? m->funcs[insn->callee]->name : "?");
+            for (int i = 0; i < insn->nargs; i++) {
+                const IrArg *arg = &insn->args[i];
+                if (i) fprintf(out, ", ");
+                if (arg->kind == IR_ARG_VAR) {
+                    fprintf(out, "&");
+                    dump_var(m, arg->var, ir_empty(), out);
+                } else if (arg->kind == IR_ARG_ELEM) {
+                    fprintf(out, "&");
+                    dump_var(m, arg->var, arg->value, out);
+                } else {
+                    dump_value(arg->value, out);
+                }
+            }
+            fprintf(out, ")");
+            break;
+        case IR_WRITE:
+            fprintf(out, " ");
+            dump_value(insn->a, out);
+            fprintf(out, " : %d (%s)", insn->imm,
+                    insn->mode == TCHAR ? "char" : insn->mode == TBOOLEAN ? "boolean" : "integer");
+            break;
+        case IR_WRITESTR:
+            fprintf(out, " ");
+            if (insn->imm >= 0 && insn->imm < m->nstrings) dump_string(m->strings[insn->imm], out);
+            break;
+        case IR_JUMP:
+            fprintf(out, " L%04d", insn->target);
+            break;
+        case IR_BRANCH:
+            fprintf(out, " %s ", ir_op_name((IrOp)insn->mode));
+            dump_value(insn->a, out);
+            fprintf(out, ", ");
+            dump_value(insn->b, out);
+            fprintf(out, " ? L%04d : L%04d", insn->target, insn->target2);
+            break;
+        default:
+            if (insn->a.kind != IR_EMPTY) {
+                fprintf(out, " ");
+                dump_value(insn->a, out);
+            }
+            if (insn->b.kind != IR_EMPTY) {
+                fprintf(out, ", ");
+                dump_value(insn->b, out);
+            }
+            break;
+    }
+    if (insn->flags & IRF_OVERFLOW) fprintf(out, " !ovf");
+    if (insn->flags & IRF_ZERODIV) fprintf(out, " !zdiv");
+    fprintf(out, "\n");
+}
+
+void ir_dump_func(const IrModule *m, const IrFunc *f, FILE *out) {
+    fprintf(out, "%s %s(", f->is_main ? "program" : "procedure", f->name);
+    for (int i = 0; i < f->nparams; i++) {
+        fprintf(out, i ? ", %s" : "%s", m->vars[f->params[i]].name);
+    }
+    fprintf(out, ")\n");
+    for (int i = 0; i < f->nblocks; i++) {
+        const IrBlock *b = f->blocks[i];
+        fprintf(out, "L%04d:\n", b->label);
+        for (int j = 0; j < b->ninsns; j++) dump_insn(m, &b->insns[j], out);
+    }
+}
+
+void ir_dump(const IrModule *m, FILE *out) {
+    for (int i = 0; i < m->nvars; i++) {
+        const IrVar *v = &m->vars[i];
+        fprintf(out, "var %s : ", v->label);
+        if (v->size > 0) fprintf(out, "array[%d] of ", v->size);
+        fprintf(out, "%s\n", v->type == TCHAR ? "char" : v->type == TBOOLEAN ? "boolean" : "integer");
+    }
+    // Procedures first, in declaration order, then the main program
+    for (int i = 1; i < m->nfuncs; i++) {
+        fprintf(out, "\n");
+        ir_dump_func(m, m->funcs[i], out);
+    }
+    if (m->nfuncs > 0) {
+        fprintf(out, "\n");
+        ir_dump_func(m, m->funcs[0], out);
+    }
+}
+
+// Verifier
+
+typedef struct {
+    const IrModule *m;
+    const IrFunc *f;
+    const IrBlock *b;
+    FILE *err;
+    int errors;
+} VerifyState;
+
+static void verify_error(VerifyState *s, const char *message) {
+    if (s->err) {
+        fprintf(s->err, "IR error in %s, block L%04d: %s\n",
+                s->f->name, s->b ? s->b->label : 0, message);
+    }
+    s->errors++;
+}
+
+static void verify_value(VerifyState *s, IrValue v, const unsigned char *defined) {
+    if (v.kind == IR_TEMP) {
+        if (v.value <= 0 || v.value > s->f->ntemps) verify_error(s, "temp out of range");
+        else if (!defined[v.value]) verify_error(s, "temp used but never defined");
+    } else if (v.kind == IR_CONST) {
+        if (v.value < -32768 || v.value > 65535) verify_error(s, "constant does not fit 16 bits");
+    }
+}
+
+static void verify_access(VerifyState *s, int var, IrValue index) {
+    if (var < 0 || var >= s->m->nvars) {
+        verify_error(s, "bad variable");
+        return;
+    }
+    const IrVar *v = &s->m->vars[var];
+    if ((v->size > 0) != (index.kind != IR_EMPTY)) {
+        verify_error(s, v->size > 0 ? "array accessed without index" : "scalar accessed with index");
+    }
+    if (v->proc && (s->f->is_main || strcmp(v->proc, s->f->name) != 0)) {
+        verify_error(s, "variable of another procedure");
+    }
+}
+
+static void verify_insn(VerifyState *s, const IrInsn *insn, const unsigned char *defined) {
+    int binary = insn->op >= IR_ADD && insn->op <= IR_OR;
+    int relation = insn->op >= IR_EQ && insn->op <= IR_GE;
+
+    if (insn->dst && (insn->dst < 0 || insn->dst > s->f->ntemps)) verify_error(s, "dst out of range");
+    if (insn->a.kind != IR_EMPTY) verify_value(s, insn->a, defined);
+    if (insn->b.kind != IR_EMPTY) verify_value(s, insn->b, defined);
+
+    switch (insn->op) {
+        case IR_MOV:
+        case IR_NEG:
+        case IR_NOT:
+            if (!insn->dst || insn->a.kind == IR_EMPTY) verify_error(s, "unary op needs dst and a");
+            break;
+        case IR_LOAD:
+            if (!insn->dst) verify_error(s, "load without dst");
+            verify_access(s, insn->var, insn->a);
+            break;
+        case IR_STORE:
+            if (insn->b.kind == IR_EMPTY) verify_error(s, "store without value");
+            verify_access(s, insn->var, insn->a);
+            break;
+        case IR_READ:
+            verify_access(s, insn->var, insn->a);
+            break;
+        case IR_CHECK:
+            if (insn->a.kind == IR_EMPTY || insn->imm <= 0) verify_error(s, "malformed bounds check");
+            break;
+        case IR_CALL: {
+            if (insn->callee <= 0 || insn->callee >= s->m->nfuncs) {
+                verify_error(s, "bad callee");
+                break;
+            }
+            const IrFunc *callee = s->m->funcs[insn->callee];
+            if (callee->nparams != insn->nargs) verify_error(s, "argument count mismatch");
+            for (int i = 0; i < insn->nargs; i++) {
+                const IrArg *arg = &insn->args[i];
+                if (arg->kind == IR_ARG_VAR) {
+                    verify_access(s, arg->var, ir_empty());
+                } else if (arg->kind == IR_ARG_ELEM) {
+                    verify_access(s, arg->var, arg->value);
+                    verify_value(s, arg->value, defined);
+                } else if (arg->kind == IR_ARG_VALUE) {
+                    verify_value(s, arg->value, defined);
+                } else {
+                    verify_error(s, "bad argument kind");
+                }
+            }
+            break;
+        }
+        case IR_WRITE:
+            if (insn->a.kind == IR_EMPTY) verify_error(s, "write without value");
+            break;
+        case IR_WRITESTR:
+            if (insn->imm < 0 || insn->imm >= s->m->nstrings) verify_error(s, "bad string");
+            break;
+        case IR_JUMP:
+            if (!ir_block(s->f, insn->target)) verify_error(s, "jump to unknown label");
+            break;
+        case IR_BRANCH:
+            if (insn->mode < IR_EQ || insn->mode > IR_GE) verify_error(s, "bad branch relation");
+            if (insn->a.kind == IR_EMPTY || insn->b.kind == IR_EMPTY) verify_error(s, "branch needs two operands");
+            if (!ir_block(s->f, insn->target) || !ir_block(s->f, insn->target2)) {
+                verify_error(s, "branch to unknown label");
+            }
+            break;
+        default:
+            if ((binary || relation) &&
+                (!insn->dst || insn->a.kind == IR_EMPTY || insn->b.kind == IR_EMPTY)) {
+                verify_error(s, "binary op needs dst, a and b");
+            }
+            break;
+    }
+}
+
+static void verify_func(VerifyState *s) {
+    const IrFunc *f = s->f;
+    unsigned char *defined = calloc((size_t)f->ntemps + 1, 1);
+
+    // Temps may be defined in any block; uses are only checked for a definition
+    for (int i = 0; i < f->nblocks; i++) {
+        const IrBlock *b = f->blocks[i];
+        for (int j = 0; j < b->ninsns; j++) {
+            int d = b->insns[j].dst;
+            if (d > 0 && d <= f->ntemps) defined[d] = 1;
+        }
+    }
+
+    if (f->nblocks == 0) {
+        s->b = NULL;
+        verify_error(s, "function without blocks");
+    }
+    for (int i = 0; i < f->nblocks; i++) {
+        const IrBlock *b = f->blocks[i];
+        s->b = b;
+        if (ir_block(f, b->label) != b) verify_error(s, "label not mapped to its block");
+        if (b->ninsns == 0 || !ir_is_terminator(b->insns[b->ninsns - 1].op)) {
+            verify_error(s, "block does not end in a terminator");
+        }
+        for (int j = 0; j < b->ninsns; j++) {
+            if (j < b->ninsns - 1 && ir_is_terminator(b->insns[j].op)) {
+                verify_error(s, "terminator in the middle of a block");
+            }
+            verify_insn(s, &b->insns[j], defined);
+        }
+        // Branch targets must belong to this function
+        int succ[2];
+        int n = ir_successors(b, succ);
+        for (int k = 0; k < n; k++) {
+            if (ir_block_index(f, succ[k]) < 0) verify_error(s, "successor in another function");
+        }
+    }
+    free(defined);
+}
+
+// Returns the number of problems found, each reported on err (if not NULL)
+int ir_verify(const IrModule *m, FILE *err) {
+    VerifyState s = { m, NULL, NULL, err, 0 };
+    if (m->nfuncs == 0 || !m->funcs[0]->is_main) {
+        if (err) fprintf(err, "IR error: module has no main program\n");
+        return 1;
+    }
+    for (int i = 0; i < m->nfuncs; i++) {
+        s.f = m->funcs[i];
+        verify_func(&s);
+    }
+    return s.errors;
+}
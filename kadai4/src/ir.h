@@ -0,0 +1,187 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdio.h>
+
+// Three-address intermediate representation between the parser and the
+// CASL emitter.
+//
+// A module holds every variable of the program and one function per
+// procedure; funcs[0] is the main program. A function is a list of basic
+// blocks, the first one being its entry. Every block ends in exactly one
+// terminator (IR_JUMP, IR_BRANCH or IR_RET) and contains no other.
+// Values live in virtual temporaries t1..tN, numbered per function; an
+// operand is either a temporary or a 16-bit constant. Block labels are
+// unique in the module and become L%04d in the CASL output.
+
+typedef enum {
+    IR_NOP,
+    IR_MOV,        // dst = a
+    IR_LOAD,       // dst = var           dst = var[a] for arrays
+    IR_STORE,      // var = b             var[a] = b for arrays
+    IR_ADD,        // dst = a + b
+    IR_SUB,        // dst = a - b
+    IR_MUL,        // dst = a * b
+    IR_DIV,        // dst = a div b
+    IR_AND,        // dst = a and b
+    IR_OR,         // dst = a or b
+    IR_NEG,        // dst = -a
+    IR_NOT,        // dst = not a          (a is 0 or 1)
+    IR_EQ,         // dst = a = b          (0 or 1)
+    IR_NE,         // dst = a <> b
+    IR_LT,         // dst = a < b
+    IR_LE,         // dst = a <= b
+    IR_GT,         // dst = a > b
+    IR_GE,         // dst = a >= b
+    IR_CHECK,      // trap with EROV unless 0 <= a < imm (the size of var)
+    IR_CALL,       // call callee(args)
+    IR_READ,       // read var / var[a], integer or char by the var's type
+    IR_READLN,     // skip the rest of the input line
+    IR_WRITE,      // write a with field width imm, mode is the value type
+    IR_WRITESTR,   // write module string imm
+    IR_WRITELN,
+    IR_JUMP,       // goto target
+    IR_BRANCH,     // if a mode b goto target else goto target2
+    IR_RET,
+    IR_OPCOUNT
+} IrOp;
+
+// Operand kinds
+#define IR_EMPTY 0
+#define IR_TEMP  1
+#define IR_CONST 2
+
+typedef struct {
+    int kind;
+    int value;  // temp number or constant
+} IrValue;
+
+// Instruction flags
+#define IRF_OVERFLOW 0x01  // JOV EOVF after ADD/SUB/MUL/NEG/DIV
+#define IRF_ZERODIV  0x02  // E0DIV when the divisor of a DIV is zero
+
+// Variable kinds
+#define IRV_GLOBAL 0
+#define IRV_LOCAL  1
+#define IRV_PARAM  2  // holds the address of the caller's variable
+
+typedef struct {
+    char *name;
+    char *proc;   // owning procedure, NULL for globals
+    int kind;
+    int type;     // TINTEGER, TCHAR or TBOOLEAN (element type for arrays)
+    int size;     // element count for arrays, 0 for scalars
+    char *label;  // CASL label: $x, $x%proc or $$x%proc
+} IrVar;
+
+// Arguments are passed by reference
+#define IR_ARG_VAR   0  // &var
+#define IR_ARG_ELEM  1  // &var[value]
+#define IR_ARG_VALUE 2  // address of a cell holding value
+
+typedef struct {
+    int kind;
+    int var;
+    IrValue value;
+} IrArg;
+
+typedef struct {
+    IrOp op;
+    int dst;          // destination temp, 0 if none
+    IrValue a, b;
+    int var;          // variable of LOAD/STORE/CHECK/READ, -1 if none
+    int imm;          // CHECK bound, WRITE width, WRITESTR string
+    int mode;         // BRANCH relation (IR_EQ..IR_GE), WRITE value type
+    int callee;       // CALL: function index
+    int target;       // JUMP/BRANCH label
+    int target2;      // BRANCH label when the relation is false
+    int flags;
+    IrArg *args;
+    int nargs;
+    int line;         // source line
+} IrInsn;
+
+typedef struct IrBlock {
+    int label;
+    IrInsn *insns;
+    int ninsns;
+    int cap;
+} IrBlock;
+
+struct IrModule;
+
+typedef struct IrFunc {
+    struct IrModule *module;
+    char *name;
+    int is_main;
+    int *params;      // variable indices in declaration order
+    int nparams;
+    IrBlock **blocks; // blocks[0] is the entry
+    int nblocks;
+    int cap;
+    int ntemps;
+} IrFunc;
+
+typedef struct IrModule {
+    char *name;       // program name
+    IrVar *vars;
+    int nvars;
+    int vcap;
+    IrFunc **funcs;   // funcs[0] is the main program
+    int nfuncs;
+    int fcap;
+    char **strings;   // WRITESTR literals
+    int nstrings;
+    int scap;
+    IrBlock **label_blocks;  // label -> block, NULL if unused
+    int nlabels;      // labels are 1..nlabels
+    int lcap;
+} IrModule;
+
+// Construction
+IrModule* ir_module_new(const char *name);
+void ir_module_free(IrModule *m);
+int ir_add_var(IrModule *m, const char *name, const char *proc, int kind, int type, int size);
+int ir_find_var(const IrModule *m, const char *name, const char *proc);
+int ir_add_string(IrModule *m, const char *text);
+IrFunc* ir_add_func(IrModule *m, const char *name, int is_main);
+int ir_find_func(const IrModule *m, const char *name);
+IrFunc* ir_insert_func(IrModule *m, int index, const char *name);  // a procedure
+void ir_remove_func(IrModule *m, int index);
+int ir_new_label(IrModule *m);
+int ir_new_temp(IrFunc *f);
+IrBlock* ir_add_block(IrFunc *f, int label);
+IrBlock* ir_insert_block(IrFunc *f, int index, int label);
+IrInsn* ir_append(IrBlock *b, IrOp op);
+IrInsn* ir_insert(IrBlock *b, int pos, IrOp op);
+void ir_remove(IrBlock *b, int pos);
+void ir_remove_block(IrFunc *f, int index);
+void ir_make_mov(IrInsn *insn, IrValue v);      // dst = v, in place
+void ir_make_jump(IrInsn *insn, int target);
+void ir_make_nop(IrInsn *insn);
+
+IrValue ir_temp(int t);
+IrValue ir_const(int c);
+IrValue ir_empty(void);
+
+// Queries
+IrBlock* ir_block(const IrFunc *f, int label);
+int ir_block_index(const IrFunc *f, int label);
+int ir_is_terminator(IrOp op);
+IrInsn* ir_terminator(IrBlock *b);
+int ir_successors(const IrBlock *b, int labels[2]);
+int ir_uses(IrInsn *insn, IrValue **out, int max);
+int ir_count_insns(const IrModule *m);
+const char* ir_op_name(IrOp op);
+
+// Evaluate a MOV, arithmetic, logical or relational op on constants the
+// way the CASL code would; returns 0 if it would trap (overflow checked
+// by flags, division by zero) or cannot be evaluated
+int ir_fold(IrOp op, int a, int b, int flags, int *result);
+
+// Text dump and structural checks
+void ir_dump(const IrModule *m, FILE *out);
+void ir_dump_func(const IrModule *m, const IrFunc *f, FILE *out);
+int ir_verify(const IrModule *m, FILE *err);
+
+#endif
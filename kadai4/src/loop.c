@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loop.h"
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void build_cfg(Loop *l) {
+    IrFunc *f = l->f;
+    int n = l->n = f->nblocks;
+    l->succ = xcalloc(n, sizeof(int[2]));
+    l->nsucc = xcalloc(n, sizeof(int));
+    l->reached = xcalloc(n, 1);
+    l->dom = xcalloc((size_t)n * n, 1);
+    l->in_loop = xcalloc(n, 1);
+    for (int b = 0; b < n; b++) {
+        int labels[2];
+        int k = ir_successors(f->blocks[b], labels);
+        for (int i = 0; i < k; i++) l->succ[b][i] = ir_block_index(f, labels[i]);
+        l->nsucc[b] = k;
+    }
+
+    int *stack = xcalloc(n, sizeof(int));
+    int sp = 0;
+    stack[sp++] = 0;
+    l->reached[0] = 1;
+    while (sp > 0) {
+        int b = stack[--sp];
+        for (int i = 0; i < l->nsucc[b]; i++) {
+            int s = l->succ[b][i];
+            if (!l->reached[s]) {
+                l->reached[s] = 1;
+                stack[sp++] = s;
+            }
+        }
+    }
+    free(stack);
+
+    // Iterative dominators over the reached blocks
+    for (int b = 0; b < n; b++) {
+        memset(&l->dom[b * n], b == 0 ? 0 : 1, n);
+    }
+    l->dom[0] = 1;
+    char *tmp = xcalloc(n, 1);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = 1; b < n; b++) {
+            if (!l->reached[b]) continue;
+            memset(tmp, 1, n);
+            for (int p = 0; p < n; p++) {
+                if (!l->reached[p]) continue;
+                for (int i = 0; i < l->nsucc[p]; i++) {
+                    if (l->succ[p][i] != b) continue;
+                    for (int d = 0; d < n; d++) tmp[d] &= l->dom[p * n + d];
+                }
+            }
+            tmp[b] = 1;
+            if (memcmp(tmp, &l->dom[b * n], n) != 0) {
+                memcpy(&l->dom[b * n], tmp, n);
+                changed = 1;
+            }
+        }
+    }
+    free(tmp);
+}
+
+static void free_cfg(Loop *l) {
+    free(l->succ);
+    free(l->nsucc);
+    free(l->reached);
+    free(l->dom);
+    free(l->in_loop);
+}
+
+static int dominates(const Loop *l, int d, int b) {
+    return l->dom[b * l->n + d];
+}
+
+// Blocks of the loop headed by h into in_loop; returns their number, 0
+// if h heads no loop
+static int loop_body(Loop *l, int h) {
+    int n = l->n;
+    memset(l->in_loop, 0, n);
+    int *stack = xcalloc(n, sizeof(int));
+    int sp = 0;
+    int size = 1;
+    l->in_loop[h] = 1;
+    for (int b = 0; b < n; b++) {
+        if (!l->reached[b] || !dominates(l, h, b)) continue;
+        for (int i = 0; i < l->nsucc[b]; i++) {
+            if (l->succ[b][i] == h && !l->in_loop[b]) {
+                l->in_loop[b] = 1;
+                size++;
+                stack[sp++] = b;
+            }
+        }
+    }
+    if (sp == 0) {
+        free(stack);
+        return 0;
+    }
+    while (sp > 0) {
+        int b = stack[--sp];
+        for (int p = 0; p < n; p++) {
+            if (!l->reached[p] || l->in_loop[p]) continue;
+            for (int i = 0; i < l->nsucc[p]; i++) {
+                if (l->succ[p][i] == b) {
+                    l->in_loop[p] = 1;
+                    size++;
+                    stack[sp++] = p;
+                    break;
+                }
+            }
+        }
+    }
+    free(stack);
+    return size;
+}
+
+// The smallest loop whose header is not in done; 0 if there is none
+static int find_loop(Loop *l, const int *done, int ndone) {
+    int best = -1;
+    int best_size = 0;
+    // The entry block cannot get a preheader in front of it
+    for (int h = 1; h < l->n; h++) {
+        int skip = 0;
+        for (int i = 0; i < ndone; i++) {
+            if (done[i] == l->f->blocks[h]->label) skip = 1;
+        }
+        if (skip || !l->reached[h]) continue;
+        int size = loop_body(l, h);
+        if (size > 0 && (best < 0 || size < best_size)) {
+            best = h;
+            best_size = size;
+        }
+    }
+    if (best < 0) return 0;
+    loop_body(l, best);
+    l->header = best;
+    return 1;
+}
+
+int loop_walk(IrFunc *f, LoopFunc fn) {
+    int result = 0;
+    int cap = 8;
+    int *done = xcalloc(cap, sizeof(int));
+    int ndone = 0;
+    for (;;) {
+        Loop l = { .f = f };
+        build_cfg(&l);
+        if (!find_loop(&l, done, ndone)) {
+            free_cfg(&l);
+            break;
+        }
+        if (ndone == cap) {
+            cap *= 2;
+            done = realloc(done, cap * sizeof(int));
+            if (!done) {
+                fprintf(stderr, "Error: out of memory\n");
+                exit(1);
+            }
+        }
+        done[ndone++] = f->blocks[l.header]->label;
+        result += fn(&l);
+        free_cfg(&l);
+    }
+    free(done);
+    return result;
+}
+
+IrBlock* loop_preheader(Loop *l) {
+    IrFunc *f = l->f;
+    int h = l->header;
+    int outside = -1;
+    int count = 0;
+    for (int p = 0; p < l->n; p++) {
+        if (!l->reached[p] || l->in_loop[p]) continue;
+        for (int i = 0; i < l->nsucc[p]; i++) {
+            if (l->succ[p][i] == h) {
+                outside = p;
+                count++;
+                break;
+            }
+        }
+    }
+    if (count == 1 && l->nsucc[outside] == 1) return f->blocks[outside];
+
+    int hlabel = f->blocks[h]->label;
+    int label = ir_new_label(f->module);
+    for (int p = 0; p < l->n; p++) {
+        if (l->in_loop[p]) continue;
+        IrInsn *term = ir_terminator(f->blocks[p]);
+        if (!term) continue;
+        if (term->op == IR_JUMP || term->op == IR_BRANCH) {
+            if (term->target == hlabel) term->target = label;
+        }
+        if (term->op == IR_BRANCH && term->target2 == hlabel) term->target2 = label;
+    }
+    IrBlock *pre = ir_insert_block(f, h, label);
+    ir_make_jump(ir_append(pre, IR_JUMP), hlabel);
+    return pre;
+}
+
+void loop_effects(const Loop *l, LoopEffects *e) {
+    const IrModule *m = l->f->module;
+    e->written = xcalloc(m->nvars, 1);
+    e->has_call = e->writes_param = e->writes_global = e->has_io = 0;
+    for (int b = 0; b < l->n; b++) {
+        if (!l->in_loop[b]) continue;
+        const IrBlock *block = l->f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            const IrInsn *insn = &block->insns[j];
+            switch (insn->op) {
+                case IR_STORE: case IR_READ:
+                    e->written[insn->var] = 1;
+                    if (m->vars[insn->var].kind == IRV_PARAM) e->writes_param = 1;
+                    if (m->vars[insn->var].kind == IRV_GLOBAL) e->writes_global = 1;
+                    if (insn->op == IR_READ) e->has_io = 1;
+                    break;
+                case IR_CALL:
+                    e->has_call = 1;
+                    for (int k = 0; k < insn->nargs; k++) {
+                        if (insn->args[k].kind != IR_ARG_VALUE) e->written[insn->args[k].var] = 1;
+                    }
+                    break;
+                case IR_READLN: case IR_WRITE: case IR_WRITESTR: case IR_WRITELN:
+                    e->has_io = 1;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+void loop_effects_free(LoopEffects *e) {
+    free(e->written);
+    e->written = NULL;
+}
+
+int loop_var_unchanged(const Loop *l, const LoopEffects *e, int var) {
+    if (e->written[var]) return 0;
+    switch (l->f->module->vars[var].kind) {
+        case IRV_LOCAL:
+            return 1;
+        case IRV_GLOBAL:
+            // A VAR parameter may be the address of any global
+            return !e->has_call && !e->writes_param;
+        default:
+            return !e->has_call && !e->writes_param && !e->writes_global;
+    }
+}
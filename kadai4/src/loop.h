@@ -0,0 +1,50 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "ir.h"
+
+// Natural loops of an IR function, for the loop passes.
+//
+// A loop is a header block h together with every block that reaches a
+// back edge into h (an edge from a block h dominates) without passing
+// through h. loop_walk() hands the loops of a function to a callback one
+// at a time, innermost first; the CFG is rebuilt before each call, so the
+// callback may add and retarget blocks freely.
+
+typedef struct {
+    IrFunc *f;
+    int n;               // blocks
+    int (*succ)[2];      // successor block indices
+    int *nsucc;
+    char *reached;
+    char *dom;           // dom[b * n + d]: d dominates b
+    char *in_loop;       // blocks of the current loop
+    int header;
+} Loop;
+
+// What the blocks of a loop may write
+typedef struct {
+    char *written;       // per var: stored, read into or passed to a call
+    int has_call;
+    int writes_param;    // a STORE/READ through a parameter
+    int writes_global;
+    int has_io;          // READ/WRITE..., which take the registers as calls do
+} LoopEffects;
+
+typedef int (*LoopFunc)(Loop *l);
+
+// Calls fn on every loop of f; returns the sum of what fn returned
+int loop_walk(IrFunc *f, LoopFunc fn);
+
+// Block right before the loop: the only way in if it leads nowhere else,
+// otherwise a new block that the entering edges are redirected to. A
+// new block shifts the blocks after it: the indices in l are stale then.
+IrBlock* loop_preheader(Loop *l);
+
+void loop_effects(const Loop *l, LoopEffects *e);
+void loop_effects_free(LoopEffects *e);
+// Is a LOAD of var the same on every iteration as far as the loop's own
+// writes go?
+int loop_var_unchanged(const Loop *l, const LoopEffects *e, int var);
+
+#endif
@@ -11,6 +11,10 @@
 #include "parser.h"
 #include "cross_referencer.h"
 #include "compiler.h"
+#include "project.h"
+#include "peephole.h"
+#include "optimizer.h"
+#include "overlay.h"
 
 // Global debug flags
 int debug_scanner = 0;
@@ -50,13 +54,95 @@ char* get_absolute_path(const char* path) {
     return abs_path;
 }
 
+static char* read_text_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (text && fread(text, 1, (size_t)size, fp) != (size_t)size) {
+        free(text);
+        text = NULL;
+    }
+    fclose(fp);
+    if (text) text[size] = '\0';
+    return text;
+}
+
+// Edit mode: parse path without generating code, replace procedure name
+// with the declaration in text_path via update_procedure_cross_reference()
+// and print the updated table. A syntax error in the new text is reported
+// at the line a full parse of the edited file would give, numbered in it.
+static int run_procedure_edit(const char *path, const char *name, const char *text_path) {
+    char *text = read_text_file(text_path);
+    if (!text) {
+        fprintf(stderr, "Error: Cannot read %s\n", text_path);
+        return 1;
+    }
+    if (init_scan(path) < 0) {
+        free(text);
+        return 1;
+    }
+    init_parser();
+    init_cross_referencer();
+    int result = parse_program();
+    gen_discard();
+    end_scan();
+
+    if (result == 0) {
+        int status = update_procedure_cross_reference(name, text);
+        if (status == 0) {
+            print_cross_reference_table();
+        } else if (status < 0) {
+            fprintf(stderr, "Error: No procedure %s in %s\n", name, path);
+        } else {
+            fprintf(stderr, "Error: New text of %s does not parse from line %d\n", name, status);
+        }
+        result = status;
+    }
+    free_cross_referencer();
+    free(text);
+    return result != 0;
+}
+
 int main(int argc, char *argv[]) {
     // Validate input and handle debug mode
-    if (argc < 2 || argc > 3) {
-        fprintf(stderr, "Usage: ./mpplc <filename.mpl> [--debug]\n");
+    if (argc < 2) {
+        fprintf(stderr, "Usage: ./mpplc <filename.mpl> [--debug-*] [--no-xref] [--mxr] [--dump-ir]\n"
+                        "       [--peephole=<rule,...>|all|none] [--peephole-stats]\n"
+                        "       [-O0|-O1|-O2|-Os] [--enable-pass=<name>] [--disable-pass=<name>]\n"
+                        "       [--pass-stats] [--unroll=<factor>] [--no-overlay]\n");
+        fprintf(stderr, "       ./mpplc --project [-j N] <file.mpl>...\n");
+        fprintf(stderr, "       ./mpplc --edit-procedure <file.mpl> <name> <procedure.mpl>\n");
         return 1;
     }
 
+    // Project mode: one merged cross-reference table for many files
+    if (strcmp(argv[1], "--project") == 0) {
+        int jobs = 4;
+        int first = 2;
+        if (argc > 3 && strcmp(argv[2], "-j") == 0) {
+            jobs = atoi(argv[3]);
+            first = 4;
+        }
+        // Worker threads would interleave debug output
+        debug_scanner = debug_parser = debug_cross_referencer =
+        debug_pretty = debug_compiler = debug_codegen = 0;
+        return run_project_cross_reference(argv + first, argc - first, jobs);
+    }
+
+    // Edit mode: one procedure re-parsed into an existing table
+    if (strcmp(argv[1], "--edit-procedure") == 0) {
+        if (argc != 5) {
+            fprintf(stderr, "Usage: ./mpplc --edit-procedure <file.mpl> <name> <procedure.mpl>\n");
+            return 1;
+        }
+        debug_scanner = debug_parser = debug_cross_referencer =
+        debug_pretty = debug_compiler = debug_codegen = 0;
+        return run_procedure_edit(argv[2], argv[3], argv[4]);
+    }
+
     // Get absolute path
     char* fullpath = get_absolute_path(argv[1]);
     if (!fullpath) {
@@ -107,6 +193,7 @@ int main(int argc, char *argv[]) {
     }
 
     // Process command line arguments
+    int xref_needs = XREF_NEED_TABLE;
     for (int i = 2; i < argc; i++) {
         if (strcmp(argv[i], "--debug-scan") == 0) {
             debug_scanner = 1;
@@ -123,6 +210,59 @@ int main(int argc, char *argv[]) {
         } else if (strcmp(argv[i], "--debug-all") == 0) {
             debug_scanner = debug_parser = debug_cross_referencer = 
             debug_pretty = debug_compiler = debug_codegen = 1;
+        } else if (strcmp(argv[i], "--no-xref") == 0) {
+            // Compile only: skip the table and reference recording
+            xref_needs &= ~XREF_NEED_TABLE;
+        } else if (strcmp(argv[i], "--mxr") == 0) {
+            // Binary cross-reference index next to the .csl file
+            xref_needs |= XREF_NEED_INDEX;
+        } else if (strcmp(argv[i], "--dump-ir") == 0) {
+            // Print the IR handed to the CASL emitter
+            dump_ir = 1;
+        } else if (strncmp(argv[i], "--peephole=", 11) == 0) {
+            if (!peephole_configure(argv[i] + 11)) {
+                fprintf(stderr, "Error: Unknown peephole rule in %s\n", argv[i]);
+                fclose(caslfp);
+                free(fullpath);
+                free(outfile);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            if (!optimizer_set_level(argv[i] + 2)) {
+                fprintf(stderr, "Error: Unknown optimization level %s\n", argv[i]);
+                fclose(caslfp);
+                free(fullpath);
+                free(outfile);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--enable-pass=", 14) == 0 ||
+                   strncmp(argv[i], "--disable-pass=", 15) == 0) {
+            int on = argv[i][2] == 'e';
+            if (!optimizer_enable_pass(strchr(argv[i], '=') + 1, on)) {
+                fprintf(stderr, "Error: Unknown optimization pass in %s\n", argv[i]);
+                fclose(caslfp);
+                free(fullpath);
+                free(outfile);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--unroll=", 9) == 0) {
+            char *end;
+            long factor = strtol(argv[i] + 9, &end, 10);
+            if (*end != '\0' || end == argv[i] + 9 || factor < 1 || factor > 16) {
+                fprintf(stderr, "Error: Unroll factor must be 1..16 in %s\n", argv[i]);
+                fclose(caslfp);
+                free(fullpath);
+                free(outfile);
+                return 1;
+            }
+            opt_unroll_set_factor((int)factor);
+        } else if (strcmp(argv[i], "--peephole-stats") == 0) {
+            peephole_stats = 1;
+        } else if (strcmp(argv[i], "--pass-stats") == 0) {
+            pass_stats = 1;
+        } else if (strcmp(argv[i], "--no-overlay") == 0) {
+            // Own words for every procedure variable
+            overlay_enabled = 0;
         }
     }
 
@@ -135,17 +275,34 @@ int main(int argc, char *argv[]) {
     }
     init_parser();
     init_cross_referencer();
+    set_xref_consumers(xref_needs);
 
     // Execute parsing and code generation
     int parse_result = parse_program();
     
     // Log error to CASL file if parsing fails
     if (parse_result != 0) {
+        gen_discard();
         fprintf(caslfp, "/* Compilation failed: no valid CASL code generated. */\n");
     }
     else {
         // Only print cross reference if no errors
-        print_cross_reference_table();
+        if (xref_needs & XREF_NEED_TABLE) {
+            print_cross_reference_table();
+        }
+        if (xref_needs & XREF_NEED_INDEX) {
+            strcpy(strrchr(outfile, '.'), ".mxr");
+            if (write_cross_reference_index(outfile) != 0) {
+                fprintf(stderr, "Error: Cannot write index file %s\n", outfile);
+            }
+        }
+        if (pass_stats) {
+            optimizer_print_stats(stderr);
+            overlay_report(stderr);
+        }
+        if (peephole_stats) {
+            peephole_print_stats(stderr);
+        }
     }
 
     // Cleanup
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "mxr.h"
+#include "token.h"
+
+// Zigzag so that out-of-order reference lists still encode compactly
+size_t mxr_put_varint(unsigned char *buf, int32_t value) {
+    uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (unsigned char)v;
+    return n;
+}
+
+int mxr_get_varint(const unsigned char **p, const unsigned char *end, int32_t *value) {
+    uint32_t v = 0;
+    int shift = 0;
+    while (*p < end && shift < 35) {
+        unsigned char c = *(*p)++;
+        v |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            *value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static int buf_reserve(MxrBuf *buf, size_t extra) {
+    if (buf->failed) return 0;
+    if (buf->size + extra <= buf->capacity) return 1;
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity < buf->size + extra) capacity *= 2;
+    unsigned char *data = realloc(buf->data, capacity);
+    if (!data) {
+        buf->failed = 1;
+        return 0;
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+    return 1;
+}
+
+int mxr_buf_append(MxrBuf *buf, const void *src, size_t len) {
+    if (!buf_reserve(buf, len)) return 0;
+    memcpy(buf->data + buf->size, src, len);
+    buf->size += len;
+    return 1;
+}
+
+void mxr_buf_pad(MxrBuf *buf) {
+    static const unsigned char zeros[4] = {0};
+    mxr_buf_append(buf, zeros, (4 - buf->size % 4) % 4);
+}
+
+static uint32_t hash_string(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static int pool_grow(MxrStringPool *pool) {
+    size_t nslots = pool->nslots ? pool->nslots * 2 : 64;
+    uint32_t *slots = calloc(nslots, sizeof(uint32_t));
+    if (!slots) return 0;
+    for (size_t i = 0; i < pool->nslots; i++) {
+        if (!pool->slots[i]) continue;
+        const char *s = (const char *)pool->strtab.data + pool->slots[i] - 1;
+        size_t j = hash_string(s) & (nslots - 1);
+        while (slots[j]) j = (j + 1) & (nslots - 1);
+        slots[j] = pool->slots[i];
+    }
+    free(pool->slots);
+    pool->slots = slots;
+    pool->nslots = nslots;
+    return 1;
+}
+
+// Offset of s in the string table; on allocation failure strtab.failed is set
+uint32_t mxr_pool_intern(MxrStringPool *pool, const char *s) {
+    if ((pool->used + 1) * 2 > pool->nslots && !pool_grow(pool)) {
+        pool->strtab.failed = 1;
+        return 0;
+    }
+    size_t j = hash_string(s) & (pool->nslots - 1);
+    while (pool->slots[j]) {
+        const char *existing = (const char *)pool->strtab.data + pool->slots[j] - 1;
+        if (strcmp(existing, s) == 0) return pool->slots[j] - 1;
+        j = (j + 1) & (pool->nslots - 1);
+    }
+    uint32_t offset = (uint32_t)pool->strtab.size;
+    if (!mxr_buf_append(&pool->strtab, s, strlen(s) + 1)) return 0;
+    pool->slots[j] = offset + 1;
+    pool->used++;
+    return offset;
+}
+
+void mxr_pool_free(MxrStringPool *pool) {
+    free(pool->strtab.data);
+    free(pool->slots);
+}
+
+static int section_ok(const MxrIndex *index, uint32_t offset, size_t size) {
+    return offset <= index->size && size <= index->size - offset;
+}
+
+static int validate(MxrIndex *index) {
+    if (index->size < sizeof(MxrHeader)) return 0;
+    const MxrHeader *h = (const MxrHeader *)index->base;
+    if (h->magic != MXR_MAGIC || h->version != MXR_VERSION) return 0;
+    if (!section_ok(index, h->strtab_offset, h->strtab_size) || h->strtab_size == 0) return 0;
+    if (index->base[h->strtab_offset + h->strtab_size - 1] != '\0') return 0;
+    if (!section_ok(index, h->symtab_offset, (size_t)h->symbol_count * sizeof(MxrSymbol))) return 0;
+    if (!section_ok(index, h->byname_offset, (size_t)h->symbol_count * sizeof(uint32_t))) return 0;
+    if (!section_ok(index, h->refdata_offset, h->refdata_size)) return 0;
+
+    // mxr_find() indexes symbols through byname without checking
+    const uint32_t *byname = (const uint32_t *)(index->base + h->byname_offset);
+    for (uint32_t i = 0; i < h->symbol_count; i++) {
+        if (byname[i] >= h->symbol_count) return 0;
+    }
+
+    index->header = h;
+    index->symbols = (const MxrSymbol *)(index->base + h->symtab_offset);
+    index->byname = byname;
+    return 1;
+}
+
+MxrIndex* mxr_open(const char *path) {
+    MxrIndex *index = calloc(1, sizeof(MxrIndex));
+    if (!index) return NULL;
+
+#ifdef _WIN32
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        free(index);
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = size > 0 ? malloc((size_t)size) : NULL;
+    if (!data || fread(data, 1, (size_t)size, fp) != (size_t)size) {
+        free(data);
+        fclose(fp);
+        free(index);
+        return NULL;
+    }
+    fclose(fp);
+    index->base = data;
+    index->size = (size_t)size;
+    index->mapped = 0;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        free(index);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        free(index);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        free(index);
+        return NULL;
+    }
+    index->base = data;
+    index->size = (size_t)st.st_size;
+    index->mapped = 1;
+#endif
+
+    if (!validate(index)) {
+        mxr_close(index);
+        return NULL;
+    }
+    return index;
+}
+
+void mxr_close(MxrIndex *index) {
+    if (!index) return;
+#ifndef _WIN32
+    if (index->mapped) {
+        munmap((void *)index->base, index->size);
+    } else
+#endif
+    {
+        free((void *)index->base);
+    }
+    free(index);
+}
+
+const char* mxr_string(const MxrIndex *index, uint32_t offset) {
+    if (offset >= index->header->strtab_size) return "";
+    return (const char *)(index->base + index->header->strtab_offset + offset);
+}
+
+static int compare_key(const MxrIndex *index, const MxrSymbol *sym,
+                       const char *name, const char *scope) {
+    int c = strcmp(mxr_string(index, sym->name), name);
+    if (c != 0) return c;
+    // Globals sort before scoped symbols of the same name
+    if (sym->scope == MXR_NO_SCOPE) return scope ? -1 : 0;
+    if (!scope) return 1;
+    return strcmp(mxr_string(index, sym->scope), scope);
+}
+
+// Binary search over the by-name permutation; scope NULL means global
+const MxrSymbol* mxr_find(const MxrIndex *index, const char *name, const char *scope) {
+    uint32_t lo = 0, hi = index->header->symbol_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const MxrSymbol *sym = &index->symbols[index->byname[mid]];
+        int c = compare_key(index, sym, name, scope);
+        if (c == 0) return sym;
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+void mxr_refs_begin(const MxrIndex *index, const MxrSymbol *sym, MxrRefIter *it) {
+    const unsigned char *data = index->base + index->header->refdata_offset;
+    uint32_t offset = sym->ref_offset;
+    if (offset > index->header->refdata_size) offset = index->header->refdata_size;
+    it->p = data + offset;
+    it->end = data + index->header->refdata_size;
+    it->remaining = sym->ref_count;
+    it->line = 0;
+}
+
+int mxr_refs_next(MxrRefIter *it, int *line) {
+    int32_t delta;
+    if (it->remaining == 0 || !mxr_get_varint(&it->p, it->end, &delta)) return 0;
+    it->remaining--;
+    it->line += delta;
+    *line = it->line;
+    return 1;
+}
+
+// Same text as print_cross_reference_table()
+void mxr_print_table(const MxrIndex *index, FILE *out) {
+    fprintf(out, "----------------------------------\n");
+    for (uint32_t i = 0; i < index->header->symbol_count; i++) {
+        const MxrSymbol *sym = &index->symbols[i];
+        if (sym->scope != MXR_NO_SCOPE && sym->ttype != TPROCEDURE) {
+            fprintf(out, "%s:%s", mxr_string(index, sym->name), mxr_string(index, sym->scope));
+        } else {
+            fprintf(out, "%s", mxr_string(index, sym->name));
+        }
+        fprintf(out, "|%s|%u|", mxr_string(index, sym->type_name), sym->deflinenum);
+
+        MxrRefIter it;
+        int line;
+        mxr_refs_begin(index, sym, &it);
+        for (int first = 1; mxr_refs_next(&it, &line); first = 0) {
+            fprintf(out, first ? "%d" : ",%d", line);
+        }
+        fprintf(out, "\n");
+    }
+}
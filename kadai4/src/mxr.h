@@ -0,0 +1,97 @@
+#ifndef MXR_H
+#define MXR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary cross-reference index (.mxr)
+//
+// Layout, all fields native 32-bit words, sections 4-byte aligned:
+//   MxrHeader
+//   string table   interned NUL-terminated strings, offset 0 is ""
+//   MxrSymbol[]    in print_cross_reference_table() order
+//   uint32_t[]     symbol indices sorted by (name, scope) for lookups
+//   reference data per symbol: zigzag delta varints of the Line list
+#define MXR_MAGIC    0x3152584Du  // "MXR1"
+#define MXR_VERSION  1
+#define MXR_NO_SCOPE 0xFFFFFFFFu  // scope of global symbols
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t symbol_count;
+    uint32_t strtab_offset;
+    uint32_t strtab_size;
+    uint32_t symtab_offset;
+    uint32_t byname_offset;
+    uint32_t refdata_offset;
+    uint32_t refdata_size;
+} MxrHeader;
+
+typedef struct {
+    uint32_t name;       // base name (string table offset)
+    uint32_t scope;      // procedure name or MXR_NO_SCOPE
+    uint32_t type_name;  // printed type, e.g. "procedure(char)"
+    uint32_t ttype;      // TINTEGER, TARRAY, TPROCEDURE, ...
+    uint32_t deflinenum;
+    uint32_t ref_offset; // into reference data
+    uint32_t ref_count;
+} MxrSymbol;
+
+typedef struct {
+    const unsigned char *base;
+    size_t size;
+    const MxrHeader *header;
+    const MxrSymbol *symbols;
+    const uint32_t *byname;
+    int mapped;  // 1 if base came from mmap, 0 if malloc'd
+} MxrIndex;
+
+// Iterator over a symbol's reference lines
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    uint32_t remaining;
+    int32_t line;
+} MxrRefIter;
+
+// Reader
+MxrIndex* mxr_open(const char *path);
+void mxr_close(MxrIndex *index);
+const char* mxr_string(const MxrIndex *index, uint32_t offset);
+const MxrSymbol* mxr_find(const MxrIndex *index, const char *name, const char *scope);
+void mxr_refs_begin(const MxrIndex *index, const MxrSymbol *sym, MxrRefIter *it);
+int mxr_refs_next(MxrRefIter *it, int *line);
+void mxr_print_table(const MxrIndex *index, FILE *out);
+
+// Varint coding shared with the writer in cross_referencer.c and with
+// tools/mxrquery.c; mxr_get_varint() returns 0 at end or on a truncated one
+size_t mxr_put_varint(unsigned char *buf, int32_t value);
+int mxr_get_varint(const unsigned char **p, const unsigned char *end, int32_t *value);
+
+// Growable byte buffer for building index sections. After a failed
+// allocation it stays failed and further appends are dropped, so writers
+// check `failed` once before writing the file out.
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    int failed;
+} MxrBuf;
+
+int mxr_buf_append(MxrBuf *buf, const void *src, size_t len);
+void mxr_buf_pad(MxrBuf *buf);  // zero-fill to a 4-byte boundary
+
+// String interning: open addressing over offsets into the string table
+typedef struct {
+    MxrBuf strtab;
+    uint32_t *slots;  // offset + 1, 0 = empty
+    size_t nslots;
+    size_t used;
+} MxrStringPool;
+
+uint32_t mxr_pool_intern(MxrStringPool *pool, const char *s);
+void mxr_pool_free(MxrStringPool *pool);
+
+#endif
@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimizer.h"
+#include "range.h"
+
+// Array bounds check elimination.
+//
+// A CHECK whose index is known to lie in 0..size-1 at that point goes
+// away. The range analysis learns index bounds from loop and if
+// conditions (`while i < 10 do a[i] := ...`) and from checks that have
+// already passed, so a later access with the same index inside the
+// checked region needs no check of its own either.
+
+static int checks_removed = 0;
+static int checks_kept = 0;
+
+int opt_bounds(IrFunc *f) {
+    RangeInfo *ri = range_analyze(f);
+    int removed = 0;
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        if (!range_enter(ri, b)) continue;
+        for (int j = 0; j < block->ninsns; j++) {
+            IrInsn *insn = &block->insns[j];
+            if (insn->op == IR_CHECK) {
+                Range r = range_get(ri, insn->a);
+                if (r.lo >= 0 && r.hi < insn->imm) {
+                    ir_make_nop(insn);
+                    removed++;
+                    continue;
+                }
+                checks_kept++;
+            }
+            range_step(ri, insn);
+        }
+    }
+    range_free(ri);
+
+    // The NOPs go with the next DCE run
+    checks_removed += removed;
+    return removed;
+}
+
+void opt_bounds_report(FILE *out) {
+    fprintf(out, "bounds: %d checks removed, %d kept\n", checks_removed, checks_kept);
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimizer.h"
+
+// Control flow cleanup, run last.
+//
+//   threading   a jump or branch to a block that only jumps on goes to
+//               where that block leads; blocks nothing jumps to go
+//   rotation    a jump back to a loop test that only loads and computes
+//               is replaced by a copy of the test, so an iteration ends
+//               in one conditional branch instead of a jump to the test
+//               and the test's branch out
+//   merging     a block jumping to one that nothing else reaches takes
+//               its instructions
+//   layout      a branch whose true target is the next block is
+//               inverted, so that it falls through when the condition
+//               holds and the JUMP after it goes
+//
+// Labels nothing jumps to any more are dropped from the CASL text by the
+// peephole pass.
+
+#define CFG_MAX_TEST 8    // instructions of a loop test copied to a latch
+
+static int rotation = 1;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+void opt_cfg_set_rotation(int on) {
+    rotation = on;
+}
+
+// Threading
+
+// Where a jump to `label` ends up, through blocks that only jump on
+static int final_target(const IrFunc *f, int label) {
+    for (int hops = 0; hops < f->nblocks; hops++) {
+        const IrBlock *b = ir_block(f, label);
+        int j = 0;
+        while (b->insns[j].op == IR_NOP) j++;
+        if (b->insns[j].op != IR_JUMP || b->insns[j].target == label) break;
+        label = b->insns[j].target;
+    }
+    return label;
+}
+
+static int thread_jumps(IrFunc *f) {
+    int changes = 0;
+    for (int i = 0; i < f->nblocks; i++) {
+        IrInsn *term = ir_terminator(f->blocks[i]);
+        if (!term || term->op == IR_RET) continue;
+        int target = final_target(f, term->target);
+        if (target != term->target) {
+            term->target = target;
+            changes++;
+        }
+        if (term->op != IR_BRANCH) continue;
+        target = final_target(f, term->target2);
+        if (target != term->target2) {
+            term->target2 = target;
+            changes++;
+        }
+        if (term->target == term->target2) {
+            ir_make_jump(term, term->target);
+            changes++;
+        }
+    }
+    return changes;
+}
+
+// Predecessor count of every block
+static int* count_preds(const IrFunc *f) {
+    int *preds = xcalloc(f->nblocks, sizeof(int));
+    for (int i = 0; i < f->nblocks; i++) {
+        int labels[2];
+        int n = ir_successors(f->blocks[i], labels);
+        for (int k = 0; k < n; k++) preds[ir_block_index(f, labels[k])]++;
+    }
+    return preds;
+}
+
+static int remove_unreferenced(IrFunc *f) {
+    int removed = 0;
+    for (;;) {
+        int *preds = count_preds(f);
+        int victim = -1;
+        for (int i = 1; i < f->nblocks && victim < 0; i++) {
+            if (preds[i] == 0) victim = i;
+        }
+        free(preds);
+        if (victim < 0) break;
+        ir_remove_block(f, victim);
+        removed++;
+    }
+    return removed;
+}
+
+// Rotation
+
+static int is_test_block(const IrBlock *b) {
+    int n = 0;
+    for (int j = 0; j < b->ninsns - 1; j++) {
+        switch (b->insns[j].op) {
+            case IR_NOP:
+                continue;
+            case IR_MOV: case IR_LOAD: case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+            case IR_AND: case IR_OR: case IR_NEG: case IR_NOT:
+            case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+                n++;
+                break;
+            default:
+                return 0;
+        }
+    }
+    return b->insns[b->ninsns - 1].op == IR_BRANCH && n <= CFG_MAX_TEST;
+}
+
+static int used_outside(const IrFunc *f, const IrBlock *b, int t) {
+    for (int i = 0; i < f->nblocks; i++) {
+        if (f->blocks[i] == b) continue;
+        for (int j = 0; j < f->blocks[i]->ninsns; j++) {
+            IrValue *used[64];
+            int n = ir_uses(&f->blocks[i]->insns[j], used, 64);
+            for (int k = 0; k < n; k++) {
+                if (used[k]->kind == IR_TEMP && used[k]->value == t) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Replace the jump ending latch with a copy of test. Temps the test uses
+// for itself only are renamed in the copy; the others keep their name and
+// get their value on either path.
+static void copy_test(IrFunc *f, IrBlock *latch, const IrBlock *test) {
+    int *map = xcalloc(f->ntemps + 1, sizeof(int));
+    ir_remove(latch, latch->ninsns - 1);
+    for (int j = 0; j < test->ninsns; j++) {
+        if (test->insns[j].op == IR_NOP) continue;
+        IrInsn *copy = ir_append(latch, test->insns[j].op);
+        *copy = test->insns[j];
+        IrValue *used[64];
+        int n = ir_uses(copy, used, 64);
+        for (int k = 0; k < n; k++) {
+            if (used[k]->kind == IR_TEMP && map[used[k]->value]) used[k]->value = map[used[k]->value];
+        }
+        int t = copy->dst;
+        if (t > 0 && !used_outside(f, test, t)) {
+            map[t] = ir_new_temp(f);
+            copy->dst = map[t];
+        }
+    }
+    free(map);
+}
+
+static int rotate_loops(IrFunc *f) {
+    int changes = 0;
+    for (int i = 0; i < f->nblocks; i++) {
+        IrInsn *term = ir_terminator(f->blocks[i]);
+        if (!term || term->op != IR_JUMP) continue;
+        int h = ir_block_index(f, term->target);
+        if (h >= i || !is_test_block(f->blocks[h])) continue;
+        copy_test(f, f->blocks[i], f->blocks[h]);
+        changes++;
+    }
+    return changes;
+}
+
+// Merging
+
+static int merge_blocks(IrFunc *f) {
+    int merged = 0;
+    for (;;) {
+        int *preds = count_preds(f);
+        int from = -1, into = -1;
+        for (int i = 0; i < f->nblocks && from < 0; i++) {
+            IrInsn *term = ir_terminator(f->blocks[i]);
+            if (!term || term->op != IR_JUMP) continue;
+            int c = ir_block_index(f, term->target);
+            if (c > 0 && c != i && preds[c] == 1) {
+                from = c;
+                into = i;
+            }
+        }
+        free(preds);
+        if (from < 0) break;
+
+        IrBlock *b = f->blocks[into];
+        IrBlock *c = f->blocks[from];
+        ir_remove(b, b->ninsns - 1);
+        for (int j = 0; j < c->ninsns; j++) {
+            if (c->insns[j].op == IR_NOP) continue;
+            *ir_append(b, c->insns[j].op) = c->insns[j];
+            c->insns[j].args = NULL;   // moved along
+        }
+        ir_remove_block(f, from);
+        merged++;
+    }
+    return merged;
+}
+
+// Layout
+
+static int negate(int relation) {
+    switch (relation) {
+        case IR_EQ: return IR_NE;
+        case IR_NE: return IR_EQ;
+        case IR_LT: return IR_GE;
+        case IR_GE: return IR_LT;
+        case IR_LE: return IR_GT;
+        default:    return IR_LE;
+    }
+}
+
+static int lay_out_branches(IrFunc *f) {
+    int changes = 0;
+    for (int i = 0; i + 1 < f->nblocks; i++) {
+        IrInsn *term = ir_terminator(f->blocks[i]);
+        if (!term || term->op != IR_BRANCH) continue;
+        if (term->target != f->blocks[i + 1]->label) continue;
+        term->mode = negate(term->mode);
+        term->target = term->target2;
+        term->target2 = f->blocks[i + 1]->label;
+        changes++;
+    }
+    return changes;
+}
+
+int opt_cfg(IrFunc *f) {
+    int changes = thread_jumps(f);
+    changes += remove_unreferenced(f);
+    if (rotation) changes += rotate_loops(f);
+    changes += merge_blocks(f);
+    changes += lay_out_branches(f);
+    return changes;
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimizer.h"
+
+// Conditions compiled to branch trees.
+//
+// The code generator evaluates an if/while condition to a 0/1 value and
+// branches on `c <> 0`. When c is used by nothing else, its computation
+// is taken apart from the branch backwards:
+//
+//   c = x rel y    branch on x rel y itself (CPA and a conditional jump,
+//                  no 0/1 value)
+//   c = not p      branch on p with the targets swapped
+//   c = p and q    branch on p to a new block that branches on q, or
+//                  straight to the false target (`or` the other way)
+//
+// The instructions computing q move into the new block, so q is only
+// evaluated when it decides the outcome. Whatever may trap (an overflow,
+// zero-divide or bounds check) or has any other effect stays where it
+// is, so a program fails exactly where it did before; only the part of
+// q after it moves.
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int is_relation(IrOp op) {
+    return op >= IR_EQ && op <= IR_GE;
+}
+
+static int is_pure(const IrInsn *insn) {
+    switch (insn->op) {
+        case IR_MOV: case IR_LOAD: case IR_AND: case IR_OR: case IR_NOT:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            return 1;
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_NEG:
+            return (insn->flags & (IRF_OVERFLOW | IRF_ZERODIV)) == 0;
+        default:
+            return 0;
+    }
+}
+
+static int def_index(const IrBlock *b, int temp, int before) {
+    for (int j = before - 1; j >= 0; j--) {
+        if (b->insns[j].dst == temp) return j;
+    }
+    return -1;
+}
+
+// Can insns (from, to) of b, which compute the right operand of an
+// and/or at `to`, run in a block of their own?
+static int can_move(const IrBlock *b, int from, int to, const int *uses) {
+    for (int j = from + 1; j < to; j++) {
+        if (!is_pure(&b->insns[j])) return 0;
+    }
+    // Their results must not be needed outside them
+    for (int j = from + 1; j < to; j++) {
+        int t = b->insns[j].dst;
+        if (t <= 0) continue;
+        int n = 0;
+        for (int k = from + 1; k <= to; k++) {
+            IrValue *used[64];
+            int nused = ir_uses(&b->insns[k], used, 64);
+            for (int u = 0; u < nused; u++) {
+                if (used[u]->kind == IR_TEMP && used[u]->value == t) n++;
+            }
+        }
+        if (n != uses[t]) return 0;
+    }
+    return 1;
+}
+
+static void swap_targets(IrInsn *branch) {
+    int t = branch->target;
+    branch->target = branch->target2;
+    branch->target2 = t;
+}
+
+// Take one step apart the condition that ends block bi; 0 if there is
+// nothing to do
+static int lower_branch(IrFunc *f, int bi, const int *uses) {
+    IrBlock *b = f->blocks[bi];
+    IrInsn *term = &b->insns[b->ninsns - 1];
+    if (term->op != IR_BRANCH || term->a.kind != IR_TEMP) return 0;
+    if (term->b.kind != IR_CONST || term->b.value != 0) return 0;
+    if (term->mode != IR_NE && term->mode != IR_EQ) return 0;
+    int c = term->a.value;
+    int d = def_index(b, c, b->ninsns - 1);
+    if (d < 0 || uses[c] != 1) return 0;
+    if (term->mode == IR_EQ) {
+        term->mode = IR_NE;
+        swap_targets(term);
+    }
+
+    IrInsn def = b->insns[d];
+    if (is_relation(def.op)) {
+        term->mode = def.op;
+        term->a = def.a;
+        term->b = def.b;
+        ir_remove(b, d);
+        return 1;
+    }
+    if (def.op == IR_NOT) {
+        term->a = def.a;
+        swap_targets(term);
+        ir_remove(b, d);
+        return 1;
+    }
+    if (def.op != IR_AND && def.op != IR_OR) return 0;
+    if (def.a.kind != IR_TEMP || def.b.kind != IR_TEMP) return 0;
+
+    int label = ir_new_label(f->module);
+    IrBlock *rest = ir_insert_block(f, bi + 1, label);
+    b = f->blocks[bi];
+    int p = def_index(b, def.a.value, d);
+    if (p >= 0 && !can_move(b, p, d, uses)) {
+        // Still move what comes after the last instruction that must stay
+        for (int j = d - 1; j > p; j--) {
+            if (!is_pure(&b->insns[j])) {
+                p = j;
+                break;
+            }
+        }
+    }
+    if (p >= 0 && can_move(b, p, d, uses)) {
+        for (int j = p + 1; j < d; j++) {
+            IrInsn *n = ir_append(rest, b->insns[j].op);
+            *n = b->insns[j];
+        }
+        // Moved struct-wise: nothing to free
+        for (int j = p + 1; j < b->ninsns - (d - p - 1); j++) b->insns[j] = b->insns[j + d - p - 1];
+        b->ninsns -= d - p - 1;
+        d = p + 1;
+    }
+    term = &b->insns[b->ninsns - 1];
+    IrInsn *second = ir_append(rest, IR_BRANCH);
+    second->mode = IR_NE;
+    second->a = def.b;
+    second->b = ir_const(0);
+    second->target = term->target;
+    second->target2 = term->target2;
+    second->line = term->line;
+
+    term->a = def.a;
+    if (def.op == IR_AND) {
+        term->target = label;
+    } else {
+        term->target2 = label;
+    }
+    ir_remove(b, d);
+    return 1;
+}
+
+int opt_condbranch(IrFunc *f) {
+    int *uses = xcalloc(f->ntemps + 1, sizeof(int));
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            IrValue *used[64];
+            int n = ir_uses(&block->insns[j], used, 64);
+            for (int k = 0; k < n; k++) {
+                if (used[k]->kind == IR_TEMP) uses[used[k]->value]++;
+            }
+        }
+    }
+    int changes = 0;
+    for (int b = 0; b < f->nblocks; b++) {
+        while (lower_branch(f, b, uses)) changes++;
+    }
+    free(uses);
+    return changes;
+}
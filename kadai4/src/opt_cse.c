@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimizer.h"
+
+// Common subexpression elimination by local value numbering.
+//
+// Within a block, an instruction that computes what an earlier one
+// already did (the same operation on the same values) is dropped and its
+// result replaced by the earlier one everywhere; the earlier definition
+// dominates every use of the later one, so this holds across blocks too.
+// Loads are reused until something may write the variable:
+//
+//   store/read v      loads of v; for an array only the elements that
+//                     may be the same (both indices constant and equal,
+//                     or either unknown)
+//   through a param   loads of globals and parameters
+//   to a global       loads of parameters
+//   call              loads of globals, parameters and the variables
+//                     passed to it
+//
+// A store makes its value available to later loads of the variable, and
+// a bounds check of an index already checked against the same size goes.
+// No register survives a call or I/O, so a loaded value kept across one
+// would be spilled and reloaded, at no less cost than loading it again:
+// loads are not reused past them.
+// A repeated overflow-checked operation may go as well: the first one
+// would have trapped.
+
+typedef struct {
+    IrOp op;
+    IrValue a, b;
+    int var;
+    int imm;
+    IrValue value;    // the result
+} Expr;
+
+typedef struct {
+    IrFunc *f;
+    const IrModule *m;
+    IrValue *map;     // temp -> the value it was found equal to
+    int *defs;        // per temp
+    Expr *exprs;      // available in the current block
+    int nexprs;
+    int cap;
+} Cse;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int same_value(IrValue x, IrValue y) {
+    return x.kind == y.kind && (x.kind == IR_EMPTY || x.value == y.value);
+}
+
+static IrValue lookup_value(const Cse *c, IrValue v) {
+    while (v.kind == IR_TEMP && c->map[v.value].kind != IR_EMPTY) v = c->map[v.value];
+    return v;
+}
+
+static int is_commutative(IrOp op) {
+    return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR ||
+           op == IR_EQ || op == IR_NE;
+}
+
+static int is_expression(IrOp op) {
+    switch (op) {
+        case IR_LOAD: case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+        case IR_AND: case IR_OR: case IR_NEG: case IR_NOT:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static Expr* find(Cse *c, IrOp op, IrValue a, IrValue b, int var, int imm) {
+    for (int i = c->nexprs - 1; i >= 0; i--) {
+        Expr *e = &c->exprs[i];
+        if (e->op != op || e->var != var || e->imm != imm) continue;
+        if (same_value(e->a, a) && same_value(e->b, b)) return e;
+        if (is_commutative(op) && same_value(e->a, b) && same_value(e->b, a)) return e;
+    }
+    return NULL;
+}
+
+static void add(Cse *c, IrOp op, IrValue a, IrValue b, int var, int imm, IrValue value) {
+    if (c->nexprs == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 32;
+        c->exprs = realloc(c->exprs, c->cap * sizeof(Expr));
+        if (!c->exprs) {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(1);
+        }
+    }
+    Expr e = { op, a, b, var, imm, value };
+    c->exprs[c->nexprs++] = e;
+}
+
+// May a write of var[index] change what e loaded?
+static int clobbers(const Cse *c, int var, IrValue index, const Expr *e) {
+    if (e->op != IR_LOAD) return 0;
+    int kind = c->m->vars[var].kind;
+    int ekind = c->m->vars[e->var].kind;
+    if (e->var == var) {
+        return !(index.kind == IR_CONST && e->a.kind == IR_CONST && index.value != e->a.value);
+    }
+    if (kind == IRV_PARAM) return ekind == IRV_GLOBAL || ekind == IRV_PARAM;
+    if (kind == IRV_GLOBAL) return ekind == IRV_PARAM;
+    return 0;
+}
+
+static void kill_var(Cse *c, int var, IrValue index) {
+    int k = 0;
+    for (int i = 0; i < c->nexprs; i++) {
+        if (!clobbers(c, var, index, &c->exprs[i])) c->exprs[k++] = c->exprs[i];
+    }
+    c->nexprs = k;
+}
+
+// A temp defined more than once (a loop counter kept in a register)
+// gets a new value: what was computed from it is gone
+static void kill_temp(Cse *c, int t) {
+    int k = 0;
+    for (int i = 0; i < c->nexprs; i++) {
+        const Expr *e = &c->exprs[i];
+        int uses = (e->a.kind == IR_TEMP && e->a.value == t) ||
+                   (e->b.kind == IR_TEMP && e->b.value == t);
+        if (!uses) c->exprs[k++] = c->exprs[i];
+    }
+    c->nexprs = k;
+}
+
+static int single(const Cse *c, IrValue v) {
+    return v.kind != IR_TEMP || c->defs[v.value] == 1;
+}
+
+static void kill_loads(Cse *c) {
+    int k = 0;
+    for (int i = 0; i < c->nexprs; i++) {
+        if (c->exprs[i].op != IR_LOAD) c->exprs[k++] = c->exprs[i];
+    }
+    c->nexprs = k;
+}
+
+static void kill_call(Cse *c, const IrInsn *call) {
+    int k = 0;
+    for (int i = 0; i < c->nexprs; i++) {
+        const Expr *e = &c->exprs[i];
+        int keep = 1;
+        if (e->op == IR_LOAD) {
+            int kind = c->m->vars[e->var].kind;
+            if (kind == IRV_GLOBAL || kind == IRV_PARAM) keep = 0;
+            for (int a = 0; a < call->nargs; a++) {
+                if (call->args[a].kind != IR_ARG_VALUE && call->args[a].var == e->var) keep = 0;
+            }
+        }
+        if (keep) c->exprs[k++] = c->exprs[i];
+    }
+    c->nexprs = k;
+}
+
+static int number_block(Cse *c, IrBlock *b) {
+    int removed = 0;
+    c->nexprs = 0;
+    for (int j = 0; j < b->ninsns; j++) {
+        IrInsn *insn = &b->insns[j];
+        IrValue *used[64];
+        int n = ir_uses(insn, used, 64);
+        for (int k = 0; k < n; k++) *used[k] = lookup_value(c, *used[k]);
+
+        if (insn->dst > 0 && c->defs[insn->dst] > 1) {
+            kill_temp(c, insn->dst);
+            continue;
+        }
+        if (insn->op == IR_MOV && insn->dst > 0 && single(c, insn->a)) {
+            c->map[insn->dst] = insn->a;
+            ir_make_nop(insn);
+            removed++;
+            continue;
+        }
+        if (is_expression(insn->op) && insn->dst > 0) {
+            int var = insn->op == IR_LOAD ? insn->var : -1;
+            Expr *e = find(c, insn->op, insn->a, insn->b, var, 0);
+            if (e) {
+                c->map[insn->dst] = e->value;
+                ir_make_nop(insn);
+                removed++;
+            } else {
+                add(c, insn->op, insn->a, insn->b, var, 0, ir_temp(insn->dst));
+            }
+            continue;
+        }
+        switch (insn->op) {
+            case IR_CHECK:
+                if (find(c, IR_CHECK, insn->a, ir_empty(), -1, insn->imm)) {
+                    ir_make_nop(insn);
+                    removed++;
+                } else {
+                    add(c, IR_CHECK, insn->a, ir_empty(), -1, insn->imm, ir_empty());
+                }
+                break;
+            case IR_STORE:
+                kill_var(c, insn->var, insn->a);
+                if (single(c, insn->b)) add(c, IR_LOAD, insn->a, ir_empty(), insn->var, 0, insn->b);
+                break;
+            case IR_READ:
+                kill_var(c, insn->var, insn->a);
+                kill_loads(c);
+                break;
+            case IR_CALL:
+                kill_call(c, insn);
+                kill_loads(c);
+                break;
+            case IR_READLN: case IR_WRITE: case IR_WRITESTR: case IR_WRITELN:
+                kill_loads(c);
+                break;
+            default:
+                break;
+        }
+    }
+    return removed;
+}
+
+int opt_cse(IrFunc *f) {
+    Cse c = { .f = f, .m = f->module };
+    c.map = xcalloc(f->ntemps + 1, sizeof(IrValue));
+    c.defs = xcalloc(f->ntemps + 1, sizeof(int));
+    for (int b = 0; b < f->nblocks; b++) {
+        for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+            int t = f->blocks[b]->insns[j].dst;
+            if (t > 0) c.defs[t]++;
+        }
+    }
+    int removed = 0;
+    for (int b = 0; b < f->nblocks; b++) removed += number_block(&c, f->blocks[b]);
+
+    // Uses in later blocks
+    if (removed > 0) {
+        for (int b = 0; b < f->nblocks; b++) {
+            IrBlock *block = f->blocks[b];
+            for (int j = 0; j < block->ninsns; j++) {
+                IrValue *used[64];
+                int n = ir_uses(&block->insns[j], used, 64);
+                for (int k = 0; k < n; k++) *used[k] = lookup_value(&c, *used[k]);
+            }
+        }
+    }
+    free(c.exprs);
+    free(c.map);
+    free(c.defs);
+    return removed;
+}
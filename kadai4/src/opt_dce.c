@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+
+// Dead code and dead store elimination.
+//
+// opt_dce removes blocks that cannot be reached from the entry (code after
+// return or break, the other arm of a folded if) and instructions whose
+// result is never used. Instructions with an effect beyond their result
+// stay: calls, I/O, stores, checks and anything that may trap on overflow
+// or division by zero.
+//
+// opt_dse removes stores to scalar variables that are not read again. A
+// call may read any global and the variables passed to it, and a load
+// through a parameter may read any global, so those keep the stores
+// before them. At the end of a procedure globals are still live; at the
+// end of the main program nothing is.
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Unreachable blocks
+
+static void mark_reachable(IrFunc *f, int b, char *reached) {
+    if (b < 0 || reached[b]) return;
+    reached[b] = 1;
+    int labels[2];
+    int n = ir_successors(f->blocks[b], labels);
+    for (int k = 0; k < n; k++) mark_reachable(f, ir_block_index(f, labels[k]), reached);
+}
+
+static int remove_unreachable_blocks(IrFunc *f) {
+    char *reached = xcalloc(f->nblocks, 1);
+    mark_reachable(f, 0, reached);
+    int removed = 0;
+    for (int b = f->nblocks - 1; b > 0; b--) {
+        if (!reached[b]) {
+            ir_remove_block(f, b);
+            removed++;
+        }
+    }
+    free(reached);
+    return removed;
+}
+
+// Dead instructions
+
+static int has_side_effect(const IrInsn *insn) {
+    switch (insn->op) {
+        case IR_MOV: case IR_LOAD: case IR_AND: case IR_OR: case IR_NOT:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            return 0;
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_NEG:
+            return (insn->flags & (IRF_OVERFLOW | IRF_ZERODIV)) != 0;
+        default:
+            return 1;
+    }
+}
+
+static int remove_dead_insns(IrFunc *f) {
+    int *uses = xcalloc(f->ntemps + 1, sizeof(int));
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            IrValue *used[64];
+            int n = ir_uses(&block->insns[j], used, 64);
+            for (int k = 0; k < n; k++) {
+                if (used[k]->kind == IR_TEMP) uses[used[k]->value]++;
+            }
+        }
+    }
+
+    // Removing an instruction may leave its operands unused in turn
+    int removed = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = 0; b < f->nblocks; b++) {
+            IrBlock *block = f->blocks[b];
+            for (int j = block->ninsns - 1; j >= 0; j--) {
+                IrInsn *insn = &block->insns[j];
+                int dead = insn->op == IR_NOP ||
+                           (insn->dst > 0 && uses[insn->dst] == 0 && !has_side_effect(insn));
+                if (!dead) continue;
+                IrValue *used[64];
+                int n = ir_uses(insn, used, 64);
+                for (int k = 0; k < n; k++) {
+                    if (used[k]->kind == IR_TEMP) uses[used[k]->value]--;
+                }
+                ir_remove(block, j);
+                removed++;
+                changed = 1;
+            }
+        }
+    }
+    free(uses);
+    return removed;
+}
+
+int opt_dce(IrFunc *f) {
+    int changes = remove_unreachable_blocks(f);
+    changes += remove_dead_insns(f);
+    return changes;
+}
+
+// Dead stores
+
+typedef struct {
+    IrFunc *f;
+    const IrModule *m;
+    int *slot_of_var;   // var -> liveness slot, -1 if not tracked
+    int nslots;
+} Dse;
+
+static void set_globals(Dse *d, char *live) {
+    for (int v = 0; v < d->m->nvars; v++) {
+        if (d->slot_of_var[v] >= 0 && d->m->vars[v].kind == IRV_GLOBAL) {
+            live[d->slot_of_var[v]] = 1;
+        }
+    }
+}
+
+// Liveness just before insn, given liveness after it in `live`
+static void transfer(Dse *d, char *live, const IrInsn *insn) {
+    int slot = insn->var >= 0 ? d->slot_of_var[insn->var] : -1;
+    const IrVar *v = insn->var >= 0 ? &d->m->vars[insn->var] : NULL;
+    switch (insn->op) {
+        case IR_STORE:
+        case IR_READ:
+            if (slot >= 0) live[slot] = 0;
+            break;
+        case IR_LOAD:
+            if (slot >= 0) live[slot] = 1;
+            else if (v->kind == IRV_PARAM) set_globals(d, live);
+            break;
+        case IR_CALL:
+            set_globals(d, live);
+            for (int i = 0; i < insn->nargs; i++) {
+                if (insn->args[i].kind != IR_ARG_VAR) continue;
+                int arg_slot = d->slot_of_var[insn->args[i].var];
+                if (arg_slot >= 0) live[arg_slot] = 1;
+            }
+            break;
+        case IR_RET:
+            if (!d->f->is_main) set_globals(d, live);
+            break;
+        default:
+            break;
+    }
+}
+
+int opt_dse(IrFunc *f) {
+    Dse d;
+    d.f = f;
+    d.m = f->module;
+    d.nslots = 0;
+    d.slot_of_var = xcalloc(d.m->nvars, sizeof(int));
+    for (int v = 0; v < d.m->nvars; v++) {
+        const IrVar *var = &d.m->vars[v];
+        int visible = var->kind == IRV_GLOBAL ||
+                      (var->kind == IRV_LOCAL && !f->is_main && strcmp(var->proc, f->name) == 0);
+        d.slot_of_var[v] = (visible && var->size == 0) ? d.nslots++ : -1;
+    }
+
+    int n = f->nblocks;
+    char **live_in = xcalloc(n, sizeof(char*));
+    char **live_out = xcalloc(n, sizeof(char*));
+    char *live = xcalloc(d.nslots, 1);
+    for (int b = 0; b < n; b++) {
+        live_in[b] = xcalloc(d.nslots, 1);
+        live_out[b] = xcalloc(d.nslots, 1);
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = n - 1; b >= 0; b--) {
+            IrBlock *block = f->blocks[b];
+            int labels[2];
+            int nsucc = ir_successors(block, labels);
+            for (int k = 0; k < nsucc; k++) {
+                int s = ir_block_index(f, labels[k]);
+                for (int i = 0; i < d.nslots; i++) {
+                    if (live_in[s][i] && !live_out[b][i]) live_out[b][i] = 1;
+                }
+            }
+            memcpy(live, live_out[b], d.nslots);
+            for (int j = block->ninsns - 1; j >= 0; j--) transfer(&d, live, &block->insns[j]);
+            if (memcmp(live, live_in[b], d.nslots) != 0) {
+                memcpy(live_in[b], live, d.nslots);
+                changed = 1;
+            }
+        }
+    }
+
+    int removed = 0;
+    for (int b = 0; b < n; b++) {
+        IrBlock *block = f->blocks[b];
+        memcpy(live, live_out[b], d.nslots);
+        for (int j = block->ninsns - 1; j >= 0; j--) {
+            IrInsn *insn = &block->insns[j];
+            int slot = insn->var >= 0 ? d.slot_of_var[insn->var] : -1;
+            if (insn->op == IR_STORE && slot >= 0 && !live[slot]) {
+                ir_remove(block, j);
+                removed++;
+                continue;
+            }
+            transfer(&d, live, insn);
+        }
+    }
+
+    for (int b = 0; b < n; b++) {
+        free(live_in[b]);
+        free(live_out[b]);
+    }
+    free(live_in);
+    free(live_out);
+    free(live);
+    free(d.slot_of_var);
+    return removed;
+}
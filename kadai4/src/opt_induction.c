@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimizer.h"
+#include "loop.h"
+
+// Induction variables in registers.
+//
+// A loop counter is a scalar variable whose only stores in the loop are
+// steps `v := v + c` (or `v - c`) by constants; an unrolled loop has one
+// per copy of its body. In a loop without calls
+// and I/O, which would take every register, the counter moves into a
+// temp for the whole loop: it is loaded once in the preheader, stepped in
+// place and stored back on the way out. Its loads in the loop become the
+// temp, so an access `a[i]` indexes `$a` with the counter's register
+// directly: the register is the pointer into the array, stepped once per
+// iteration.
+//
+// A product `i * C` of a counter with a constant that is not a power of
+// two (those are a single shift) is strength-reduced to a second temp
+// that starts at i0 * C and steps by c * C next to each step of the
+// counter. This is
+// done only for products without an overflow check, which wrap the same
+// way as the running sum.
+//
+// The counter and the products stepped with it are the only temps with
+// more than one definition; the passes that rely on single definitions
+// run before this one.
+
+#define INDUCTION_MAX_VARS    2   // counters per loop
+#define INDUCTION_MAX_STEPS   8   // steps per counter
+#define INDUCTION_MAX_DERIVED 2   // products per loop
+
+typedef struct {
+    int var;
+    int reg;          // temp holding the counter
+    int nsteps;
+    int step[INDUCTION_MAX_STEPS];
+    int ub[INDUCTION_MAX_STEPS];  // the step instructions
+    int uj[INDUCTION_MAX_STEPS];
+} Counter;
+
+typedef struct {
+    int counter;      // index into counters
+    int factor;
+    int reg;
+} Derived;
+
+typedef struct {
+    Loop *l;
+    IrFunc *f;
+    int *uses;        // per temp, over the function
+    int *defs;
+    Counter counters[INDUCTION_MAX_VARS];
+    int ncounters;
+    Derived derived[INDUCTION_MAX_DERIVED];
+    int nderived;
+} Induction;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int wrap16(long v) {
+    v &= 0xFFFF;
+    return v >= 0x8000 ? (int)(v - 0x10000) : (int)v;
+}
+
+static int is_power_of_two(int c) {
+    if (c < 0) c = -c;
+    return c > 0 && (c & (c - 1)) == 0;
+}
+
+static void count_temps(Induction *in) {
+    IrFunc *f = in->f;
+    in->uses = xcalloc(f->ntemps + 1, sizeof(int));
+    in->defs = xcalloc(f->ntemps + 1, sizeof(int));
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            IrValue *used[64];
+            int n = ir_uses(&block->insns[j], used, 64);
+            for (int k = 0; k < n; k++) {
+                if (used[k]->kind == IR_TEMP) in->uses[used[k]->value]++;
+            }
+            if (block->insns[j].dst > 0) in->defs[block->insns[j].dst]++;
+        }
+    }
+}
+
+static int def_index(const IrBlock *b, int temp, int before) {
+    for (int j = before - 1; j >= 0; j--) {
+        if (b->insns[j].dst == temp) return j;
+    }
+    return -1;
+}
+
+static int uses_in(IrInsn *insn, int temp) {
+    IrValue *used[64];
+    int n = ir_uses(insn, used, 64);
+    int count = 0;
+    for (int k = 0; k < n; k++) {
+        if (used[k]->kind == IR_TEMP && used[k]->value == temp) count++;
+    }
+    return count;
+}
+
+// insn is about to go: its operands lose a use
+static void drop_uses(Induction *in, IrInsn *insn) {
+    IrValue *used[64];
+    int n = ir_uses(insn, used, 64);
+    for (int k = 0; k < n; k++) {
+        if (used[k]->kind == IR_TEMP) in->uses[used[k]->value]--;
+    }
+}
+
+static void replace_uses(IrInsn *insn, int temp, IrValue v) {
+    IrValue *used[64];
+    int n = ir_uses(insn, used, 64);
+    for (int k = 0; k < n; k++) {
+        if (used[k]->kind == IR_TEMP && used[k]->value == temp) *used[k] = v;
+    }
+}
+
+// Is `store v, t` at (b, j) a counter step v := v +- c? Adds it to c
+static int match_step(Induction *in, int b, int j, Counter *c) {
+    IrBlock *block = in->f->blocks[b];
+    IrInsn *store = &block->insns[j];
+    if (store->b.kind != IR_TEMP) return 0;
+    int t = store->b.value;
+    if (in->defs[t] != 1 || in->uses[t] != 1) return 0;
+    int u = def_index(block, t, j);
+    if (u < 0) return 0;
+    IrInsn *step = &block->insns[u];
+    if (step->op != IR_ADD && step->op != IR_SUB) return 0;
+    IrValue x = step->a, k = step->b;
+    if (step->op == IR_ADD && x.kind == IR_CONST) {
+        x = step->b;
+        k = step->a;
+    }
+    if (x.kind != IR_TEMP || k.kind != IR_CONST) return 0;
+    int d = def_index(block, x.value, u);
+    if (d < 0 || block->insns[d].op != IR_LOAD || block->insns[d].var != store->var) return 0;
+    // The variable changes at the store: nothing between the step and
+    // the store may see it
+    for (int i = u + 1; i < j; i++) {
+        if (block->insns[i].op == IR_LOAD && block->insns[i].var == store->var) return 0;
+    }
+    c->step[c->nsteps] = step->op == IR_ADD ? k.value : wrap16(-(long)k.value);
+    c->ub[c->nsteps] = b;
+    c->uj[c->nsteps] = u;
+    c->nsteps++;
+    return 1;
+}
+
+static void find_counters(Induction *in) {
+    Loop *l = in->l;
+    const IrModule *m = in->f->module;
+    int *stores = xcalloc(m->nvars, sizeof(int));
+    // A parameter may be a global passed by reference: a loop going
+    // through one can read or write any global behind the register's back
+    int through_param = 0;
+    for (int b = 0; b < l->n; b++) {
+        if (!l->in_loop[b]) continue;
+        IrBlock *block = in->f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            const IrInsn *insn = &block->insns[j];
+            if (insn->op == IR_STORE) stores[insn->var]++;
+            if (insn->var >= 0 && m->vars[insn->var].kind == IRV_PARAM) through_param = 1;
+        }
+    }
+    for (int v = 0; v < m->nvars && in->ncounters < INDUCTION_MAX_VARS; v++) {
+        if (stores[v] == 0 || stores[v] > INDUCTION_MAX_STEPS) continue;
+        if (m->vars[v].size != 0 || m->vars[v].kind == IRV_PARAM) continue;
+        if (m->vars[v].kind == IRV_GLOBAL && through_param) continue;
+        Counter c = { .var = v };
+        int ok = 1;
+        for (int b = 0; b < l->n && ok; b++) {
+            if (!l->in_loop[b]) continue;
+            IrBlock *block = in->f->blocks[b];
+            for (int j = 0; j < block->ninsns && ok; j++) {
+                IrInsn *insn = &block->insns[j];
+                if (insn->op == IR_STORE && insn->var == v) ok = match_step(in, b, j, &c);
+            }
+        }
+        if (ok) {
+            c.reg = ir_new_temp(in->f);
+            in->counters[in->ncounters++] = c;
+        }
+    }
+    free(stores);
+}
+
+// Does the counter step between (b, j) and (b, i)?
+static int steps_between(const Counter *c, int b, int j, int i) {
+    for (int s = 0; s < c->nsteps; s++) {
+        if (c->ub[s] == b && j < c->uj[s] && c->uj[s] < i) return 1;
+    }
+    return 0;
+}
+
+// Can the uses of temp, defined at (b, j), read the counter's register
+// instead? Only if they are in the same block with no step in between
+static int same_side(Induction *in, const Counter *c, int b, int j, int temp) {
+    IrBlock *block = in->f->blocks[b];
+    int n = 0;
+    for (int i = j + 1; i < block->ninsns; i++) {
+        int k = uses_in(&block->insns[i], temp);
+        if (k == 0) continue;
+        if (steps_between(c, b, j, i)) return 0;
+        n += k;
+    }
+    return n == in->uses[temp];
+}
+
+// t, equal to the register at (b, j), becomes the register
+static void substitute(Induction *in, const Counter *c, int b, int j, int reg) {
+    IrBlock *block = in->f->blocks[b];
+    IrInsn *def = &block->insns[j];
+    int t = def->dst;
+    drop_uses(in, def);
+    if (!same_side(in, c, b, j, t)) {
+        ir_make_mov(def, ir_temp(reg));
+        return;
+    }
+    for (int i = j + 1; i < block->ninsns; i++) replace_uses(&block->insns[i], t, ir_temp(reg));
+    ir_make_nop(def);
+}
+
+// Products i * C of a load of the counter at (b, j)
+static void reduce_products(Induction *in, int ci, int b, int j) {
+    const Counter *c = &in->counters[ci];
+    IrBlock *block = in->f->blocks[b];
+    int x = block->insns[j].dst;
+    for (int i = j + 1; i < block->ninsns; i++) {
+        IrInsn *insn = &block->insns[i];
+        if (insn->op != IR_MUL || insn->flags != 0 || in->defs[insn->dst] != 1) continue;
+        IrValue k;
+        if (insn->a.kind == IR_TEMP && insn->a.value == x) k = insn->b;
+        else if (insn->b.kind == IR_TEMP && insn->b.value == x) k = insn->a;
+        else continue;
+        if (k.kind != IR_CONST || is_power_of_two(k.value) || k.value == 0) continue;
+        // The product must see the counter where the load did
+        if (steps_between(c, b, j, i)) continue;
+        int di = -1;
+        for (int d = 0; d < in->nderived; d++) {
+            if (in->derived[d].counter == ci && in->derived[d].factor == k.value) di = d;
+        }
+        if (di < 0) {
+            if (in->nderived == INDUCTION_MAX_DERIVED) continue;
+            di = in->nderived++;
+            in->derived[di].counter = ci;
+            in->derived[di].factor = k.value;
+            in->derived[di].reg = ir_new_temp(in->f);
+        }
+        substitute(in, c, b, i, in->derived[di].reg);
+    }
+}
+
+static void promote_loads(Induction *in, int ci) {
+    Loop *l = in->l;
+    const Counter *c = &in->counters[ci];
+    for (int b = 0; b < l->n; b++) {
+        if (!l->in_loop[b]) continue;
+        IrBlock *block = in->f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            IrInsn *insn = &block->insns[j];
+            if (insn->op != IR_LOAD || insn->var != c->var) continue;
+            reduce_products(in, ci, b, j);
+            substitute(in, c, b, j, c->reg);
+        }
+    }
+}
+
+// Step the counter in place and drop the store
+static void rewrite_step(Induction *in, const Counter *c, int s) {
+    IrBlock *block = in->f->blocks[c->ub[s]];
+    IrInsn *step = &block->insns[c->uj[s]];
+    int t = step->dst;
+    for (int i = c->uj[s] + 1; i < block->ninsns; i++) {
+        IrInsn *insn = &block->insns[i];
+        if (insn->op == IR_STORE && insn->b.kind == IR_TEMP && insn->b.value == t) {
+            ir_make_nop(insn);
+            break;
+        }
+    }
+    step->dst = c->reg;
+}
+
+// Where the loop is left, gathered before any block is added
+typedef struct {
+    IrBlock **blocks;   // of the loop
+    int nblocks;
+    int *targets;       // labels outside the loop that it jumps to
+    char *only_loop;    // the target has no other predecessors
+    int ntargets;
+} Exits;
+
+static void find_exits(const Loop *l, Exits *x) {
+    IrFunc *f = l->f;
+    x->blocks = xcalloc(l->n, sizeof(IrBlock*));
+    x->targets = xcalloc(l->n, sizeof(int));
+    x->only_loop = xcalloc(l->n, 1);
+    x->nblocks = x->ntargets = 0;
+    for (int b = 0; b < l->n; b++) {
+        if (!l->in_loop[b]) continue;
+        x->blocks[x->nblocks++] = f->blocks[b];
+        for (int i = 0; i < l->nsucc[b]; i++) {
+            int s = l->succ[b][i];
+            int seen = 0;
+            for (int k = 0; k < x->ntargets; k++) {
+                if (x->targets[k] == f->blocks[s]->label) seen = 1;
+            }
+            if (l->in_loop[s] || seen) continue;
+            int only = 1;
+            for (int p = 0; p < l->n; p++) {
+                if (!l->reached[p] || l->in_loop[p]) continue;
+                for (int k = 0; k < l->nsucc[p]; k++) {
+                    if (l->succ[p][k] == s) only = 0;
+                }
+            }
+            x->only_loop[x->ntargets] = only;
+            x->targets[x->ntargets++] = f->blocks[s]->label;
+        }
+    }
+}
+
+// Store the counters on every edge leaving the loop
+static void store_on_exits(Induction *in, Exits *x) {
+    IrFunc *f = in->f;
+    for (int k = 0; k < x->ntargets; k++) {
+        int target = x->targets[k];
+        IrBlock *exit;
+        if (x->only_loop[k]) {
+            exit = ir_block(f, target);
+        } else {
+            // A block of its own on the loop's edges into the target
+            int label = ir_new_label(f->module);
+            for (int b = 0; b < x->nblocks; b++) {
+                IrInsn *term = ir_terminator(x->blocks[b]);
+                if (term->op == IR_JUMP || term->op == IR_BRANCH) {
+                    if (term->target == target) term->target = label;
+                }
+                if (term->op == IR_BRANCH && term->target2 == target) term->target2 = label;
+            }
+            exit = ir_insert_block(f, ir_block_index(f, target), label);
+            ir_make_jump(ir_append(exit, IR_JUMP), target);
+        }
+        for (int i = 0; i < in->ncounters; i++) {
+            IrInsn *store = ir_insert(exit, i, IR_STORE);
+            store->var = in->counters[i].var;
+            store->b = ir_temp(in->counters[i].reg);
+        }
+    }
+    free(x->blocks);
+    free(x->targets);
+    free(x->only_loop);
+}
+
+// A product stepped next to a step of its counter
+typedef struct {
+    int b, j;
+    int reg;
+    int add;
+} Update;
+
+static int compare_updates(const void *x, const void *y) {
+    const Update *p = x, *q = y;
+    if (p->b != q->b) return q->b - p->b;
+    return q->j - p->j;
+}
+
+static int promote(Loop *l) {
+    LoopEffects e;
+    loop_effects(l, &e);
+    if (e.has_call || e.has_io) {
+        loop_effects_free(&e);
+        return 0;
+    }
+    Induction in = { .l = l, .f = l->f };
+    count_temps(&in);
+    find_counters(&in);
+    loop_effects_free(&e);
+    if (in.ncounters == 0) {
+        free(in.uses);
+        free(in.defs);
+        return 0;
+    }
+
+    for (int i = 0; i < in.ncounters; i++) promote_loads(&in, i);
+    for (int i = 0; i < in.ncounters; i++) {
+        for (int k = 0; k < in.counters[i].nsteps; k++) rewrite_step(&in, &in.counters[i], k);
+    }
+
+    // Step the products right after their counters, the later positions
+    // first so that the earlier ones stay valid
+    Update updates[INDUCTION_MAX_DERIVED * INDUCTION_MAX_STEPS];
+    int nupdates = 0;
+    for (int d = 0; d < in.nderived; d++) {
+        const Counter *c = &in.counters[in.derived[d].counter];
+        for (int k = 0; k < c->nsteps; k++) {
+            Update u = { c->ub[k], c->uj[k], in.derived[d].reg,
+                         wrap16((long)c->step[k] * in.derived[d].factor) };
+            updates[nupdates++] = u;
+        }
+    }
+    qsort(updates, nupdates, sizeof(Update), compare_updates);
+    for (int k = 0; k < nupdates; k++) {
+        IrInsn *add = ir_insert(in.f->blocks[updates[k].b], updates[k].j + 1, IR_ADD);
+        add->dst = updates[k].reg;
+        add->a = ir_temp(updates[k].reg);
+        add->b = ir_const(updates[k].add);
+    }
+
+    Exits x;
+    find_exits(l, &x);
+    IrBlock *pre = loop_preheader(l);
+    for (int i = 0; i < in.ncounters; i++) {
+        IrInsn *load = ir_insert(pre, pre->ninsns - 1, IR_LOAD);
+        load->dst = in.counters[i].reg;
+        load->var = in.counters[i].var;
+    }
+    for (int d = 0; d < in.nderived; d++) {
+        IrInsn *mul = ir_insert(pre, pre->ninsns - 1, IR_MUL);
+        mul->dst = in.derived[d].reg;
+        mul->a = ir_temp(in.counters[in.derived[d].counter].reg);
+        mul->b = ir_const(in.derived[d].factor);
+    }
+    store_on_exits(&in, &x);
+
+    int changes = in.ncounters + in.nderived;
+    free(in.uses);
+    free(in.defs);
+    return changes;
+}
+
+int opt_induction(IrFunc *f) {
+    return loop_walk(f, promote);
+}
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+
+// Inline expansion of procedure calls.
+//
+// MPL has no recursion, so procedures are expanded bottom-up: each
+// procedure's calls are inlined before the procedure itself is inlined
+// into its callers. A call is expanded when the callee is small or when
+// it is the callee's only call site, as long as the caller stays within
+// a size limit.
+//
+// Parameters are bound to the caller's arguments directly: a variable or
+// array element argument replaces the parameter in every load, store,
+// read and call. An expression argument becomes its value when the
+// callee never writes the parameter, and a fresh variable otherwise.
+// The callee's locals are copied as fresh variables of the caller for
+// each expansion, and procedures that are no longer called are removed.
+
+#define INLINE_MAX_INSNS   40    // callees this small are inlined everywhere
+#define INLINE_MAX_CALLER  2000  // callers are not grown beyond this
+
+#define BIND_VAR   0  // param -> var
+#define BIND_ELEM  1  // param -> var[value]
+#define BIND_VALUE 2  // param -> value, never written
+
+typedef struct {
+    int kind;
+    int var;
+    IrValue value;
+} Binding;
+
+typedef struct {
+    IrModule *m;
+    int *calls_to;   // call sites per function
+    int serial;      // numbers copied locals
+} Inliner;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int func_size(const IrFunc *f) {
+    int n = 0;
+    for (int i = 0; i < f->nblocks; i++) n += f->blocks[i]->ninsns;
+    return n;
+}
+
+static int param_index(const IrFunc *q, int var) {
+    for (int i = 0; i < q->nparams; i++) {
+        if (q->params[i] == var) return i;
+    }
+    return -1;
+}
+
+// A variable of the caller standing in for a local or parameter of q
+static int new_caller_var(Inliner *in, IrFunc *f, const IrFunc *q, int var) {
+    IrVar v = in->m->vars[var];
+    char name[300];
+    snprintf(name, sizeof(name), "%s%%%s%%%d", v.name, q->name, ++in->serial);
+    int kind = v.kind == IRV_PARAM ? IRV_LOCAL : v.kind;
+    if (f->is_main) {
+        return ir_add_var(in->m, name, NULL, IRV_GLOBAL, v.type, v.size);
+    }
+    return ir_add_var(in->m, name, f->name, kind, v.type, v.size);
+}
+
+static IrValue shift_temp(IrValue v, int base) {
+    if (v.kind == IR_TEMP) v.value += base;
+    return v;
+}
+
+static int map_label(const IrFunc *q, const int *labels, int label) {
+    return labels[ir_block_index(q, label)];
+}
+
+// Copy one instruction of q into block nb of the caller
+static void clone_insn(Inliner *in, IrFunc *f, const IrFunc *q, const IrInsn *src, IrBlock *nb,
+                       int base, const int *labels, int cont, const Binding *binds, int *local_map) {
+    IrInsn *n = ir_append(nb, src->op);
+    *n = *src;
+    if (src->nargs > 0) {
+        n->args = xcalloc(src->nargs, sizeof(IrArg));
+        memcpy(n->args, src->args, src->nargs * sizeof(IrArg));
+    }
+    if (n->dst > 0) n->dst += base;
+    n->a = shift_temp(n->a, base);
+    n->b = shift_temp(n->b, base);
+    for (int k = 0; k < n->nargs; k++) n->args[k].value = shift_temp(n->args[k].value, base);
+
+    switch (n->op) {
+        case IR_JUMP:
+            n->target = map_label(q, labels, n->target);
+            break;
+        case IR_BRANCH:
+            n->target = map_label(q, labels, n->target);
+            n->target2 = map_label(q, labels, n->target2);
+            break;
+        case IR_RET:
+            n->op = IR_JUMP;
+            n->target = cont;
+            break;
+        case IR_CALL:
+            in->calls_to[n->callee]++;
+            break;
+        default:
+            break;
+    }
+
+    if (n->var >= 0) {
+        int p = param_index(q, n->var);
+        if (p >= 0) {
+            n->var = binds[p].var;
+            if (binds[p].kind == BIND_ELEM) {
+                n->a = binds[p].value;
+            } else if (binds[p].kind == BIND_VALUE) {
+                // Only loads reach here: the parameter is never written
+                n->op = IR_MOV;
+                n->var = -1;
+                n->a = binds[p].value;
+            }
+        } else if (in->m->vars[n->var].kind == IRV_LOCAL) {
+            if (local_map[n->var] < 0) local_map[n->var] = new_caller_var(in, f, q, n->var);
+            n->var = local_map[n->var];
+        }
+    }
+    for (int k = 0; k < n->nargs; k++) {
+        IrArg *arg = &n->args[k];
+        if (arg->kind == IR_ARG_VALUE) continue;
+        int p = param_index(q, arg->var);
+        if (p >= 0) {
+            arg->var = binds[p].var;
+            if (binds[p].kind == BIND_ELEM) {
+                arg->kind = IR_ARG_ELEM;
+                arg->value = binds[p].value;
+            }
+        } else if (in->m->vars[arg->var].kind == IRV_LOCAL) {
+            if (local_map[arg->var] < 0) local_map[arg->var] = new_caller_var(in, f, q, arg->var);
+            arg->var = local_map[arg->var];
+        }
+    }
+}
+
+// Replace the call at f->blocks[bi]->insns[j] by a copy of the callee
+static void inline_call(Inliner *in, IrFunc *f, int bi, int j) {
+    IrModule *m = in->m;
+    IrBlock *b = f->blocks[bi];
+    IrInsn call = b->insns[j];
+    IrFunc *q = m->funcs[call.callee];
+
+    Binding *binds = xcalloc(q->nparams, sizeof(Binding));
+    for (int p = 0; p < q->nparams; p++) {
+        const IrArg *arg = &call.args[p];
+        binds[p].var = arg->var;
+        binds[p].value = arg->value;
+        if (arg->kind == IR_ARG_VAR) {
+            binds[p].kind = BIND_VAR;
+        } else if (arg->kind == IR_ARG_ELEM) {
+            binds[p].kind = BIND_ELEM;
+        } else if (!opt_param_written(q, q->params[p])) {
+            binds[p].kind = BIND_VALUE;
+        } else {
+            binds[p].kind = BIND_VAR;
+            binds[p].var = new_caller_var(in, f, q, q->params[p]);
+        }
+    }
+
+    // The rest of the block continues after the callee's body
+    int cont = ir_new_label(m);
+    IrBlock *post = ir_insert_block(f, bi + 1, cont);
+    for (int k = j + 1; k < b->ninsns; k++) {
+        IrInsn *n = ir_append(post, b->insns[k].op);
+        *n = b->insns[k];
+    }
+    b->ninsns = j;
+
+    int *labels = xcalloc(q->nblocks, sizeof(int));
+    for (int i = 0; i < q->nblocks; i++) labels[i] = ir_new_label(m);
+
+    for (int p = 0; p < q->nparams; p++) {
+        if (call.args[p].kind == IR_ARG_VALUE && binds[p].kind == BIND_VAR) {
+            IrInsn *st = ir_append(b, IR_STORE);
+            st->var = binds[p].var;
+            st->b = call.args[p].value;
+            st->line = call.line;
+        }
+    }
+    IrInsn *jump = ir_append(b, IR_JUMP);
+    jump->target = labels[0];
+    jump->line = call.line;
+
+    int base = f->ntemps;
+    f->ntemps += q->ntemps;
+    int *local_map = xcalloc(m->nvars, sizeof(int));
+    for (int v = 0; v < m->nvars; v++) local_map[v] = -1;
+    for (int i = 0; i < q->nblocks; i++) {
+        IrBlock *nb = ir_insert_block(f, bi + 1 + i, labels[i]);
+        const IrBlock *src = q->blocks[i];
+        for (int k = 0; k < src->ninsns; k++) {
+            clone_insn(in, f, q, &src->insns[k], nb, base, labels, cont, binds, local_map);
+        }
+    }
+
+    in->calls_to[call.callee]--;
+    free(call.args);
+    free(local_map);
+    free(labels);
+    free(binds);
+}
+
+static int inline_calls_in(Inliner *in, IrFunc *f) {
+    int inlined = 0;
+    for (int bi = 0; bi < f->nblocks; bi++) {
+        IrBlock *b = f->blocks[bi];
+        for (int j = 0; j < b->ninsns; j++) {
+            if (b->insns[j].op != IR_CALL) continue;
+            IrFunc *q = in->m->funcs[b->insns[j].callee];
+            int size = func_size(q);
+            int wanted = size <= INLINE_MAX_INSNS || in->calls_to[b->insns[j].callee] == 1;
+            if (!wanted || func_size(f) + size > INLINE_MAX_CALLER) continue;
+            inline_call(in, f, bi, j);
+            inlined++;
+            break;  // the rest of the block moved to the next one
+        }
+    }
+    return inlined;
+}
+
+int opt_inline(IrModule *m) {
+    Inliner in;
+    in.m = m;
+    in.serial = 0;
+    in.calls_to = xcalloc(m->nfuncs, sizeof(int));
+    for (int i = 0; i < m->nfuncs; i++) {
+        IrFunc *f = m->funcs[i];
+        for (int b = 0; b < f->nblocks; b++) {
+            for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+                const IrInsn *insn = &f->blocks[b]->insns[j];
+                if (insn->op == IR_CALL) in.calls_to[insn->callee]++;
+            }
+        }
+    }
+
+    // Callees are declared, and so numbered, before their callers
+    int changes = 0;
+    for (int i = 1; i < m->nfuncs; i++) changes += inline_calls_in(&in, m->funcs[i]);
+    changes += inline_calls_in(&in, m->funcs[0]);
+
+    changes += opt_remove_uncalled(m);
+    free(in.calls_to);
+    return changes;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimizer.h"
+#include "loop.h"
+
+// Loop-invariant code motion.
+//
+// Loops are taken innermost first (see loop.h). An instruction in a loop
+// is invariant when every operand is a constant, a temp defined outside
+// the loop or a temp computed by another invariant instruction; a temp
+// with a single definition has only that one reaching each use. A LOAD is invariant when no definition of
+// its variable lies in the loop:
+//
+//   own local    not stored or read into, not passed to a call
+//   global       the same, and no call and no store through a parameter
+//                (a VAR parameter may be the address of any global)
+//   parameter    no call and no store to a global or a parameter
+//
+// Invariant instructions move to the end of a preheader, a block that
+// runs once before the loop is entered. Only instructions that cannot
+// fail move from anywhere in the loop: anything that may trap (an
+// overflow, zero-divide or bounds check) is hoisted only from the front
+// of the loop header, which runs whenever the loop is entered, so a
+// program still fails at the same point.
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int can_trap(const IrInsn *insn) {
+    return insn->op == IR_CHECK || (insn->flags & (IRF_OVERFLOW | IRF_ZERODIV)) != 0;
+}
+
+static int is_movable(const IrInsn *insn) {
+    switch (insn->op) {
+        case IR_MOV:
+            // Constants are better left as immediate operands
+            return insn->a.kind == IR_TEMP;
+        case IR_LOAD: case IR_CHECK:
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_AND: case IR_OR:
+        case IR_NEG: case IR_NOT:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int operand_invariant(IrValue v, const char *loop_def, const char *invariant) {
+    if (v.kind != IR_TEMP) return 1;
+    return !loop_def[v.value] || invariant[v.value];
+}
+
+static int hoist(Loop *l) {
+    IrFunc *f = l->f;
+    LoopEffects e;
+    loop_effects(l, &e);
+
+    char *loop_def = xcalloc(f->ntemps + 1, 1);
+    char *invariant = xcalloc(f->ntemps + 1, 1);
+    int *defs = xcalloc(f->ntemps + 1, sizeof(int));
+    for (int b = 0; b < l->n; b++) {
+        const IrBlock *block = f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            int t = block->insns[j].dst;
+            if (t <= 0) continue;
+            defs[t]++;
+            if (l->in_loop[b]) loop_def[t] = 1;
+        }
+    }
+
+    // Mark the invariant instructions; order holds the (block, index)
+    // pairs in an order where each comes after what it uses
+    int cap = 16;
+    int norder = 0;
+    int (*order)[2] = xcalloc(cap, sizeof(int[2]));
+    char **marked = xcalloc(l->n, sizeof(char*));
+    for (int b = 0; b < l->n; b++) {
+        if (l->in_loop[b]) marked[b] = xcalloc(f->blocks[b]->ninsns, 1);
+    }
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = 0; b < l->n; b++) {
+            if (!l->in_loop[b]) continue;
+            const IrBlock *block = f->blocks[b];
+            int front = b == l->header;
+            for (int j = 0; j < block->ninsns; j++) {
+                const IrInsn *insn = &block->insns[j];
+                if (marked[b][j]) continue;
+                int ok = is_movable(insn)
+                    && (insn->dst == 0 || defs[insn->dst] == 1)
+                    && operand_invariant(insn->a, loop_def, invariant)
+                    && operand_invariant(insn->b, loop_def, invariant)
+                    && (insn->op != IR_LOAD || loop_var_unchanged(l, &e, insn->var))
+                    && (!can_trap(insn) || front);
+                if (ok) {
+                    marked[b][j] = 1;
+                    if (insn->dst > 0) invariant[insn->dst] = 1;
+                    if (norder == cap) {
+                        cap *= 2;
+                        order = realloc(order, cap * sizeof(int[2]));
+                        if (!order) {
+                            fprintf(stderr, "Error: out of memory\n");
+                            exit(1);
+                        }
+                    }
+                    order[norder][0] = b;
+                    order[norder][1] = j;
+                    norder++;
+                    changed = 1;
+                } else if (can_trap(insn) || (!is_movable(insn) && insn->op != IR_MOV)) {
+                    // Nothing that may fail moves past this point
+                    front = 0;
+                }
+            }
+        }
+    }
+
+    if (norder > 0) {
+        // Copy out before the preheader shifts the blocks
+        IrInsn *moved = xcalloc(norder, sizeof(IrInsn));
+        for (int i = 0; i < norder; i++) moved[i] = f->blocks[order[i][0]]->insns[order[i][1]];
+        for (int b = 0; b < l->n; b++) {
+            if (!l->in_loop[b]) continue;
+            // Moved struct-wise: nothing to free
+            IrBlock *block = f->blocks[b];
+            int k = 0;
+            for (int j = 0; j < block->ninsns; j++) {
+                if (!marked[b][j]) block->insns[k++] = block->insns[j];
+            }
+            block->ninsns = k;
+        }
+        IrBlock *pre = loop_preheader(l);
+        for (int i = 0; i < norder; i++) {
+            IrInsn *n = ir_insert(pre, pre->ninsns - 1, moved[i].op);
+            *n = moved[i];
+        }
+        free(moved);
+    }
+
+    for (int b = 0; b < l->n; b++) free(marked[b]);
+    free(marked);
+    free(order);
+    free(defs);
+    free(invariant);
+    free(loop_def);
+    loop_effects_free(&e);
+    return norder;
+}
+
+int opt_licm(IrFunc *f) {
+    return loop_walk(f, hoist);
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimizer.h"
+#include "range.h"
+
+// Overflow check elimination.
+//
+// An ADD, SUB, MUL, DIV or NEG whose exact result is known to fit in 16
+// bits loses its overflow check (the JOV EOVF after it), and a DIV whose
+// divisor cannot be zero loses its zero-divide check. Loop counters
+// bounded by their condition, char and boolean arithmetic and most index
+// computations qualify. Everything else keeps its check and still ends
+// up in the EOVF/E0DIV handlers at run time.
+
+static int checks_removed = 0;
+static int checks_kept = 0;
+
+static int check_insn(RangeInfo *ri, IrInsn *insn) {
+    int removed = 0;
+    Range a = range_get(ri, insn->a);
+    Range b = range_get(ri, insn->b);
+    if (insn->flags & IRF_OVERFLOW) {
+        long lo, hi;
+        range_exact(insn->op, a, b, &lo, &hi);
+        if (lo >= RANGE_MIN && hi <= RANGE_MAX) {
+            insn->flags &= ~IRF_OVERFLOW;
+            removed++;
+        } else {
+            checks_kept++;
+        }
+    }
+    if (insn->flags & IRF_ZERODIV) {
+        if (b.lo > 0 || b.hi < 0) {
+            insn->flags &= ~IRF_ZERODIV;
+            removed++;
+        } else {
+            checks_kept++;
+        }
+    }
+    return removed;
+}
+
+int opt_overflow(IrFunc *f) {
+    RangeInfo *ri = range_analyze(f);
+    int removed = 0;
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        if (!range_enter(ri, b)) continue;
+        for (int j = 0; j < block->ninsns; j++) {
+            IrInsn *insn = &block->insns[j];
+            switch (insn->op) {
+                case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_NEG:
+                    removed += check_insn(ri, insn);
+                    break;
+                default:
+                    break;
+            }
+            range_step(ri, insn);
+        }
+    }
+    range_free(ri);
+    checks_removed += removed;
+    return removed;
+}
+
+void opt_overflow_report(FILE *out) {
+    fprintf(out, "overflow: %d checks removed, %d kept\n", checks_removed, checks_kept);
+}
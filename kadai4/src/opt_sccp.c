@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+
+// Sparse conditional constant propagation.
+//
+// Tracks a lattice value for every temp and for every scalar variable the
+// function can see directly (globals and its own locals), following only
+// the edges that can be taken. Parameters are addresses of the caller's
+// variables and are never tracked; storing through one may change any
+// global, and so may a call. A variable passed to a call is unknown after
+// it.
+//
+// Afterwards, operands and results known to be constant are replaced by
+// the constant, branches with a known condition become jumps, array
+// checks of constant in-range indices go away, and blocks that were never
+// reached are removed. Constant MOVs left without a use are dropped.
+
+#define LAT_TOP    0   // no value reaches here (yet)
+#define LAT_CONST  1
+#define LAT_BOTTOM 2   // not a constant
+
+typedef struct {
+    unsigned char kind;
+    int value;
+} Lattice;
+
+typedef struct {
+    IrFunc *f;
+    const IrModule *m;
+    int *slot_of_var;    // var -> state slot, -1 if not tracked
+    int nslots_var;
+    int size;            // tracked vars, then temps 0..ntemps
+    Lattice **in;        // per block
+    Lattice **out;
+    char *reached;
+    int (*succ)[2];      // successor block indices
+    int *nsucc;
+    char (*taken)[2];    // succ[b][k] can be taken
+} Sccp;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int temp_slot(Sccp *s, int t) {
+    return s->nslots_var + t;
+}
+
+static Lattice lat_const(int c) {
+    Lattice l = { LAT_CONST, c };
+    return l;
+}
+
+static Lattice lat_bottom(void) {
+    Lattice l = { LAT_BOTTOM, 0 };
+    return l;
+}
+
+static Lattice meet(Lattice x, Lattice y) {
+    if (x.kind == LAT_TOP) return y;
+    if (y.kind == LAT_TOP) return x;
+    if (x.kind == LAT_CONST && y.kind == LAT_CONST && x.value == y.value) return x;
+    return lat_bottom();
+}
+
+static int same_state(const Lattice *x, const Lattice *y, int n) {
+    for (int i = 0; i < n; i++) {
+        if (x[i].kind != y[i].kind) return 0;
+        if (x[i].kind == LAT_CONST && x[i].value != y[i].value) return 0;
+    }
+    return 1;
+}
+
+static Lattice value_of(Sccp *s, const Lattice *st, IrValue v) {
+    if (v.kind == IR_CONST) return lat_const(v.value);
+    if (v.kind == IR_TEMP) return st[temp_slot(s, v.value)];
+    return lat_bottom();
+}
+
+static void clobber_globals(Sccp *s, Lattice *st) {
+    for (int v = 0; v < s->m->nvars; v++) {
+        if (s->slot_of_var[v] >= 0 && s->m->vars[v].kind == IRV_GLOBAL) {
+            st[s->slot_of_var[v]] = lat_bottom();
+        }
+    }
+}
+
+static Lattice evaluate(Sccp *s, const Lattice *st, const IrInsn *insn) {
+    int unary = insn->op == IR_MOV || insn->op == IR_NEG || insn->op == IR_NOT;
+    Lattice x = value_of(s, st, insn->a);
+    Lattice y = unary ? lat_const(0) : value_of(s, st, insn->b);
+    if (x.kind == LAT_BOTTOM || y.kind == LAT_BOTTOM) return lat_bottom();
+    if (x.kind == LAT_TOP || y.kind == LAT_TOP) return x.kind == LAT_TOP ? x : y;
+    if (x.kind == LAT_CONST && y.kind == LAT_CONST) {
+        int r;
+        if (ir_fold(insn->op, x.value, y.value, insn->flags, &r)) return lat_const(r);
+    }
+    return lat_bottom();
+}
+
+// Effect of one instruction on the state
+static void transfer(Sccp *s, Lattice *st, const IrInsn *insn) {
+    const IrVar *v = insn->var >= 0 ? &s->m->vars[insn->var] : NULL;
+    int slot = insn->var >= 0 ? s->slot_of_var[insn->var] : -1;
+    switch (insn->op) {
+        case IR_MOV: case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV:
+        case IR_AND: case IR_OR: case IR_NEG: case IR_NOT:
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            st[temp_slot(s, insn->dst)] = evaluate(s, st, insn);
+            return;
+        case IR_LOAD:
+            st[temp_slot(s, insn->dst)] = slot >= 0 ? st[slot] : lat_bottom();
+            return;
+        case IR_STORE:
+            if (slot >= 0) st[slot] = value_of(s, st, insn->b);
+            else if (v->kind == IRV_PARAM) clobber_globals(s, st);
+            return;
+        case IR_READ:
+            if (slot >= 0) st[slot] = lat_bottom();
+            else if (v->kind == IRV_PARAM) clobber_globals(s, st);
+            return;
+        case IR_CALL:
+            clobber_globals(s, st);
+            for (int i = 0; i < insn->nargs; i++) {
+                if (insn->args[i].kind != IR_ARG_VAR) continue;
+                int arg_slot = s->slot_of_var[insn->args[i].var];
+                if (arg_slot >= 0) st[arg_slot] = lat_bottom();
+            }
+            return;
+        default:
+            if (insn->dst > 0) st[temp_slot(s, insn->dst)] = lat_bottom();
+            return;
+    }
+}
+
+// Which successors of a block ending in `t` can be taken in state st;
+// -1 for both
+static int branch_outcome(Sccp *s, const Lattice *st, const IrInsn *t) {
+    if (t->op != IR_BRANCH) return -1;
+    Lattice x = value_of(s, st, t->a);
+    Lattice y = value_of(s, st, t->b);
+    int r;
+    if (x.kind == LAT_CONST && y.kind == LAT_CONST && ir_fold(t->mode, x.value, y.value, 0, &r)) {
+        return r ? 0 : 1;
+    }
+    return -1;
+}
+
+static void compute_in(Sccp *s, int b, Lattice *in) {
+    for (int i = 0; i < s->size; i++) in[i].kind = LAT_TOP;
+    if (b == 0) {
+        // Nothing is known about variables on entry
+        for (int i = 0; i < s->nslots_var; i++) in[i] = lat_bottom();
+    }
+    for (int p = 0; p < s->f->nblocks; p++) {
+        for (int k = 0; k < s->nsucc[p]; k++) {
+            if (s->succ[p][k] != b || !s->taken[p][k]) continue;
+            for (int i = 0; i < s->size; i++) in[i] = meet(in[i], s->out[p][i]);
+        }
+    }
+}
+
+static void solve(Sccp *s) {
+    IrFunc *f = s->f;
+    Lattice *cur = xcalloc(s->size, sizeof(Lattice));
+    s->reached[0] = 1;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = 0; b < f->nblocks; b++) {
+            if (!s->reached[b]) continue;
+            IrBlock *block = f->blocks[b];
+            compute_in(s, b, s->in[b]);
+            memcpy(cur, s->in[b], s->size * sizeof(Lattice));
+            for (int j = 0; j < block->ninsns; j++) transfer(s, cur, &block->insns[j]);
+            if (!same_state(cur, s->out[b], s->size)) {
+                memcpy(s->out[b], cur, s->size * sizeof(Lattice));
+                changed = 1;
+            }
+            IrInsn *t = ir_terminator(block);
+            int outcome = t ? branch_outcome(s, cur, t) : -1;
+            for (int k = 0; k < s->nsucc[b]; k++) {
+                if (outcome >= 0 && s->nsucc[b] == 2 && k != outcome) continue;
+                if (!s->taken[b][k]) {
+                    s->taken[b][k] = 1;
+                    s->reached[s->succ[b][k]] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+    free(cur);
+}
+
+// Rewrite block b using the solution; returns the number of changes
+static int rewrite_block(Sccp *s, int b) {
+    IrBlock *block = s->f->blocks[b];
+    Lattice *st = xcalloc(s->size, sizeof(Lattice));
+    memcpy(st, s->in[b], s->size * sizeof(Lattice));
+    int changes = 0;
+    for (int j = 0; j < block->ninsns; j++) {
+        IrInsn *insn = &block->insns[j];
+        IrValue *uses[64];
+        int nuses = ir_uses(insn, uses, 64);
+        for (int k = 0; k < nuses; k++) {
+            if (uses[k]->kind != IR_TEMP) continue;
+            Lattice l = st[temp_slot(s, uses[k]->value)];
+            if (l.kind == LAT_CONST) {
+                *uses[k] = ir_const(l.value);
+                changes++;
+            }
+        }
+        if (insn->op == IR_BRANCH) {
+            int outcome = branch_outcome(s, st, insn);
+            if (outcome >= 0) {
+                ir_make_jump(insn, outcome == 0 ? insn->target : insn->target2);
+                changes++;
+            }
+            continue;
+        }
+        if (insn->op == IR_CHECK && insn->a.kind == IR_CONST &&
+            insn->a.value >= 0 && insn->a.value < insn->imm) {
+            ir_make_nop(insn);
+            changes++;
+            continue;
+        }
+        transfer(s, st, insn);
+        if (insn->dst > 0 && insn->op != IR_CALL) {
+            Lattice l = st[temp_slot(s, insn->dst)];
+            int already = insn->op == IR_MOV && insn->a.kind == IR_CONST;
+            if (l.kind == LAT_CONST && !already) {
+                ir_make_mov(insn, ir_const(l.value));
+                changes++;
+            }
+        }
+    }
+    free(st);
+
+    for (int j = block->ninsns - 1; j >= 0; j--) {
+        if (block->insns[j].op == IR_NOP) ir_remove(block, j);
+    }
+    return changes;
+}
+
+// Constants that replaced a temp everywhere leave its MOV unused
+static void remove_unused_constants(IrFunc *f) {
+    char *used = xcalloc(f->ntemps + 1, 1);
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            IrValue *uses[64];
+            int nuses = ir_uses(&block->insns[j], uses, 64);
+            for (int k = 0; k < nuses; k++) {
+                if (uses[k]->kind == IR_TEMP) used[uses[k]->value] = 1;
+            }
+        }
+    }
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        for (int j = block->ninsns - 1; j >= 0; j--) {
+            IrInsn *insn = &block->insns[j];
+            if (insn->op == IR_MOV && insn->a.kind == IR_CONST && !used[insn->dst]) {
+                ir_remove(block, j);
+            }
+        }
+    }
+    free(used);
+}
+
+int opt_sccp(IrFunc *f) {
+    Sccp s;
+    memset(&s, 0, sizeof(s));
+    s.f = f;
+    s.m = f->module;
+
+    s.slot_of_var = xcalloc(s.m->nvars, sizeof(int));
+    for (int v = 0; v < s.m->nvars; v++) {
+        const IrVar *var = &s.m->vars[v];
+        int visible = var->kind == IRV_GLOBAL ||
+                      (var->kind == IRV_LOCAL && !f->is_main && strcmp(var->proc, f->name) == 0);
+        s.slot_of_var[v] = (visible && var->size == 0) ? s.nslots_var++ : -1;
+    }
+    s.size = s.nslots_var + f->ntemps + 1;
+
+    int n = f->nblocks;
+    s.in = xcalloc(n, sizeof(Lattice*));
+    s.out = xcalloc(n, sizeof(Lattice*));
+    s.reached = xcalloc(n, 1);
+    s.succ = xcalloc(n, sizeof(*s.succ));
+    s.nsucc = xcalloc(n, sizeof(int));
+    s.taken = xcalloc(n, sizeof(*s.taken));
+    for (int b = 0; b < n; b++) {
+        s.in[b] = xcalloc(s.size, sizeof(Lattice));
+        s.out[b] = xcalloc(s.size, sizeof(Lattice));
+        int labels[2];
+        s.nsucc[b] = ir_successors(f->blocks[b], labels);
+        for (int k = 0; k < s.nsucc[b]; k++) s.succ[b][k] = ir_block_index(f, labels[k]);
+    }
+
+    solve(&s);
+
+    int changes = 0;
+    for (int b = 0; b < n; b++) {
+        if (s.reached[b]) changes += rewrite_block(&s, b);
+    }
+    for (int b = n - 1; b > 0; b--) {
+        if (!s.reached[b]) {
+            ir_remove_block(f, b);
+            changes++;
+        }
+    }
+    if (changes > 0) remove_unused_constants(f);
+
+    for (int b = 0; b < n; b++) {
+        free(s.in[b]);
+        free(s.out[b]);
+    }
+    free(s.in);
+    free(s.out);
+    free(s.reached);
+    free(s.succ);
+    free(s.nsucc);
+    free(s.taken);
+    free(s.slot_of_var);
+    return changes;
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+
+// Procedure specialization on constant arguments.
+//
+// An expression argument is passed as the address of a cell holding its
+// value, so `call draw(10, x)` stores 10 to memory and the callee reads it
+// back through the parameter. For each procedure that survived inlining,
+// call sites passing constants to parameters the procedure never writes
+// are grouped by those constants, and each group calls a clone of the
+// procedure that has the values built in: the parameters disappear from
+// the clone and its loads become constants for SCCP to fold. The number
+// of clones per procedure and the code they add are bounded; a procedure
+// whose every call went to a clone is removed.
+
+#define SPECIALIZE_MAX_CLONES 4    // per procedure
+#define SPECIALIZE_BUDGET     400  // instructions added over the module
+
+typedef struct {
+    int *is_const;   // per parameter
+    int *value;
+} Variant;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int func_size(const IrFunc *f) {
+    int n = 0;
+    for (int i = 0; i < f->nblocks; i++) n += f->blocks[i]->ninsns;
+    return n;
+}
+
+// The constants a call passes to the read-only parameters of q
+static void call_variant(const IrInsn *call, const int *read_only, int nparams, Variant *v) {
+    for (int p = 0; p < nparams; p++) {
+        const IrArg *arg = &call->args[p];
+        v->is_const[p] = read_only[p] && arg->kind == IR_ARG_VALUE && arg->value.kind == IR_CONST;
+        v->value[p] = v->is_const[p] ? arg->value.value : 0;
+    }
+}
+
+static int any_const(const Variant *v, int nparams) {
+    for (int p = 0; p < nparams; p++) {
+        if (v->is_const[p]) return 1;
+    }
+    return 0;
+}
+
+static int same_variant(const Variant *a, const Variant *b, int nparams) {
+    for (int p = 0; p < nparams; p++) {
+        if (a->is_const[p] != b->is_const[p]) return 0;
+        if (a->is_const[p] && a->value[p] != b->value[p]) return 0;
+    }
+    return 1;
+}
+
+// Copy q as a new procedure at index ci, with the parameters that are
+// constant in v replaced by their values
+static IrFunc* clone_func(IrModule *m, int qi, int ci, const Variant *v, int serial) {
+    char name[300];
+    snprintf(name, sizeof(name), "%s%%c%d", m->funcs[qi]->name, serial);
+    IrFunc *c = ir_insert_func(m, ci, name);
+    const IrFunc *q = m->funcs[qi];
+    c->ntemps = q->ntemps;
+
+    // Parameters and locals of q -> those of the clone, -2 for constants
+    int *var_map = xcalloc(m->nvars, sizeof(int));
+    int nvars = m->nvars;
+    for (int i = 0; i < nvars; i++) var_map[i] = -1;
+    c->params = xcalloc(q->nparams, sizeof(int));
+    for (int p = 0; p < q->nparams; p++) {
+        int old = q->params[p];
+        if (v->is_const[p]) {
+            var_map[old] = -2;
+            continue;
+        }
+        IrVar var = m->vars[old];
+        var_map[old] = ir_add_var(m, var.name, name, IRV_PARAM, var.type, var.size);
+        c->params[c->nparams++] = var_map[old];
+    }
+    for (int i = 0; i < nvars; i++) {
+        IrVar var = m->vars[i];
+        if (var.kind == IRV_LOCAL && strcmp(var.proc, q->name) == 0) {
+            var_map[i] = ir_add_var(m, var.name, name, IRV_LOCAL, var.type, var.size);
+        }
+    }
+
+    int *labels = xcalloc(q->nblocks, sizeof(int));
+    for (int i = 0; i < q->nblocks; i++) labels[i] = ir_new_label(m);
+    for (int i = 0; i < q->nblocks; i++) {
+        const IrBlock *src = q->blocks[i];
+        IrBlock *nb = ir_add_block(c, labels[i]);
+        for (int k = 0; k < src->ninsns; k++) {
+            IrInsn *n = ir_append(nb, src->insns[k].op);
+            *n = src->insns[k];
+            if (n->nargs > 0) {
+                n->args = xcalloc(n->nargs, sizeof(IrArg));
+                memcpy(n->args, src->insns[k].args, n->nargs * sizeof(IrArg));
+            }
+            if (n->op == IR_JUMP || n->op == IR_BRANCH) {
+                n->target = labels[ir_block_index(q, n->target)];
+            }
+            if (n->op == IR_BRANCH) n->target2 = labels[ir_block_index(q, n->target2)];
+            if (n->var >= 0 && var_map[n->var] == -2) {
+                // Only loads: constant parameters are never written
+                int p = 0;
+                while (q->params[p] != n->var) p++;
+                n->op = IR_MOV;
+                n->var = -1;
+                n->a = ir_const(v->value[p]);
+            } else if (n->var >= 0 && var_map[n->var] >= 0) {
+                n->var = var_map[n->var];
+            }
+            for (int a = 0; a < n->nargs; a++) {
+                IrArg *arg = &n->args[a];
+                if (arg->kind != IR_ARG_VALUE && var_map[arg->var] >= 0) arg->var = var_map[arg->var];
+            }
+        }
+    }
+    free(labels);
+    free(var_map);
+    return c;
+}
+
+// Drop the arguments the clone has built in
+static void redirect_call(IrInsn *call, int callee, const Variant *v, int nparams) {
+    int n = 0;
+    for (int p = 0; p < nparams; p++) {
+        if (!v->is_const[p]) call->args[n++] = call->args[p];
+    }
+    call->nargs = n;
+    call->callee = callee;
+}
+
+static int specialize_func(IrModule *m, int qi, int *budget, int *serial) {
+    IrFunc *q = m->funcs[qi];
+    int np = q->nparams;
+    if (np == 0) return 0;
+    int size = func_size(q);
+
+    int *read_only = xcalloc(np, sizeof(int));
+    for (int p = 0; p < np; p++) read_only[p] = !opt_param_written(q, q->params[p]);
+
+    Variant variants[SPECIALIZE_MAX_CLONES];
+    int clone_index[SPECIALIZE_MAX_CLONES];
+    int nvariants = 0;
+    Variant cur;
+    cur.is_const = xcalloc(np, sizeof(int));
+    cur.value = xcalloc(np, sizeof(int));
+
+    // Procedures calling q come after it and its clones, main before
+    int changes = 0;
+    for (int i = 0; i < m->nfuncs; i++) {
+        IrFunc *f = m->funcs[i];
+        for (int b = 0; b < f->nblocks; b++) {
+            for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+                IrInsn *insn = &f->blocks[b]->insns[j];
+                if (insn->op != IR_CALL || insn->callee != qi) continue;
+                call_variant(insn, read_only, np, &cur);
+                if (!any_const(&cur, np)) continue;
+                int k = 0;
+                while (k < nvariants && !same_variant(&variants[k], &cur, np)) k++;
+                if (k == nvariants) {
+                    if (nvariants == SPECIALIZE_MAX_CLONES || *budget < size) continue;
+                    variants[k].is_const = xcalloc(np, sizeof(int));
+                    variants[k].value = xcalloc(np, sizeof(int));
+                    memcpy(variants[k].is_const, cur.is_const, np * sizeof(int));
+                    memcpy(variants[k].value, cur.value, np * sizeof(int));
+                    clone_index[k] = qi + 1 + k;
+                    clone_func(m, qi, clone_index[k], &variants[k], ++*serial);
+                    *budget -= size;
+                    nvariants++;
+                    if (i > qi) i++;  // the clone went in before the caller
+                    changes++;
+                }
+                redirect_call(insn, clone_index[k], &variants[k], np);
+                changes++;
+            }
+        }
+    }
+
+    for (int k = 0; k < nvariants; k++) {
+        free(variants[k].is_const);
+        free(variants[k].value);
+    }
+    free(cur.is_const);
+    free(cur.value);
+    free(read_only);
+    return changes;
+}
+
+int opt_specialize(IrModule *m) {
+    int budget = SPECIALIZE_BUDGET;
+    int serial = 0;
+    int changes = 0;
+    // Downwards, so that clones (inserted after their original) of
+    // callers are seen before the procedures they call
+    for (int qi = m->nfuncs - 1; qi > 0; qi--) changes += specialize_func(m, qi, &budget, &serial);
+    changes += opt_remove_uncalled(m);
+    return changes;
+}
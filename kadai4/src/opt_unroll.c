@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "loop.h"
+
+// Unrolling of while loops with a constant trip count.
+//
+// The loops handled look like
+//
+//   i := i0;
+//   while i rel K do begin ... i := i + c end
+//
+// with constants i0, K and c (after SCCP), no other write to i in the
+// loop, no exit but the test and the step at the end of the body. The
+// trip count n then follows from simulating the counter.
+//
+// A loop whose n copies of the body stay within UNROLL_FULL_INSNS is
+// replaced by the copies, one after the other, and SCCP is run again on
+// the function: in each copy the counter is a known constant and the
+// body folds. Any other loop gets unroll_factor copies of its body per
+// test, with n mod unroll_factor copies in front of it for the rest; as
+// n is known, the tests between the copies are not needed. Unrolling is
+// limited to UNROLL_MAX_GROWTH instructions per loop and UNROLL_BUDGET
+// per function.
+
+#define UNROLL_FULL_INSNS 64
+#define UNROLL_FULL_TRIP  16
+#define UNROLL_MAX_GROWTH 48
+#define UNROLL_BUDGET     256
+#define UNROLL_MAX_TRIP   32768
+
+static int unroll_factor = 4;
+static int budget;
+static int folded;
+
+typedef struct {
+    IrFunc *f;
+    int header;        // label
+    int pre;           // label of the block that enters the loop
+    IrBlock **body;    // the loop's blocks but the header, in order
+    int nbody;
+    int entry;         // label of the first body block
+    IrBlock *latch;
+    int size;          // instructions in the body
+    char *renamed;     // temps defined only in the body
+    int ntemps;        // temps before any copy; the length of renamed - 1
+} Body;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+void opt_unroll_set_factor(int factor) {
+    unroll_factor = factor;
+}
+
+static int holds(int rel, long a, long b) {
+    switch (rel) {
+        case IR_EQ: return a == b;
+        case IR_NE: return a != b;
+        case IR_LT: return a < b;
+        case IR_LE: return a <= b;
+        case IR_GT: return a > b;
+        default:    return a >= b;
+    }
+}
+
+static int negate(int rel) {
+    switch (rel) {
+        case IR_EQ: return IR_NE;
+        case IR_NE: return IR_EQ;
+        case IR_LT: return IR_GE;
+        case IR_LE: return IR_GT;
+        case IR_GT: return IR_LE;
+        default:    return IR_LT;
+    }
+}
+
+static int swap(int rel) {
+    switch (rel) {
+        case IR_LT: return IR_GT;
+        case IR_LE: return IR_GE;
+        case IR_GT: return IR_LT;
+        case IR_GE: return IR_LE;
+        default:    return rel;
+    }
+}
+
+static int def_index(const IrBlock *b, int temp, int before) {
+    for (int j = before - 1; j >= 0; j--) {
+        if (b->insns[j].dst == temp) return j;
+    }
+    return -1;
+}
+
+static int uses_of(const IrFunc *f, int temp) {
+    int n = 0;
+    for (int b = 0; b < f->nblocks; b++) {
+        IrBlock *block = f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            IrValue *used[64];
+            int k = ir_uses(&block->insns[j], used, 64);
+            for (int u = 0; u < k; u++) {
+                if (used[u]->kind == IR_TEMP && used[u]->value == temp) n++;
+            }
+        }
+    }
+    return n;
+}
+
+// The header holds the test and what it reads, nothing needed elsewhere
+static int plain_header(const IrFunc *f, const IrBlock *h) {
+    for (int j = 0; j < h->ninsns - 1; j++) {
+        const IrInsn *insn = &h->insns[j];
+        if (insn->op != IR_LOAD && insn->op != IR_MOV) return 0;
+        int n = 0;
+        for (int k = j + 1; k < h->ninsns; k++) {
+            IrValue *used[64];
+            int m = ir_uses((IrInsn*)&h->insns[k], used, 64);
+            for (int u = 0; u < m; u++) {
+                if (used[u]->kind == IR_TEMP && used[u]->value == insn->dst) n++;
+            }
+        }
+        if (n != uses_of(f, insn->dst)) return 0;
+    }
+    return 1;
+}
+
+// Value of var when block b jumps into the loop, if a constant
+static int initial_value(const IrModule *m, const IrBlock *b, int var, int *value) {
+    for (int j = b->ninsns - 1; j >= 0; j--) {
+        const IrInsn *insn = &b->insns[j];
+        if (insn->op == IR_STORE && insn->var == var) {
+            if (insn->b.kind != IR_CONST) return 0;
+            *value = insn->b.value;
+            return 1;
+        }
+        if (insn->op == IR_READ && insn->var == var) return 0;
+        if (insn->op == IR_CALL) return 0;
+        if (insn->op == IR_STORE && m->vars[var].kind == IRV_GLOBAL &&
+            m->vars[insn->var].kind == IRV_PARAM) return 0;
+    }
+    return 0;
+}
+
+// Trip count of loop l into n, and its body into body; 0 if the loop
+// is not one of ours
+static int analyze(Loop *l, Body *body, int *n) {
+    IrFunc *f = l->f;
+    const IrModule *m = f->module;
+    IrBlock *h = f->blocks[l->header];
+    IrInsn *test = ir_terminator(h);
+    if (!test || test->op != IR_BRANCH || !plain_header(f, h)) return 0;
+
+    int in_target = ir_block_index(f, test->target);
+    int in_target2 = ir_block_index(f, test->target2);
+    if (l->in_loop[in_target] == l->in_loop[in_target2]) return 0;
+    int rel = l->in_loop[in_target] ? test->mode : negate(test->mode);
+    body->entry = l->in_loop[in_target] ? test->target : test->target2;
+
+    // One way in, one way around, no way out but the test
+    int pre = -1, latch = -1;
+    for (int b = 0; b < l->n; b++) {
+        if (!l->reached[b]) continue;
+        for (int i = 0; i < l->nsucc[b]; i++) {
+            int s = l->succ[b][i];
+            if (s == l->header && !l->in_loop[b]) {
+                if (pre >= 0) return 0;
+                pre = b;
+            }
+            if (s == l->header && l->in_loop[b]) {
+                if (latch >= 0) return 0;
+                latch = b;
+            }
+            if (b != l->header && l->in_loop[b] && !l->in_loop[s]) return 0;
+        }
+    }
+    if (pre < 0 || latch < 0 || l->nsucc[pre] != 1) return 0;
+    if (ir_terminator(f->blocks[latch])->op != IR_JUMP) return 0;
+
+    // The counter: i rel K in the test, i := i + c last in the latch
+    IrValue x = test->a, k = test->b;
+    if (x.kind == IR_CONST) {
+        x = test->b;
+        k = test->a;
+        rel = swap(rel);
+    }
+    if (x.kind != IR_TEMP || k.kind != IR_CONST) return 0;
+    int d = def_index(h, x.value, h->ninsns - 1);
+    if (d < 0 || h->insns[d].op != IR_LOAD) return 0;
+    int var = h->insns[d].var;
+    if (m->vars[var].size != 0 || m->vars[var].kind == IRV_PARAM) return 0;
+
+    IrBlock *lb = f->blocks[latch];
+    int sj = lb->ninsns - 2;
+    if (sj < 0 || lb->insns[sj].op != IR_STORE || lb->insns[sj].var != var) return 0;
+    if (lb->insns[sj].b.kind != IR_TEMP) return 0;
+    int u = def_index(lb, lb->insns[sj].b.value, sj);
+    if (u < 0) return 0;
+    IrInsn *step = &lb->insns[u];
+    if (step->op != IR_ADD && step->op != IR_SUB) return 0;
+    IrValue y = step->a, c = step->b;
+    if (step->op == IR_ADD && y.kind == IR_CONST) {
+        y = step->b;
+        c = step->a;
+    }
+    if (y.kind != IR_TEMP || c.kind != IR_CONST) return 0;
+    int yd = def_index(lb, y.value, u);
+    if (yd < 0 || lb->insns[yd].op != IR_LOAD || lb->insns[yd].var != var) return 0;
+
+    LoopEffects e;
+    loop_effects(l, &e);
+    int other_writes = 0;
+    for (int b = 0; b < l->n; b++) {
+        if (!l->in_loop[b]) continue;
+        IrBlock *block = f->blocks[b];
+        for (int j = 0; j < block->ninsns; j++) {
+            const IrInsn *insn = &block->insns[j];
+            if ((insn->op == IR_STORE || insn->op == IR_READ) && insn->var == var &&
+                !(block == lb && j == sj)) other_writes = 1;
+            for (int a = 0; a < insn->nargs; a++) {
+                if (insn->args[a].kind != IR_ARG_VALUE && insn->args[a].var == var) other_writes = 1;
+            }
+        }
+    }
+    if (m->vars[var].kind == IRV_GLOBAL && (e.has_call || e.writes_param)) other_writes = 1;
+    loop_effects_free(&e);
+    if (other_writes) return 0;
+
+    int i0;
+    if (!initial_value(m, f->blocks[pre], var, &i0)) return 0;
+    long v = i0;
+    long stepc = step->op == IR_ADD ? c.value : -(long)c.value;
+    int trips = 0;
+    while (holds(rel, v, k.value)) {
+        if (++trips > UNROLL_MAX_TRIP) return 0;
+        v += stepc;
+        // Trapping or wrapping half way: leave it alone
+        if (v < -32768 || v > 32767) return 0;
+    }
+    if (trips == 0) return 0;
+    *n = trips;
+
+    body->f = f;
+    body->header = h->label;
+    body->pre = f->blocks[pre]->label;
+    body->latch = lb;
+    body->body = xcalloc(l->n, sizeof(IrBlock*));
+    body->nbody = 0;
+    body->size = 0;
+    for (int b = 0; b < l->n; b++) {
+        if (!l->in_loop[b] || b == l->header) continue;
+        body->body[body->nbody++] = f->blocks[b];
+        body->size += f->blocks[b]->ninsns;
+    }
+
+    // Temps defined in the body and nowhere else get fresh ones per copy
+    int *defs = xcalloc(f->ntemps + 1, sizeof(int));
+    body->ntemps = f->ntemps;
+    body->renamed = xcalloc(body->ntemps + 1, 1);
+    for (int b = 0; b < f->nblocks; b++) {
+        for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+            int t = f->blocks[b]->insns[j].dst;
+            if (t > 0) defs[t]++;
+        }
+    }
+    for (int i = 0; i < body->nbody; i++) {
+        for (int j = 0; j < body->body[i]->ninsns; j++) {
+            int t = body->body[i]->insns[j].dst;
+            if (t > 0) body->renamed[t]++;
+        }
+    }
+    for (int t = 1; t <= body->ntemps; t++) body->renamed[t] = body->renamed[t] > 0 && body->renamed[t] == defs[t];
+    free(defs);
+    return 1;
+}
+
+static IrValue map_value(IrValue v, const int *temps) {
+    if (v.kind == IR_TEMP && temps[v.value] > 0) v.value = temps[v.value];
+    return v;
+}
+
+// A copy of the body at block index `at` whose back edge goes to next;
+// returns the label of the copy's first block
+static int clone_body(Body *body, int next, int at) {
+    IrFunc *f = body->f;
+    int *temps = xcalloc(body->ntemps + 1, sizeof(int));
+    for (int t = 1; t <= body->ntemps; t++) {
+        if (body->renamed[t]) temps[t] = ir_new_temp(f);
+    }
+    int *labels = xcalloc(body->nbody, sizeof(int));
+    for (int i = 0; i < body->nbody; i++) labels[i] = ir_new_label(f->module);
+
+    for (int i = 0; i < body->nbody; i++) {
+        const IrBlock *src = body->body[i];
+        IrBlock *nb = ir_insert_block(f, at + i, labels[i]);
+        for (int j = 0; j < src->ninsns; j++) {
+            IrInsn *n = ir_append(nb, src->insns[j].op);
+            *n = src->insns[j];
+            if (n->nargs > 0) {
+                n->args = xcalloc(n->nargs, sizeof(IrArg));
+                memcpy(n->args, src->insns[j].args, n->nargs * sizeof(IrArg));
+            }
+            if (n->dst > 0 && temps[n->dst] > 0) n->dst = temps[n->dst];
+            n->a = map_value(n->a, temps);
+            n->b = map_value(n->b, temps);
+            for (int k = 0; k < n->nargs; k++) n->args[k].value = map_value(n->args[k].value, temps);
+            if (n->op == IR_JUMP || n->op == IR_BRANCH) {
+                for (int k = 0; k < body->nbody; k++) {
+                    if (n->target == body->body[k]->label) {
+                        n->target = labels[k];
+                        break;
+                    }
+                }
+                if (n->target == body->header) n->target = next;
+            }
+            if (n->op == IR_BRANCH) {
+                for (int k = 0; k < body->nbody; k++) {
+                    if (n->target2 == body->body[k]->label) {
+                        n->target2 = labels[k];
+                        break;
+                    }
+                }
+                if (n->target2 == body->header) n->target2 = next;
+            }
+        }
+    }
+
+    int entry = 0;
+    for (int i = 0; i < body->nbody; i++) {
+        if (body->body[i]->label == body->entry) entry = labels[i];
+    }
+    free(labels);
+    free(temps);
+    return entry;
+}
+
+// Copies c1 -> c2 -> ... -> c_count -> last laid out in that order from
+// block index at; returns the label of c1, or last if count is 0
+static int chain(Body *body, int count, int last, int at) {
+    int next = last;
+    for (int k = count; k >= 1; k--) next = clone_body(body, next, at);
+    return next;
+}
+
+static void redirect(IrBlock *b, int from, int to) {
+    IrInsn *term = ir_terminator(b);
+    if (term->op == IR_JUMP || term->op == IR_BRANCH) {
+        if (term->target == from) term->target = to;
+    }
+    if (term->op == IR_BRANCH && term->target2 == from) term->target2 = to;
+}
+
+static int unroll(Loop *l) {
+    Body body;
+    int n;
+    if (!analyze(l, &body, &n)) return 0;
+    IrFunc *f = l->f;
+    IrBlock *pre = ir_block(f, body.pre);
+    IrInsn *test = ir_terminator(ir_block(f, body.header));
+    int exit = body.entry == test->target ? test->target2 : test->target;
+    int changes = 0;
+
+    if (n <= UNROLL_FULL_TRIP && n * body.size <= UNROLL_FULL_INSNS &&
+        n * body.size <= budget) {
+        // The loop becomes n copies; its blocks are unreachable then
+        int first = chain(&body, n, exit, ir_block_index(f, body.header));
+        redirect(pre, body.header, first);
+        budget -= n * body.size;
+        folded = 1;
+        changes = 1;
+    } else {
+        int factor = unroll_factor;
+        while (factor > 1 && ((factor - 1 + n % factor) * body.size > UNROLL_MAX_GROWTH ||
+                              (factor - 1 + n % factor) * body.size > budget ||
+                              n < 2 * factor)) {
+            factor--;
+        }
+        if (factor > 1) {
+            int rest = n % factor;
+            // Copies 2..factor go after the body; the last one jumps back
+            int after = ir_block_index(f, body.body[body.nbody - 1]->label) + 1;
+            int second = chain(&body, factor - 1, body.header, after);
+            int first = chain(&body, rest, body.header, ir_block_index(f, body.header));
+            redirect(body.latch, body.header, second);
+            redirect(pre, body.header, first);
+            budget -= (factor - 1 + rest) * body.size;
+            changes = 1;
+        }
+    }
+    free(body.body);
+    free(body.renamed);
+    return changes;
+}
+
+int opt_unroll(IrFunc *f) {
+    if (unroll_factor < 1) return 0;
+    budget = UNROLL_BUDGET;
+    folded = 0;
+    int changes = loop_walk(f, unroll);
+    if (folded) opt_sccp(f);
+    return changes;
+}
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "optimizer.h"
+#include "debug.h"
+
+#define ALL (OPT_O1 | OPT_O2 | OPT_OS)
+
+// -O1 keeps to the cheap local passes, -Os leaves out whatever copies
+// code (inlining, specialization, unrolling, counters stored at every
+// loop exit)
+static OptPass passes[] = {
+    { "inline",     NULL,           opt_inline,     NULL,                OPT_O2,          -1, 0, 0, 0, 0 },
+    { "specialize", NULL,           opt_specialize, NULL,                OPT_O2,          -1, 0, 0, 0, 0 },
+    { "condbranch", opt_condbranch, NULL,           NULL,                ALL,             -1, 0, 0, 0, 0 },
+    { "sccp",       opt_sccp,       NULL,           NULL,                ALL,             -1, 0, 0, 0, 0 },
+    { "bounds",     opt_bounds,     NULL,           opt_bounds_report,   ALL,             -1, 0, 0, 0, 0 },
+    { "overflow",   opt_overflow,   NULL,           opt_overflow_report, ALL,             -1, 0, 0, 0, 0 },
+    { "unroll",     opt_unroll,     NULL,           NULL,                OPT_O2,          -1, 0, 0, 0, 0 },
+    { "licm",       opt_licm,       NULL,           NULL,                OPT_O2 | OPT_OS, -1, 0, 0, 0, 0 },
+    { "induction",  opt_induction,  NULL,           NULL,                OPT_O2,          -1, 0, 0, 0, 0 },
+    { "cse",        opt_cse,        NULL,           NULL,                ALL,             -1, 0, 0, 0, 0 },
+    { "dse",        opt_dse,        NULL,           NULL,                ALL,             -1, 0, 0, 0, 0 },
+    { "dce",        opt_dce,        NULL,           NULL,                ALL,             -1, 0, 0, 0, 0 },
+    { "cfg",        opt_cfg,        NULL,           NULL,                ALL,             -1, 0, 0, 0, 0 },
+};
+
+#define NPASSES ((int)(sizeof(passes) / sizeof(passes[0])))
+
+int pass_stats = 0;
+static int level = OPT_O2;   // 0 for -O0
+
+static void debug_optimizer_printf(const char *format, ...) {
+    if (debug_codegen) {
+        va_list args;
+        va_start(args, format);
+        printf("[OPT] ");
+        vprintf(format, args);
+        va_end(args);
+    }
+}
+
+static double wall_time(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+int optimizer_set_level(const char *name) {
+    if (strcmp(name, "0") == 0) level = 0;
+    else if (strcmp(name, "1") == 0) level = OPT_O1;
+    else if (strcmp(name, "2") == 0) level = OPT_O2;
+    else if (strcmp(name, "s") == 0) level = OPT_OS;
+    else return 0;
+    opt_cfg_set_rotation(level != OPT_OS);
+    return 1;
+}
+
+int optimizer_enable_pass(const char *name, int on) {
+    for (int i = 0; i < NPASSES; i++) {
+        if (strcmp(passes[i].name, name) == 0) {
+            passes[i].forced = on;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int pass_enabled(const OptPass *p) {
+    return p->forced >= 0 ? p->forced : (p->levels & level) != 0;
+}
+
+void optimize_module(IrModule *m) {
+    for (int i = 0; i < NPASSES; i++) {
+        OptPass *p = &passes[i];
+        if (!pass_enabled(p)) continue;
+        int before = ir_count_insns(m);
+        double start = wall_time();
+        if (p->run_module) {
+            int changes = p->run_module(m);
+            p->changes += changes;
+            if (changes > 0) {
+                debug_optimizer_printf("%s: %d changes\n", p->name, changes);
+            }
+        } else {
+            for (int j = 0; j < m->nfuncs; j++) {
+                int changes = p->run(m->funcs[j]);
+                p->changes += changes;
+                if (changes > 0) {
+                    debug_optimizer_printf("%s: %d changes in %s\n", p->name, changes,
+                                           m->funcs[j]->is_main ? "main" : m->funcs[j]->name);
+                }
+            }
+        }
+        p->seconds += wall_time() - start;
+        p->insns_before += before;
+        p->insns_after += ir_count_insns(m);
+        if (p->report && debug_codegen) {
+            printf("[OPT] ");
+            p->report(stdout);
+        }
+    }
+}
+
+void optimizer_print_stats(FILE *out) {
+    double total = 0;
+    fprintf(out, "pass        changes  insns before   after  time (ms)\n");
+    for (int i = 0; i < NPASSES; i++) {
+        const OptPass *p = &passes[i];
+        if (!pass_enabled(p)) {
+            fprintf(out, "%-10s  (off)\n", p->name);
+            continue;
+        }
+        fprintf(out, "%-10s %8d %13d %7d %10.3f\n", p->name, p->changes,
+                p->insns_before, p->insns_after, p->seconds * 1000);
+        total += p->seconds;
+    }
+    fprintf(out, "%-10s %41.3f\n", "total", total * 1000);
+    for (int i = 0; i < NPASSES; i++) {
+        if (passes[i].report && pass_enabled(&passes[i])) passes[i].report(out);
+    }
+}
+
+// Helpers for the interprocedural passes
+
+int opt_param_written(const IrFunc *f, int var) {
+    for (int i = 0; i < f->nblocks; i++) {
+        const IrBlock *b = f->blocks[i];
+        for (int j = 0; j < b->ninsns; j++) {
+            const IrInsn *insn = &b->insns[j];
+            if ((insn->op == IR_STORE || insn->op == IR_READ) && insn->var == var) return 1;
+            for (int k = 0; k < insn->nargs; k++) {
+                if (insn->args[k].kind != IR_ARG_VALUE && insn->args[k].var == var) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void count_calls(const IrFunc *f, int *calls_to) {
+    for (int b = 0; b < f->nblocks; b++) {
+        for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+            const IrInsn *insn = &f->blocks[b]->insns[j];
+            if (insn->op == IR_CALL) calls_to[insn->callee]++;
+        }
+    }
+}
+
+int opt_remove_uncalled(IrModule *m) {
+    int *calls_to = calloc(m->nfuncs, sizeof(int));
+    if (!calls_to) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < m->nfuncs; i++) count_calls(m->funcs[i], calls_to);
+
+    // Callers come after their callees, so one backward sweep also
+    // catches procedures called only from removed ones
+    int removed = 0;
+    for (int i = m->nfuncs - 1; i > 0; i--) {
+        if (calls_to[i] > 0) continue;
+        IrFunc *f = m->funcs[i];
+        for (int b = 0; b < f->nblocks; b++) {
+            for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+                const IrInsn *insn = &f->blocks[b]->insns[j];
+                if (insn->op == IR_CALL) calls_to[insn->callee]--;
+            }
+        }
+        memmove(&calls_to[i], &calls_to[i + 1], (m->nfuncs - i - 1) * sizeof(int));
+        ir_remove_func(m, i);
+        removed++;
+    }
+    free(calls_to);
+    return removed;
+}
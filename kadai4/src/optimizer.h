@@ -0,0 +1,78 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ir.h"
+
+// IR optimization passes, run on the finished module before it is
+// verified and handed to the CASL emitter. A pass works either on one
+// function at a time or on the whole module, and returns the number of
+// changes it made.
+//
+// The passes run in a fixed order; the optimization level (-O0, -O1,
+// -O2, -Os) picks which of them do, and --enable-pass/--disable-pass
+// override that pass by pass, whatever the order of the options.
+
+typedef int (*OptPassFunc)(IrFunc *f);
+typedef int (*OptModulePassFunc)(IrModule *m);
+typedef void (*OptReportFunc)(FILE *out);
+
+// Levels whose pipeline includes a pass
+#define OPT_O1 1
+#define OPT_O2 2
+#define OPT_OS 4
+
+typedef struct {
+    const char *name;
+    OptPassFunc run;
+    OptModulePassFunc run_module;
+    OptReportFunc report;   // optional summary line of a pass
+    int levels;             // OPT_O1 | OPT_O2 | OPT_OS
+    int forced;             // -1, or 0/1 from --disable-pass/--enable-pass
+    // Statistics, summed over the run
+    int changes;
+    int insns_before;       // IR instructions in the module before the pass
+    int insns_after;
+    double seconds;         // wall time
+} OptPass;
+
+void optimize_module(IrModule *m);
+
+// Select the pipeline for "0", "1", "2" (the default) or "s" (-O);
+// returns 0 for anything else
+int optimizer_set_level(const char *level);
+// Turn a pass on or off by name (--enable-pass=, --disable-pass=);
+// returns 0 if there is none
+int optimizer_enable_pass(const char *name, int on);
+
+// Print what every pass did after compiling (--pass-stats)
+void optimizer_print_stats(FILE *out);
+extern int pass_stats;
+
+// Does f store to, read into or pass on its parameter var?
+int opt_param_written(const IrFunc *f, int var);
+// Drop procedures that are no longer called; returns how many
+int opt_remove_uncalled(IrModule *m);
+
+// Passes (opt_*.c)
+int opt_inline(IrModule *m);
+int opt_specialize(IrModule *m);
+int opt_condbranch(IrFunc *f);
+int opt_sccp(IrFunc *f);
+int opt_cse(IrFunc *f);
+int opt_unroll(IrFunc *f);
+// Copies of the body per test in partly unrolled loops (--unroll=); 1
+// leaves them alone, full unrolling only
+void opt_unroll_set_factor(int factor);
+// Copy loop tests to the end of the loop (0 for -Os)
+void opt_cfg_set_rotation(int on);
+int opt_bounds(IrFunc *f);
+void opt_bounds_report(FILE *out);
+int opt_overflow(IrFunc *f);
+void opt_overflow_report(FILE *out);
+int opt_licm(IrFunc *f);
+int opt_induction(IrFunc *f);
+int opt_dse(IrFunc *f);
+int opt_dce(IrFunc *f);
+int opt_cfg(IrFunc *f);
+
+#endif
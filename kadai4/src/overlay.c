@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "overlay.h"
+
+// Variables are placed largest first, each at the lowest offset where it
+// overlaps no variable already placed that it interferes with.
+
+int overlay_enabled = 1;
+
+static int total_words;
+static int total_region;
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static int words_of(const IrVar *v) {
+    return v->size > 0 ? v->size : 1;
+}
+
+// Sets of functions, one bit each
+typedef unsigned long long Word;
+#define WORD_BITS 64
+
+static int words_for(int n) {
+    return (n + WORD_BITS - 1) / WORD_BITS;
+}
+
+static void set_bit(Word *set, int i) {
+    set[i / WORD_BITS] |= (Word)1 << (i % WORD_BITS);
+}
+
+static int has_bit(const Word *set, int i) {
+    return (set[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+}
+
+// reach + a * w: the functions a calls, directly or not (w words a row)
+static Word* call_reach(const IrModule *m, int w) {
+    int n = m->nfuncs;
+    Word *reach = xcalloc((size_t)n * w, sizeof(Word));
+    for (int a = 0; a < n; a++) {
+        const IrFunc *f = m->funcs[a];
+        for (int b = 0; b < f->nblocks; b++) {
+            for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+                const IrInsn *insn = &f->blocks[b]->insns[j];
+                if (insn->op == IR_CALL) set_bit(reach + a * w, insn->callee);
+            }
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        for (int a = 0; a < n; a++) {
+            if (!has_bit(reach + a * w, k)) continue;
+            for (int i = 0; i < w; i++) reach[a * w + i] |= reach[k * w + i];
+        }
+    }
+    return reach;
+}
+
+// users + v * w: the functions that read, write or receive var v
+static Word* var_users(const IrModule *m, int w) {
+    Word *users = xcalloc((size_t)m->nvars * w, sizeof(Word));
+    for (int i = 0; i < m->nfuncs; i++) {
+        const IrFunc *f = m->funcs[i];
+        for (int p = 0; p < f->nparams; p++) set_bit(users + f->params[p] * w, i);
+        for (int b = 0; b < f->nblocks; b++) {
+            for (int j = 0; j < f->blocks[b]->ninsns; j++) {
+                const IrInsn *insn = &f->blocks[b]->insns[j];
+                if (insn->var >= 0) set_bit(users + insn->var * w, i);
+                for (int k = 0; k < insn->nargs; k++) {
+                    if (insn->args[k].kind != IR_ARG_VALUE) set_bit(users + insn->args[k].var * w, i);
+                }
+            }
+        }
+    }
+    return users;
+}
+
+// active + v * w: the functions that can be active while a user of v is:
+// its users, the functions they call and the functions calling them
+static Word* var_active(const IrModule *m, const Word *users, const Word *reach, int w) {
+    int n = m->nfuncs;
+    Word *active = xcalloc((size_t)m->nvars * w, sizeof(Word));
+    for (int v = 0; v < m->nvars; v++) {
+        Word *set = active + v * w;
+        const Word *used_by = users + v * w;
+        for (int a = 0; a < n; a++) {
+            if (!has_bit(used_by, a)) continue;
+            for (int i = 0; i < w; i++) set[i] |= used_by[i] | reach[a * w + i];
+        }
+        for (int b = 0; b < n; b++) {
+            if (has_bit(set, b)) continue;
+            for (int i = 0; i < w; i++) {
+                if (reach[b * w + i] & used_by[i]) {
+                    set_bit(set, b);
+                    break;
+                }
+            }
+        }
+    }
+    return active;
+}
+
+static int intersect(const Word *x, const Word *y, int w) {
+    for (int i = 0; i < w; i++) {
+        if (x[i] & y[i]) return 1;
+    }
+    return 0;
+}
+
+Overlay* overlay_layout(const IrModule *m, const char *used) {
+    Overlay *o = xcalloc(1, sizeof(Overlay));
+    o->offset = xcalloc(m->nvars, sizeof(int));
+    int *order = xcalloc(m->nvars, sizeof(int));
+    int count = 0;
+    for (int v = 0; v < m->nvars; v++) {
+        o->offset[v] = -1;
+        if (overlay_enabled && used[v] && m->vars[v].kind != IRV_GLOBAL) order[count++] = v;
+    }
+    // Largest first, in declaration order among equals
+    for (int i = 1; i < count; i++) {
+        int v = order[i];
+        int k = i;
+        while (k > 0 && words_of(&m->vars[order[k - 1]]) < words_of(&m->vars[v])) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = v;
+    }
+
+    int w = words_for(m->nfuncs);
+    Word *reach = call_reach(m, w);
+    Word *users = var_users(m, w);
+    Word *active = var_active(m, users, reach, w);
+    // The vars placed so far, by offset
+    int *placed = xcalloc(count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+        int v = order[i];
+        int size = words_of(&m->vars[v]);
+        o->words += size;
+        // Move past every interfering var that overlaps [at, at + size)
+        int at = 0;
+        for (int k = 0; k < i; k++) {
+            int u = placed[k];
+            int start = o->offset[u];
+            if (start >= at + size) break;
+            int end = start + words_of(&m->vars[u]);
+            if (end > at && intersect(users + u * w, active + v * w, w)) at = end;
+        }
+        o->offset[v] = at;
+        if (at + size > o->size) o->size = at + size;
+        int k = i;
+        while (k > 0 && o->offset[placed[k - 1]] > at) {
+            placed[k] = placed[k - 1];
+            k--;
+        }
+        placed[k] = v;
+    }
+    free(placed);
+    free(active);
+    free(reach);
+    free(users);
+    free(order);
+    total_words += o->words;
+    total_region += o->size;
+    return o;
+}
+
+void overlay_free(Overlay *o) {
+    if (!o) return;
+    free(o->offset);
+    free(o);
+}
+
+void overlay_report(FILE *out) {
+    int saved = total_words - total_region;
+    fprintf(out, "overlay: %d words of procedure variables in %d, %d bytes saved\n",
+            total_words, total_region, saved * 2);
+}
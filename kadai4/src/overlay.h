@@ -0,0 +1,34 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdio.h>
+#include "ir.h"
+
+// Static overlay of procedure variables.
+//
+// MPL procedures are not recursive, so a procedure's locals and parameter
+// cells only need to hold their values while it is active. Two variables
+// can share words unless some function using one can be active at the
+// same time as some function using the other: they are the same
+// function, or one calls the other, directly or through others. Every
+// local and parameter gets an offset in one region shared by all of
+// them, like the overlays of FORTRAN's static frames; globals keep their
+// own words.
+
+typedef struct {
+    int *offset;    // per var: first word in the region, -1 if not in it
+    int size;       // words of the region
+    int words;      // words its variables would take on their own
+} Overlay;
+
+// Lay out the locals and parameters marked in used (one byte per var)
+Overlay* overlay_layout(const IrModule *m, const char *used);
+void overlay_free(Overlay *o);
+
+// Words saved in the programs compiled so far (--pass-stats)
+void overlay_report(FILE *out);
+
+// Give every variable its own words instead (--no-overlay)
+extern int overlay_enabled;
+
+#endif
@@ -11,6 +11,11 @@
 
 // Define a constant for EOF
 #define EOF_TOKEN -1
+
+// How parse_variable lowers the variable it parses
+#define VAR_LOAD  0  // value into the accumulator
+#define VAR_STORE 1  // assignment target; an index is saved for gen_store_element()
+#define VAR_READ  2  // read/readln target
 #define MAX_ERRORS 5
 #define SYNC_TOKENS_COUNT 6
 
@@ -34,7 +39,7 @@ static int parse_return_statement(void);
 static int parse_input_statement(void);
 static int parse_output_statement(void);
 static int parse_empty_statement(void);
-static int parse_variable(void);
+static int parse_variable(int access);
 static int parse_expression(void);
 static int parse_simple_expression(void);
 static int parse_term(void);
@@ -69,14 +74,16 @@ static void debug_parser_printf(const char *format, ...) {
 }
 
 // Parser state
-extern Parser parser;  // Make this a global variable
-static int in_while_loop = 0;
+extern THREAD_LOCAL Parser parser;  // Make this a global variable
+static THREAD_LOCAL int in_while_loop = 0;
+static THREAD_LOCAL int loop_exit_label = 0;  // target of break
 
 // Global variable to track format specifier presence
-static int format_specifier_present = 0;
+static THREAD_LOCAL int format_specifier_present = 0;
 
 // Add after other static variables
-int current_array_size = 0;  // Keep this as the single global definition
+THREAD_LOCAL int current_array_size = 0;  // Keep this as the single global definition
+static THREAD_LOCAL int current_array_type = TINTEGER;  // Element type of the last array type
 
 // Add these functions to manage array size
 static void set_array_size(int size) {
@@ -88,7 +95,7 @@ static int get_array_size(void) {
 }
 
 // Define the global parser instance
-Parser parser;
+THREAD_LOCAL Parser parser;
 
 void init_parser(void) {
     parser.current_token = scan();
@@ -96,6 +103,9 @@ void init_parser(void) {
     parser.first_error_line = 0;
     parser.previous_token = 0;
     parser.previous_previous_token = 0;
+    // An error can longjmp out of a loop body; don't let a parse start inside one
+    in_while_loop = 0;
+    loop_exit_label = 0;
 }
 
 // Main program parsing
@@ -113,9 +123,6 @@ int parse_program(void) {
         return error_line;
     }
 
-    // Generate runtime error handlers at the start
-    gen_runtime_error_handlers();
-
     // Generate program start
     if (match(TPROGRAM) == ERROR) return ERROR;
     gen_program_start(string_attr);  // Use program name for CASL
@@ -138,6 +145,25 @@ int parse_program(void) {
     return 0;  // Success
 }
 
+// Parse exactly one procedure declaration (the scanner holds only its text)
+int parse_procedure_fragment(void) {
+    parser.first_error_line = 0;
+
+    int error_line = setjmp(parser.error_jmp);
+    if (error_line != 0) {
+        return error_line;
+    }
+
+    if (parser.current_token != TPROCEDURE) {
+        parse_error("Expected procedure declaration");
+    }
+    parse_subprogram_declaration();
+    if (parser.current_token != -1) {
+        parse_error("Unexpected text after procedure declaration");
+    }
+    return 0;
+}
+
 static int parse_block(void) {
     // Block ::= { Variable declaration section | Subprogram declaration } Compound statement
     
@@ -211,9 +237,9 @@ static int parse_variable_declaration_section(void) {
             
             // Generate CASL allocation
             if (var_type == TARRAY) {
-                gen_array_allocation(var_names[i], array_size);
+                gen_array_allocation(var_names[i], array_size, current_array_type);
             } else {
-                gen_variable_allocation(var_names[i], 1);
+                gen_variable_allocation(var_names[i], var_type);
             }
             free(var_names[i]);
         }
@@ -258,6 +284,7 @@ static int parse_array_type(void) {
     // Save base type
     int base_type = parser.current_token;
     int result = parse_standard_type();
+    current_array_type = base_type;
     
     // Set array info for cross-referencer
     set_array_info(size, base_type);
@@ -273,13 +300,16 @@ static int parse_expression(void) {
         int op = parser.current_token;
         if (match(op) == ERROR) return ERROR;
         
+        gen_push();  // Save left operand
         int right_type = parse_simple_expression();
         if (right_type == ERROR) return ERROR;
         
         // Check type compatibility for comparison
         check_type_compatibility(left_type, right_type);
+        gen_compare(op);
+        left_type = TBOOLEAN;
     }
-    return NORMAL;
+    return left_type;
 }
 
 static int parse_simple_expression(void) {
@@ -293,7 +323,7 @@ static int parse_simple_expression(void) {
     if (type == ERROR) return ERROR;
 
     if (unary_op == TMINUS) {
-        gen_code("NEG", "GR1");  // Negate if minus operator
+        gen_negate();  // Negate if minus operator
     }
 
     while (is_additive_operator(parser.current_token)) {
@@ -307,10 +337,10 @@ static int parse_simple_expression(void) {
         // Generate arithmetic and check for overflow
         if (op == TPLUS) {
             gen_add();
-            check_arithmetic_overflow(TPLUS, type, term_type);
+            gen_overflow_check();
         } else if (op == TMINUS) {
             gen_subtract();
-            check_arithmetic_overflow(TMINUS, type, term_type);
+            gen_overflow_check();
         } else if (op == TOR) {
             gen_or();
         }
@@ -330,14 +360,14 @@ static int parse_term(void) {
         int factor_type = parse_factor();
         if (factor_type == ERROR) return ERROR;
 
-        if (op == TDIV) {
-            gen_div_check();  // Check for division by zero
-        }
-
         // Generate operation with overflow check
         if (op == TSTAR) {
             gen_multiply();
             gen_overflow_check();
+        } else if (op == TDIV) {
+            gen_divide();
+            gen_div_check();  // Check for division by zero
+            gen_overflow_check();
         } else if (op == TAND) {
             gen_and();
         }
@@ -596,36 +626,23 @@ static int parse_procedure_call_statement(void) {
     if (parser.current_token == TLPAREN) {
         if (match(TLPAREN) == ERROR) return ERROR;
         
-        // Handle parameters
+        // A variable is passed by reference, any other expression by the
+        // address of a cell holding its value (gen_push_expression_address)
         if (parser.current_token != TRPAREN) {
             do {
                 param_count++;  // Count parameters
-                // For each parameter
-                char is_variable = (parser.current_token == TNAME);
-                if (is_variable) {
-                    // Variable parameter - pass by reference
-                    char* var_name = strdup(string_attr);
-                    if (parse_variable() == ERROR) {
-                        free(var_name);
-                        return ERROR;
-                    }
-                    gen_push_address(var_name);
-                    free(var_name);
-                } else {
-                    // Expression parameter - evaluate and pass address of result
-                    if (parse_expression() == ERROR) return ERROR;
-                    gen_push_expression_address();
-                }
+                if (parse_expression() == ERROR) return ERROR;
+                gen_push_expression_address();
             } while (parser.current_token == TCOMMA && match(TCOMMA) == NORMAL);
         }
         
         if (match(TRPAREN) == ERROR) return ERROR;
     }
     
+    add_reference(proc_name, line_num);
+
     // Generate procedure call with parameter count
     gen_procedure_call(proc_name, param_count);
-    
-    add_reference(proc_name, line_num);
     free(proc_name);
     return NORMAL;
 }
@@ -638,12 +655,12 @@ static int parse_read_statement(void) {
         if (match(TLPAREN) == ERROR) return ERROR;
         
         // Must have at least one variable
-        if (parse_variable() == ERROR) return ERROR;
+        if (parse_variable(VAR_READ) == ERROR) return ERROR;
 
         // Handle multiple variables
         while (parser.current_token == TCOMMA) {
             if (match(TCOMMA) == ERROR) return ERROR;
-            if (parse_variable() == ERROR) return ERROR;
+            if (parse_variable(VAR_READ) == ERROR) return ERROR;
         }
 
         if (match(TRPAREN) == ERROR) return ERROR;
@@ -729,7 +746,7 @@ static int parse_write_statement(void) {
     return NORMAL;
 } 
 
-static int parse_variable(void) {
+static int parse_variable(int access) {
     debug_parser_printf("Entering parse_variable with token: %d, string_attr: %s\n", 
                        parser.current_token, string_attr);
     
@@ -742,25 +759,57 @@ static int parse_variable(void) {
         return ERROR;
     }
     
-    // Get variable info from symbol table
-    SymbolEntry* entry = lookup_symbol(var_name);
-    if (entry) {
-        debug_parser_printf("Found symbol entry for %s, type: %d\n", var_name, entry->type);
-        var_type = entry->type;
-        
-        // Handle array access
-        if (parser.current_token == TLSQPAREN) {
-            // ...existing array handling code...
+    // Get variable info from the code generator's scope
+    const IrVar* var = gen_lookup_variable(var_name);
+    if (!var) {
+        debug_parser_printf("Symbol %s not found in symbol table\n", var_name);
+        free(var_name);
+        parse_error("Undefined variable");
+        return ERROR;
+    }
+    debug_parser_printf("Found symbol entry for %s, type: %d\n", var_name, var->type);
+    var_type = var->type;
+    int array_size = var->size;
+    
+    add_reference(var_name, line_num);
+
+    if (parser.current_token == TLSQPAREN) {
+        if (array_size == 0) {
+            free(var_name);
+            parse_error("Index on a variable that is not an array");
+            return ERROR;
+        }
+        if (match(TLSQPAREN) == ERROR) return ERROR;
+        int index_type = parse_expression();
+        if (index_type == ERROR) return ERROR;
+        if (index_type != TINTEGER) {
+            free(var_name);
+            parse_error("Array index must be an integer");
+            return ERROR;
+        }
+        if (match(TRSQPAREN) == ERROR) return ERROR;
+
+        gen_bounds_check(var_name);
+        if (access == VAR_LOAD) {
+            gen_array_access(var_name);
+        } else if (access == VAR_STORE) {
+            gen_push();  // Index, for gen_store_element()
         } else {
-            // Simple variable access
-            gen_load(var_name);
+            gen_read_element(var_name);
         }
     } else {
-        debug_parser_printf("Symbol %s not found in symbol table\n", var_name);
-        var_type = ERROR;
+        if (array_size > 0) {
+            free(var_name);
+            parse_error("Array variable used without an index");
+            return ERROR;
+        }
+        if (access == VAR_LOAD) {
+            gen_load(var_name);
+        } else if (access == VAR_READ) {
+            gen_read(var_name);
+        }
     }
     
-    add_reference(var_name, line_num);
     debug_parser_printf("Exiting parse_variable with type: %d\n", var_type);
     free(var_name);
     return var_type;
@@ -1000,28 +1049,24 @@ static int parse_output_format(void) {
         int str_len = strlen(string_attr);
         debug_parser_printf("String length: %d\n", str_len);
         
-        if (match(TSTRING) == ERROR) return ERROR;
-        
         // Multi-character strings cannot have format specifiers according to grammar
-        if (str_len > 1) {
+        if (str_len != 1) {
             debug_parser_printf("Multi-char string - format specifier not allowed\n");
-            return NORMAL;  // Early return for multi-char strings
-        }
-        
-        // Single-character strings can have format specifiers
-        if (parser.current_token == TCOLON) {
-            if (match(TCOLON) == ERROR) return ERROR;
-            if (match(TNUMBER) == ERROR) return ERROR;
+            gen_write_string(string_attr);
+            return match(TSTRING);
         }
-        return NORMAL;
     }
     
-    // Handle normal expressions
-    if (parse_expression() == ERROR) return ERROR;
+    // Handle normal expressions, including single-character strings
+    int type = parse_expression();
+    if (type == ERROR) return ERROR;
+    int width = 0;
     if (parser.current_token == TCOLON) {
         if (match(TCOLON) == ERROR) return ERROR;
+        width = num_attr;
         if (match(TNUMBER) == ERROR) return ERROR;
     }
+    gen_write_value(type, width);
     return NORMAL;
 }
 
@@ -1064,6 +1109,7 @@ static int parse_assignment_statement(void) {
         free(target_var);
         return ERROR;
     }
+    int is_element = parser.previous_token == TRSQPAREN;
 
     if (match(TASSIGN) == ERROR) {
         free(target_var);
@@ -1080,14 +1126,18 @@ static int parse_assignment_statement(void) {
     check_type_compatibility(target_type, expr_type);
     
     // Generate store instruction
-    gen_store(target_var);
+    if (is_element) {
+        gen_store_element(target_var);
+    } else {
+        gen_store(target_var);
+    }
     free(target_var);
     return NORMAL;
 }
 
 // Left-hand part implementation
 static int parse_left_hand_part(void) {
-    return parse_variable();
+    return parse_variable(VAR_STORE);
 }
 
 // Conditional statement implementation
@@ -1095,26 +1145,48 @@ static int parse_conditional_statement(void) {
     if (match(TIF) == ERROR) return ERROR;
     if (parse_expression() == ERROR) return ERROR;
     if (match(TTHEN) == ERROR) return ERROR;
+
+    int else_label = get_label_num();
+    gen_jump_if_false(else_label);
     
     // Parse the then-statement
     if (parse_statement() == ERROR) return ERROR;
     
     // Handle else part - associates with closest if
     if (parser.current_token == TELSE) {
+        int end_label = get_label_num();
+        gen_jump(end_label);
+        gen_label(else_label);
         if (match(TELSE) == ERROR) return ERROR;
-        return parse_statement();
+        if (parse_statement() == ERROR) return ERROR;
+        gen_label(end_label);
+        return NORMAL;
     }
+    gen_label(else_label);
     return NORMAL;
 }
 
 // Iteration statement implementation
 static int parse_iteration_statement(void) {
     if (match(TWHILE) == ERROR) return ERROR;
+
+    int top_label = get_label_num();
+    int exit_label = get_label_num();
+    gen_label(top_label);
     if (parse_expression() == ERROR) return ERROR;
     if (match(TDO) == ERROR) return ERROR;
+    gen_jump_if_false(exit_label);
+
+    // break jumps to the exit of the innermost loop
+    int saved_exit = loop_exit_label;
+    loop_exit_label = exit_label;
     in_while_loop++;
     int result = parse_statement();
     in_while_loop--;
+    loop_exit_label = saved_exit;
+
+    gen_jump(top_label);
+    gen_label(exit_label);
     return result;
 }
 
@@ -1124,11 +1196,13 @@ static int parse_exit_statement(void) {
         parse_error("Break statement must be directly inside a while loop");
         return ERROR;
     }
+    gen_jump(loop_exit_label);
     return match(TBREAK);
 }
 
 // Return statement implementation
 static int parse_return_statement(void) {
+    gen_return();
     return match(TRETURN);
 }
 
@@ -1149,19 +1223,22 @@ static int parse_input_statement(void) {
         
         // Get the type of the variable being read into
         debug_parser_printf("Reading variable, current token: %d\n", parser.current_token);
-        int var_type = parse_variable();
+        int var_type = parse_variable(VAR_READ);
         debug_parser_printf("Variable type after parse_variable: %d\n", var_type);
         
         if (var_type == ERROR) return ERROR;
 
         while (parser.current_token == TCOMMA) {
             if (match(TCOMMA) == ERROR) return ERROR;
-            var_type = parse_variable();
+            var_type = parse_variable(VAR_READ);
             if (var_type == ERROR) return ERROR;
         }
 
         if (match(TRPAREN) == ERROR) return ERROR;
     }
+    if (is_readln) {
+        gen_readln();
+    }
     
     debug_parser_printf("Exiting parse_input_statement\n");
     return NORMAL;
@@ -1174,6 +1251,7 @@ static int parse_output_statement(void) {
         parse_error("Expected write or writeln");
         return ERROR;
     }
+    int is_writeln = (parser.current_token == TWRITELN);
     if (match(parser.current_token) == ERROR) return ERROR;
     
     if (parser.current_token == TLPAREN) {
@@ -1185,13 +1263,17 @@ static int parse_output_statement(void) {
             if (parse_output_format() == ERROR) return ERROR;
         }
         
-        return match(TRPAREN);
+        if (match(TRPAREN) == ERROR) return ERROR;
+    }
+    if (is_writeln) {
+        gen_writeln();
     }
     return NORMAL;
 }
 
 // Subprogram declaration implementation
 static int parse_subprogram_declaration(void) {
+    int start_line = get_linenum();
     if (match(TPROCEDURE) == ERROR) return ERROR;
 
     char* proc_name = strdup(string_attr);
@@ -1222,8 +1304,15 @@ static int parse_subprogram_declaration(void) {
     exit_procedure();
     gen_procedure_exit();
     
+    // Remember the line span so the procedure can be re-parsed on its own
+    int end_line = get_linenum();
+    if (match(TSEMI) == ERROR) {
+        free(proc_name);
+        return ERROR;
+    }
+    record_procedure_fragment(proc_name, start_line, end_line);
     free(proc_name);
-    return match(TSEMI);
+    return NORMAL;
 }
 
 // Formal parameter section implementation
@@ -1263,6 +1352,11 @@ static int parse_formal_parameter_section(void) {
         
         // Get parameter type
         int param_type = parser.current_token;
+        if (param_type == TARRAY) {
+            for (int i = 0; i < param_count; i++) free(param_names[i]);
+            parse_error("Parameters must be of a standard type");
+            return ERROR;
+        }
         if (parse_type() == ERROR) {
             for (int i = 0; i < param_count; i++) free(param_names[i]);
             return ERROR;
@@ -1272,6 +1366,7 @@ static int parse_formal_parameter_section(void) {
         for (int i = 0; i < param_count; i++) {
             add_symbol(param_names[i], param_type, param_line, 1);
             add_procedure_parameter(param_type);
+            gen_procedure_param(get_current_procedure(), param_names[i], param_type);
             free(param_names[i]);
         }
         
@@ -1281,33 +1376,59 @@ static int parse_formal_parameter_section(void) {
 }
 
 static int parse_factor(void) {
+    int type;
     switch (parser.current_token) {
         case TNAME:
-            return parse_variable();
+            return parse_variable(VAR_LOAD);
             
         case TNUMBER:
+            gen_load_constant(num_attr);
+            if (match(TNUMBER) == ERROR) return ERROR;
+            return TINTEGER;
+
         case TTRUE:
         case TFALSE:
+            gen_load_constant(parser.current_token == TTRUE);
+            if (match(parser.current_token) == ERROR) return ERROR;
+            return TBOOLEAN;
+
         case TSTRING:
-            return match(parser.current_token);
+            // Only one-character strings are constants
+            if (strlen(string_attr) != 1) {
+                parse_error("String constant must be a single character");
+                return ERROR;
+            }
+            gen_load_constant((unsigned char)string_attr[0]);
+            if (match(TSTRING) == ERROR) return ERROR;
+            return TCHAR;
             
         case TLPAREN:
             if (match(TLPAREN) == ERROR) return ERROR;
-            if (parse_expression() == ERROR) return ERROR;
-            return match(TRPAREN);
+            type = parse_expression();
+            if (type == ERROR) return ERROR;
+            if (match(TRPAREN) == ERROR) return ERROR;
+            return type;
             
         case TNOT:
             if (match(TNOT) == ERROR) return ERROR;
-            return parse_factor();
+            type = parse_factor();
+            if (type == ERROR) return ERROR;
+            gen_not();
+            return type;
             
         case TINTEGER:
         case TBOOLEAN:
-        case TCHAR:
+        case TCHAR: {
             // Standard type "(" Expression ")"
+            int to_type = parser.current_token;
             if (match(parser.current_token) == ERROR) return ERROR;
             if (match(TLPAREN) == ERROR) return ERROR;
-            if (parse_expression() == ERROR) return ERROR;
-            return match(TRPAREN);
+            type = parse_expression();
+            if (type == ERROR) return ERROR;
+            gen_type_conversion(type, to_type);
+            if (match(TRPAREN) == ERROR) return ERROR;
+            return to_type;
+        }
             
         default:
             parse_error("Invalid factor");
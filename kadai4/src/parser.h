@@ -4,6 +4,7 @@
 #include <setjmp.h>
 #include <stdbool.h>
 #include "codegenerator.h"  // Add this include
+#include "tls.h"
 
 #define ERROR 0
 #define NORMAL 1
@@ -31,16 +32,17 @@ typedef struct {
 } Parser;
 
 // Expose the parser instance
-extern Parser parser;
+extern THREAD_LOCAL Parser parser;
 
 // Add these declarations
-extern int current_array_size;  // For array size tracking
-extern FILE* caslfp;           // CASL output file pointer
+extern THREAD_LOCAL int current_array_size;  // For array size tracking
+extern THREAD_LOCAL FILE* caslfp; // CASL output file pointer
 
 // Public interface
 void init_parser(void);
 void parse_error(const char* message);
 int parse_program(void);
+int parse_procedure_fragment(void);
 
 // Symbol table functions
 SymbolEntry* lookup_symbol(const char* name);
@@ -55,22 +57,4 @@ int p_exp(void);
 int p_st(void);
 int p_factor(void);
 
-// Add these declarations for code generation functions
-void gen_code(const char* opc, const char* opr);
-void gen_push(void);
-void gen_add(void);
-void gen_subtract(void);
-void gen_or(void);
-void gen_div_check(void);
-void gen_multiply(void);
-void gen_overflow_check(void);
-void gen_and(void);
-void gen_push_address(const char* var_name);
-void gen_push_expression_address(void);
-void gen_procedure_call(const char* proc_name, int param_count);
-void gen_array_access(const char* array_name, const char* index_reg);
-void gen_bounds_check(void);
-void gen_load(const char* var_name);
-void gen_store(const char* var_name);
-
 #endif
\ No newline at end of file
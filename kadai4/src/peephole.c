@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+
+int peephole_stats = 0;
+
+typedef int (*PeepholeRule)(CaslCode *code, int i);
+
+typedef struct {
+    const char *name;
+    PeepholeRule apply;
+    int enabled;
+    int hits;
+    int removed;    // lines deleted by this rule
+} RuleEntry;
+
+// Window helpers
+
+static CaslLine* insn_at(CaslCode *code, int i) {
+    if (i < 0 || i >= code->n || code->lines[i].kind != CASL_INSN) return NULL;
+    return &code->lines[i];
+}
+
+static int is_op(const CaslLine *line, const char *opc) {
+    return line && strcmp(line->opc, opc) == 0;
+}
+
+static int is_register(const char *op) {
+    return op[0] == 'G' && op[1] == 'R' && op[2] >= '0' && op[2] <= '7' && op[3] == '\0';
+}
+
+static int is_conditional_jump(const CaslLine *line) {
+    return line && (is_op(line, "JPL") || is_op(line, "JMI") || is_op(line, "JNZ") ||
+                    is_op(line, "JZE") || is_op(line, "JOV"));
+}
+
+static int is_jump(const CaslLine *line) {
+    return is_op(line, "JUMP") || is_conditional_jump(line);
+}
+
+// Can the flags set by the instruction at i be dropped? The emitter tests
+// flags right after the instruction setting them, or after the LADs that
+// materialize a relation (compare / LAD r,1 / Jcc); LAD leaves them alone.
+static int flags_unused(CaslCode *code, int i) {
+    int j = i + 1;
+    while (is_op(insn_at(code, j), "LAD")) j++;
+    return !is_conditional_jump(insn_at(code, j));
+}
+
+// The label lines directly before the line at i include `label`
+static int labels_before_include(CaslCode *code, int i, const char *label) {
+    for (int j = i; j < code->n && code->lines[j].kind == CASL_LABEL; j++) {
+        if (strcmp(code->lines[j].label, label) == 0) return 1;
+    }
+    return 0;
+}
+
+static int same_ops(const CaslLine *x, const CaslLine *y, int from) {
+    if (x->nops != y->nops) return 0;
+    for (int k = from; k < x->nops; k++) {
+        if (strcmp(x->ops[k], y->ops[k]) != 0) return 0;
+    }
+    return 1;
+}
+
+static void set_insn(CaslCode *code, CaslLine *line, const char *opc, const char *operands) {
+    snprintf(line->opc, sizeof(line->opc), "%s", opc);
+    casl_code_set_ops(code, line, operands);
+}
+
+// Rules; each returns the number of lines it deleted plus one, 0 if it
+// did not match
+
+// JUMP L / Jcc L straight into L
+static int rule_jump_to_next(CaslCode *code, int i) {
+    CaslLine *j = insn_at(code, i);
+    if (!is_jump(j) || j->nops != 1) return 0;
+    if (!labels_before_include(code, i + 1, j->ops[0])) return 0;
+    casl_code_remove(code, i);
+    return 2;
+}
+
+// Label of the JUMP that the code at `label` starts with, NULL if none
+static const char* jump_at_label(CaslCode *code, const char *label) {
+    int i = casl_code_find_label(code, label);
+    if (i < 0) return NULL;
+    while (i < code->n && code->lines[i].kind == CASL_LABEL) i++;
+    CaslLine *next = insn_at(code, i);
+    if (!is_op(next, "JUMP") || next->nops != 1) return NULL;
+    return next->ops[0];
+}
+
+// Jxx L1 ... L1: JUMP L2  =>  Jxx L2
+static int rule_jump_chain(CaslCode *code, int i) {
+    CaslLine *j = insn_at(code, i);
+    if (!is_jump(j) || j->nops != 1) return 0;
+    const char *target = jump_at_label(code, j->ops[0]);
+    if (!target || strcmp(target, j->ops[0]) == 0) return 0;
+    // Leave loops made only of jumps alone
+    const char *end = target;
+    for (int hops = 0; end && hops < code->n; hops++) {
+        if (strcmp(end, j->ops[0]) == 0) return 0;
+        end = jump_at_label(code, end);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s", target);
+    casl_code_set_ops(code, j, label);
+    return 1;
+}
+
+// Jcc L1 / JUMP L2 / L1:  =>  J!cc L2 / L1:
+static int rule_branch_over_jump(CaslCode *code, int i) {
+    static const struct {
+        const char *first, *second;   // the conditional jumps to L1
+        const char *inv1, *inv2;      // their inverse, jumping to L2
+    } forms[] = {
+        { "JZE", NULL,  "JNZ", NULL  },
+        { "JNZ", NULL,  "JZE", NULL  },
+        { "JMI", "JZE", "JPL", NULL  },
+        { "JPL", "JZE", "JMI", NULL  },
+        { "JMI", NULL,  "JPL", "JZE" },
+        { "JPL", NULL,  "JMI", "JZE" },
+    };
+    CaslLine *first = insn_at(code, i);
+    if (!is_conditional_jump(first) || first->nops != 1) return 0;
+    for (size_t f = 0; f < sizeof(forms) / sizeof(forms[0]); f++) {
+        if (!is_op(first, forms[f].first)) continue;
+        int k = i + 1;
+        if (forms[f].second) {
+            CaslLine *second = insn_at(code, k);
+            if (!is_op(second, forms[f].second) || !same_ops(first, second, 0)) continue;
+            k++;
+        }
+        CaslLine *jump = insn_at(code, k);
+        if (!is_op(jump, "JUMP") || jump->nops != 1) continue;
+        if (!labels_before_include(code, k + 1, first->ops[0])) continue;
+
+        char target[64];
+        snprintf(target, sizeof(target), "%s", jump->ops[0]);
+        int old_count = k - i + 1;
+        int new_count = forms[f].inv2 ? 2 : 1;
+        for (int n = old_count; n > new_count; n--) casl_code_remove(code, i + 1);
+        set_insn(code, &code->lines[i], forms[f].inv1, target);
+        if (forms[f].inv2) set_insn(code, &code->lines[i + 1], forms[f].inv2, target);
+        return old_count - new_count + 1;
+    }
+    return 0;
+}
+
+// Nothing after JUMP, RET or SVC runs until the next label
+static int rule_unreachable(CaslCode *code, int i) {
+    CaslLine *j = insn_at(code, i);
+    if (!is_op(j, "JUMP") && !is_op(j, "RET") && !is_op(j, "SVC")) return 0;
+    int removed = 0;
+    while (insn_at(code, i + 1) && !code->lines[i + 1].label) {
+        casl_code_remove(code, i + 1);
+        removed++;
+    }
+    return removed ? removed + 1 : 0;
+}
+
+// Emitter labels (L0001...) that nothing jumps to
+static int rule_unused_label(CaslCode *code, int i) {
+    CaslLine *l = &code->lines[i];
+    if (l->kind != CASL_LABEL || l->label[0] != 'L') return 0;
+    if (casl_code_label_uses(code, l->label) > 0) return 0;
+    casl_code_remove(code, i);
+    return 2;
+}
+
+// ST r1,X / LD r2,X  =>  ST r1,X / LD r2,r1
+static int rule_store_load(CaslCode *code, int i) {
+    CaslLine *st = insn_at(code, i);
+    CaslLine *ld = insn_at(code, i + 1);
+    if (!is_op(st, "ST") || !is_op(ld, "LD") || ld->label) return 0;
+    if (st->nops < 2 || !same_ops(st, ld, 1)) return 0;
+    if (strcmp(st->ops[0], ld->ops[0]) == 0) {
+        if (!flags_unused(code, i + 1)) return 0;
+        casl_code_remove(code, i + 1);
+        return 2;
+    }
+    char operands[32];
+    snprintf(operands, sizeof(operands), "%s,%s", ld->ops[0], st->ops[0]);
+    casl_code_set_ops(code, ld, operands);
+    return 1;
+}
+
+// LD r,r
+static int rule_self_move(CaslCode *code, int i) {
+    CaslLine *ld = insn_at(code, i);
+    if (!is_op(ld, "LD") || ld->nops != 2 || ld->label) return 0;
+    if (!is_register(ld->ops[1]) || strcmp(ld->ops[0], ld->ops[1]) != 0) return 0;
+    if (!flags_unused(code, i)) return 0;
+    casl_code_remove(code, i);
+    return 2;
+}
+
+// LD r1,r2 / LD r2,r1  =>  LD r1,r2
+static int rule_move_back(CaslCode *code, int i) {
+    CaslLine *x = insn_at(code, i);
+    CaslLine *y = insn_at(code, i + 1);
+    if (!is_op(x, "LD") || !is_op(y, "LD") || y->label) return 0;
+    if (x->nops != 2 || y->nops != 2 || !is_register(x->ops[1])) return 0;
+    if (strcmp(x->ops[0], y->ops[1]) != 0 || strcmp(x->ops[1], y->ops[0]) != 0) return 0;
+    casl_code_remove(code, i + 1);
+    return 2;
+}
+
+// PUSH 0,r1 / POP r2  =>  LD r2,r1
+static int rule_push_pop(CaslCode *code, int i) {
+    CaslLine *push = insn_at(code, i);
+    CaslLine *pop = insn_at(code, i + 1);
+    if (!is_op(push, "PUSH") || !is_op(pop, "POP") || pop->label) return 0;
+    if (push->nops != 2 || strcmp(push->ops[0], "0") != 0) return 0;
+    if (!flags_unused(code, i + 1)) return 0;
+    char operands[32];
+    snprintf(operands, sizeof(operands), "%s,%s", pop->ops[0], push->ops[1]);
+    set_insn(code, push, "LD", operands);
+    casl_code_remove(code, i + 1);
+    return 2;
+}
+
+static RuleEntry rules[] = {
+    { "jump-to-next",      rule_jump_to_next,      1, 0, 0 },
+    { "jump-chain",        rule_jump_chain,        1, 0, 0 },
+    { "branch-over-jump",  rule_branch_over_jump,  1, 0, 0 },
+    { "unreachable",       rule_unreachable,       1, 0, 0 },
+    { "unused-label",      rule_unused_label,      1, 0, 0 },
+    { "store-load",        rule_store_load,        1, 0, 0 },
+    { "self-move",         rule_self_move,         1, 0, 0 },
+    { "move-back",         rule_move_back,         1, 0, 0 },
+    { "push-pop",          rule_push_pop,          1, 0, 0 },
+};
+
+#define NRULES ((int)(sizeof(rules) / sizeof(rules[0])))
+
+int peephole_configure(const char *spec) {
+    int all = strcmp(spec, "all") == 0;
+    for (int r = 0; r < NRULES; r++) rules[r].enabled = all;
+    if (all || strcmp(spec, "none") == 0) return 1;
+
+    int ok = 1;
+    const char *p = spec;
+    while (*p) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        int found = 0;
+        for (int r = 0; r < NRULES; r++) {
+            if (strlen(rules[r].name) == len && strncmp(rules[r].name, p, len) == 0) {
+                rules[r].enabled = 1;
+                found = 1;
+            }
+        }
+        if (!found) ok = 0;
+        p += len;
+        if (*p == ',') p++;
+    }
+    return ok;
+}
+
+void peephole_optimize(CaslCode *code) {
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        // Labels are looked up and counted through the index from here on
+        casl_code_index_labels(code);
+        for (int i = 0; i < code->n; i++) {
+            for (int r = 0; r < NRULES && i < code->n; r++) {
+                if (!rules[r].enabled) continue;
+                int result = rules[r].apply(code, i);
+                if (result) {
+                    rules[r].hits++;
+                    rules[r].removed += result - 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+void peephole_print_stats(FILE *out) {
+    int hits = 0, removed = 0;
+    fprintf(out, "peephole rule          hits  removed\n");
+    for (int r = 0; r < NRULES; r++) {
+        fprintf(out, "%-20s %6d %8d%s\n", rules[r].name, rules[r].hits, rules[r].removed,
+                rules[r].enabled ? "" : "  (off)");
+        hits += rules[r].hits;
+        removed += rules[r].removed;
+    }
+    fprintf(out, "%-20s %6d %8d\n", "total", hits, removed);
+}
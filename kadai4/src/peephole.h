@@ -0,0 +1,25 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include "casl_emitter.h"
+
+// Peephole optimizer over the buffered CASL program text.
+//
+// Each rule looks at a short window of consecutive lines starting at one
+// instruction and rewrites it in place. The rules are applied over the
+// whole program until none of them matches any more.
+
+// Select rules from a comma-separated list of names, "all" or "none";
+// returns 0 if a name is unknown
+int peephole_configure(const char *spec);
+
+void peephole_optimize(CaslCode *code);
+
+// Per-rule hit counts since the start of the run
+void peephole_print_stats(FILE *out);
+
+// Print the hit counts after compiling (--peephole-stats)
+extern int peephole_stats;
+
+#endif
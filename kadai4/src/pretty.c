@@ -44,8 +44,8 @@ static int need_space = 0;
 static int last_printed_newline = 1; 
 static int prev_token = 0, curr_token = 0, next_token = 0;
 static int in_procedure_header = 0;
-extern int num_attr;
-extern char string_attr[];
+extern THREAD_LOCAL int num_attr;
+extern THREAD_LOCAL char string_attr[];
 extern char *tokenstr[];
 
 // Forward declarations
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "project.h"
+#include "scan.h"
+#include "parser.h"
+#include "cross_referencer.h"
+#include "compiler.h"
+
+typedef struct {
+    const char *path;
+    XrefRow *rows;
+    int count;
+    int failed;
+} ProjectFile;
+
+typedef struct {
+    ProjectFile *files;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} ProjectQueue;
+
+// One merged row; rank is the row's position in its own file's table
+typedef struct {
+    const XrefRow *row;
+    int file;
+    int rank;
+} MergedRow;
+
+// Parse one file with this thread's scanner/parser/symbol table. caslfp
+// stays NULL, so the program is never optimized or emitted: the passes
+// keep their statistics in process-wide statics.
+static void cross_reference_file(ProjectFile *file) {
+    jmp_buf recovery;
+    caslfp = NULL;
+    error_recovery = &recovery;
+    init_cross_referencer();
+
+    if (setjmp(recovery) == 0) {
+        if (init_scan(file->path) == 0) {
+            init_parser();
+            parse_program();
+            file->rows = export_cross_reference_table(&file->count);
+        }
+    }
+    if (!file->rows) file->failed = 1;
+
+    error_recovery = NULL;
+    gen_discard();
+    end_scan();
+    free_cross_referencer();
+}
+
+static void* project_worker(void *arg) {
+    ProjectQueue *queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (i >= queue->count) break;
+        cross_reference_file(&queue->files[i]);
+    }
+    return NULL;
+}
+
+// Same rules as compare_ids(), then file order, then per-file order
+static int compare_merged(const void *a, const void *b) {
+    const MergedRow *m1 = a;
+    const MergedRow *m2 = b;
+    int proc1 = m1->row->ttype == TPROCEDURE;
+    int proc2 = m2->row->ttype == TPROCEDURE;
+
+    if (proc1 != proc2) return proc1 ? -1 : 1;
+    if (proc1) {
+        int c = strcmp(m1->row->display_name, m2->row->display_name);
+        if (c != 0) return c;
+    } else if (m1->row->deflinenum != m2->row->deflinenum) {
+        return m1->row->deflinenum - m2->row->deflinenum;
+    }
+    if (m1->file != m2->file) return m1->file - m2->file;
+    return m1->rank - m2->rank;
+}
+
+int run_project_cross_reference(char **paths, int file_count, int jobs) {
+    ProjectFile *files = calloc(file_count > 0 ? file_count : 1, sizeof(ProjectFile));
+    if (!files) return 1;
+    for (int i = 0; i < file_count; i++) files[i].path = paths[i];
+
+    ProjectQueue queue = { files, file_count, 0, PTHREAD_MUTEX_INITIALIZER };
+    if (jobs > file_count) jobs = file_count;
+    if (jobs < 1) jobs = 1;
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    int started = 0;
+    for (int t = 0; threads && t < jobs; t++) {
+        if (pthread_create(&threads[t], NULL, project_worker, &queue) == 0) started++;
+    }
+    if (started == 0) project_worker(&queue);
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    free(threads);
+
+    int total = 0, failed = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (files[i].failed) {
+            fprintf(stderr, "Error: %s was not cross-referenced\n", files[i].path);
+            failed++;
+        }
+        total += files[i].count;
+    }
+
+    MergedRow *merged = malloc((total > 0 ? total : 1) * sizeof(MergedRow));
+    if (!merged) {
+        failed++;
+        total = 0;
+    }
+    int n = 0;
+    for (int i = 0; merged && i < file_count; i++) {
+        for (int j = 0; j < files[i].count; j++) {
+            merged[n].row = &files[i].rows[j];
+            merged[n].file = i;
+            merged[n].rank = j;
+            n++;
+        }
+    }
+    if (merged) qsort(merged, total, sizeof(MergedRow), compare_merged);
+
+    printf("----------------------------------\n");
+    for (int i = 0; i < total; i++) {
+        const XrefRow *row = merged[i].row;
+        printf("%s|%s|%s|%d|", files[merged[i].file].path, row->display_name,
+               row->type_name, row->deflinenum);
+        for (int r = 0; r < row->ref_count; r++) {
+            printf(r == 0 ? "%d" : ",%d", row->refs[r]);
+        }
+        printf("\n");
+    }
+
+    free(merged);
+    for (int i = 0; i < file_count; i++) {
+        free_cross_reference_rows(files[i].rows, files[i].count);
+    }
+    free(files);
+    return failed != 0;
+}
@@ -0,0 +1,9 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+// Cross-reference many files on a worker pool and print one merged table
+// (file|name|type|defline|refs), ordered like print_cross_reference_table()
+// with ties broken by command-line file order.
+int run_project_cross_reference(char **files, int file_count, int jobs);
+
+#endif
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "range.h"
+#include "token.h"
+
+// The state at a point is one Range per tracked variable followed by one
+// per temp. A condition or check that narrows a range to nothing means
+// the point cannot be reached, which is how infeasible branch edges drop
+// out.
+
+#define NARROW_ROUNDS 2
+
+struct RangeInfo {
+    const IrFunc *f;
+    const IrModule *m;
+    int *slot_of_var;    // var -> state slot, -1 if not tracked
+    char *slot_global;   // slot holds a global
+    int nslots_var;
+    int size;            // tracked vars, then temps 0..ntemps
+    Range **in;          // per block
+    char *reached;
+
+    // Cursor
+    Range *cur;
+    int *origin;         // temp -> slot of the variable it was loaded from in this block
+    const IrInsn **cmp;  // temp -> relation that computed it in this block
+    int dead;            // the cursor is past a point that cannot be reached
+};
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Empty ranges are always {1, 0} so that states compare equal
+static Range make_range(long lo, long hi) {
+    Range r;
+    if (lo < RANGE_MIN) lo = RANGE_MIN;
+    if (hi > RANGE_MAX) hi = RANGE_MAX;
+    if (lo > hi) lo = 1, hi = 0;
+    r.lo = (int)lo;
+    r.hi = (int)hi;
+    return r;
+}
+
+static Range full_range(void) {
+    return make_range(RANGE_MIN, RANGE_MAX);
+}
+
+static int is_empty(Range r) {
+    return r.lo > r.hi;
+}
+
+static Range join(Range x, Range y) {
+    if (is_empty(x)) return y;
+    if (is_empty(y)) return x;
+    return make_range(x.lo < y.lo ? x.lo : y.lo, x.hi > y.hi ? x.hi : y.hi);
+}
+
+static Range intersect(Range x, Range y) {
+    return make_range(x.lo > y.lo ? x.lo : y.lo, x.hi < y.hi ? x.hi : y.hi);
+}
+
+// What a variable of this type can hold
+static Range type_range(int type) {
+    switch (type) {
+        case TBOOLEAN: return make_range(0, 1);
+        case TCHAR:    return make_range(0, 255);
+        default:       return full_range();
+    }
+}
+
+static int temp_slot(const RangeInfo *ri, int t) {
+    return ri->nslots_var + t;
+}
+
+Range range_get(const RangeInfo *ri, IrValue v) {
+    if (v.kind == IR_CONST) return make_range(v.value, v.value);
+    if (v.kind == IR_TEMP) return ri->cur[temp_slot(ri, v.value)];
+    return full_range();
+}
+
+// Arithmetic
+
+static long min4(long a, long b, long c, long d) {
+    long m = a;
+    if (b < m) m = b;
+    if (c < m) m = c;
+    if (d < m) m = d;
+    return m;
+}
+
+static long max4(long a, long b, long c, long d) {
+    long m = a;
+    if (b > m) m = b;
+    if (c > m) m = c;
+    if (d > m) m = d;
+    return m;
+}
+
+void range_exact(IrOp op, Range a, Range b, long *lo, long *hi) {
+    switch (op) {
+        case IR_ADD:
+            *lo = (long)a.lo + b.lo;
+            *hi = (long)a.hi + b.hi;
+            break;
+        case IR_SUB:
+            *lo = (long)a.lo - b.hi;
+            *hi = (long)a.hi - b.lo;
+            break;
+        case IR_NEG:
+            *lo = -(long)a.hi;
+            *hi = -(long)a.lo;
+            break;
+        case IR_MUL:
+            *lo = min4((long)a.lo * b.lo, (long)a.lo * b.hi, (long)a.hi * b.lo, (long)a.hi * b.hi);
+            *hi = max4((long)a.lo * b.lo, (long)a.lo * b.hi, (long)a.hi * b.lo, (long)a.hi * b.hi);
+            break;
+        case IR_DIV: {
+            // Truncating division never grows the magnitude, except
+            // -32768 div -1
+            long m = -(long)a.lo > a.hi ? -(long)a.lo : a.hi;
+            *lo = a.lo >= 0 && b.lo >= 0 ? 0 : -m;
+            *hi = m;
+            if (b.lo == b.hi && b.lo != 0) {
+                *lo = a.lo / b.lo < a.hi / b.lo ? a.lo / b.lo : a.hi / b.lo;
+                *hi = a.lo / b.lo > a.hi / b.lo ? a.lo / b.lo : a.hi / b.lo;
+            }
+            break;
+        }
+        default:
+            *lo = RANGE_MIN;
+            *hi = RANGE_MAX;
+            break;
+    }
+}
+
+// Smallest 2^k - 1 covering a non-negative value
+static int mask_above(int v) {
+    int m = 0;
+    while (m < v) m = m * 2 + 1;
+    return m;
+}
+
+static Range relation(IrOp op, Range a, Range b) {
+    int always = 0, never = 0;
+    switch (op) {
+        case IR_EQ: always = a.lo == a.hi && b.lo == b.hi && a.lo == b.lo;
+                    never = a.hi < b.lo || b.hi < a.lo; break;
+        case IR_NE: never = a.lo == a.hi && b.lo == b.hi && a.lo == b.lo;
+                    always = a.hi < b.lo || b.hi < a.lo; break;
+        case IR_LT: always = a.hi < b.lo; never = a.lo >= b.hi; break;
+        case IR_LE: always = a.hi <= b.lo; never = a.lo > b.hi; break;
+        case IR_GT: always = a.lo > b.hi; never = a.hi <= b.lo; break;
+        case IR_GE: always = a.lo >= b.hi; never = a.hi < b.lo; break;
+        default: break;
+    }
+    return make_range(never ? 0 : always ? 1 : 0, always ? 1 : never ? 0 : 1);
+}
+
+static Range evaluate(const RangeInfo *ri, const IrInsn *insn) {
+    Range a = range_get(ri, insn->a);
+    Range b = range_get(ri, insn->b);
+    long lo, hi;
+    switch (insn->op) {
+        case IR_MOV:
+            return a;
+        case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_NEG:
+            range_exact(insn->op, a, b, &lo, &hi);
+            if (lo >= RANGE_MIN && hi <= RANGE_MAX) return make_range(lo, hi);
+            // A checked result that is out of range never gets here
+            if (insn->flags & IRF_OVERFLOW) return make_range(lo, hi);
+            return full_range();
+        case IR_AND:
+            if (a.lo >= 0 && b.lo >= 0) return make_range(0, a.hi < b.hi ? a.hi : b.hi);
+            if (a.lo >= 0) return make_range(0, a.hi);
+            if (b.lo >= 0) return make_range(0, b.hi);
+            return full_range();
+        case IR_OR:
+            if (a.lo >= 0 && b.lo >= 0) {
+                int m = mask_above(a.hi > b.hi ? a.hi : b.hi);
+                return make_range(a.lo > b.lo ? a.lo : b.lo, m);
+            }
+            return full_range();
+        case IR_NOT:
+            if (a.lo >= 0 && a.hi <= 1) return make_range(1 - a.hi, 1 - a.lo);
+            return full_range();
+        case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+            return relation(insn->op, a, b);
+        default:
+            return full_range();
+    }
+}
+
+// Transfer
+
+static void set_var_slots(RangeInfo *ri, Range *state, int globals_only) {
+    for (int v = 0; v < ri->m->nvars; v++) {
+        int slot = ri->slot_of_var[v];
+        if (slot < 0) continue;
+        if (globals_only && ri->m->vars[v].kind != IRV_GLOBAL) continue;
+        state[slot] = type_range(ri->m->vars[v].type);
+    }
+}
+
+// The variable in `slot` changed: temps loaded from it no longer copy it
+static void forget_origin(RangeInfo *ri, int slot) {
+    for (int t = 0; t <= ri->f->ntemps; t++) {
+        if (ri->origin[t] == slot) ri->origin[t] = -1;
+    }
+}
+
+static void forget_globals(RangeInfo *ri) {
+    for (int t = 0; t <= ri->f->ntemps; t++) {
+        if (ri->origin[t] >= 0 && ri->slot_global[ri->origin[t]]) ri->origin[t] = -1;
+    }
+}
+
+// Narrow an operand, and the variable it was just loaded from
+static void refine(RangeInfo *ri, IrValue v, Range r) {
+    if (v.kind == IR_CONST) {
+        if (v.value < r.lo || v.value > r.hi) ri->dead = 1;
+        return;
+    }
+    if (v.kind != IR_TEMP) return;
+    int s = temp_slot(ri, v.value);
+    ri->cur[s] = intersect(ri->cur[s], r);
+    if (is_empty(ri->cur[s])) ri->dead = 1;
+    int origin = ri->origin[v.value];
+    if (origin >= 0) ri->cur[origin] = intersect(ri->cur[origin], r);
+}
+
+void range_step(RangeInfo *ri, const IrInsn *insn) {
+    const IrVar *var = insn->var >= 0 ? &ri->m->vars[insn->var] : NULL;
+    int slot = insn->var >= 0 ? ri->slot_of_var[insn->var] : -1;
+    switch (insn->op) {
+        case IR_LOAD:
+            if (slot >= 0) {
+                ri->cur[temp_slot(ri, insn->dst)] = ri->cur[slot];
+            } else {
+                ri->cur[temp_slot(ri, insn->dst)] = type_range(var->type);
+            }
+            ri->origin[insn->dst] = slot;
+            ri->cmp[insn->dst] = NULL;
+            return;
+        case IR_STORE:
+            if (slot >= 0) {
+                ri->cur[slot] = range_get(ri, insn->b);
+                forget_origin(ri, slot);
+            } else if (var->kind == IRV_PARAM) {
+                set_var_slots(ri, ri->cur, 1);
+                forget_globals(ri);
+            }
+            return;
+        case IR_READ:
+            if (slot >= 0) {
+                ri->cur[slot] = type_range(var->type);
+                forget_origin(ri, slot);
+            } else if (var->kind == IRV_PARAM) {
+                set_var_slots(ri, ri->cur, 1);
+                forget_globals(ri);
+            }
+            return;
+        case IR_CALL:
+            set_var_slots(ri, ri->cur, 1);
+            forget_globals(ri);
+            for (int k = 0; k < insn->nargs; k++) {
+                int arg_slot = insn->args[k].kind == IR_ARG_VAR ? ri->slot_of_var[insn->args[k].var] : -1;
+                if (arg_slot >= 0) {
+                    ri->cur[arg_slot] = type_range(ri->m->vars[insn->args[k].var].type);
+                    forget_origin(ri, arg_slot);
+                }
+            }
+            return;
+        case IR_CHECK:
+            // Execution only continues with an index in bounds
+            refine(ri, insn->a, make_range(0, insn->imm - 1));
+            return;
+        default:
+            break;
+    }
+    if (insn->dst > 0) {
+        ri->cur[temp_slot(ri, insn->dst)] = evaluate(ri, insn);
+        ri->origin[insn->dst] = -1;
+        ri->cmp[insn->dst] = insn->op >= IR_EQ && insn->op <= IR_GE ? insn : NULL;
+    }
+}
+
+static IrOp negate_relation(IrOp op) {
+    switch (op) {
+        case IR_EQ: return IR_NE;
+        case IR_NE: return IR_EQ;
+        case IR_LT: return IR_GE;
+        case IR_LE: return IR_GT;
+        case IR_GT: return IR_LE;
+        default:    return IR_LT;  // IR_GE
+    }
+}
+
+// Narrow x and y to the values for which `x op y` holds
+static void assume(RangeInfo *ri, IrOp op, IrValue x, IrValue y) {
+    Range a = range_get(ri, x);
+    Range b = range_get(ri, y);
+    switch (op) {
+        case IR_EQ:
+            refine(ri, x, b);
+            refine(ri, y, a);
+            break;
+        case IR_NE:
+            if (b.lo == b.hi && a.lo == b.lo) refine(ri, x, make_range((long)a.lo + 1, a.hi));
+            else if (b.lo == b.hi && a.hi == b.lo) refine(ri, x, make_range(a.lo, (long)a.hi - 1));
+            if (a.lo == a.hi && b.lo == a.lo) refine(ri, y, make_range((long)b.lo + 1, b.hi));
+            else if (a.lo == a.hi && b.hi == a.lo) refine(ri, y, make_range(b.lo, (long)b.hi - 1));
+            break;
+        case IR_LT:
+            refine(ri, x, make_range(RANGE_MIN, (long)b.hi - 1));
+            refine(ri, y, make_range((long)a.lo + 1, RANGE_MAX));
+            break;
+        case IR_LE:
+            refine(ri, x, make_range(RANGE_MIN, b.hi));
+            refine(ri, y, make_range(a.lo, RANGE_MAX));
+            break;
+        case IR_GT:
+            refine(ri, x, make_range((long)b.lo + 1, RANGE_MAX));
+            refine(ri, y, make_range(RANGE_MIN, (long)a.hi - 1));
+            break;
+        case IR_GE:
+            refine(ri, x, make_range(b.lo, RANGE_MAX));
+            refine(ri, y, make_range(RANGE_MIN, a.hi));
+            break;
+        default:
+            break;
+    }
+}
+
+// Refine the cursor state for the edge of `branch` taken when its
+// relation is `holds`
+static void assume_branch(RangeInfo *ri, const IrInsn *branch, int holds) {
+    IrOp op = holds ? (IrOp)branch->mode : negate_relation((IrOp)branch->mode);
+    assume(ri, op, branch->a, branch->b);
+
+    // `t <> 0` / `t = 0` on a relation computed in this block
+    if (branch->a.kind == IR_TEMP && branch->b.kind == IR_CONST && branch->b.value == 0 &&
+        (op == IR_NE || op == IR_EQ)) {
+        const IrInsn *rel = ri->cmp[branch->a.value];
+        if (rel) {
+            IrOp r = op == IR_NE ? rel->op : negate_relation(rel->op);
+            assume(ri, r, rel->a, rel->b);
+        }
+    }
+}
+
+// Analysis
+
+static int merge_into(RangeInfo *ri, Range *dst, const Range *src, char *reached, int widen) {
+    if (!*reached) {
+        memcpy(dst, src, ri->size * sizeof(Range));
+        *reached = 1;
+        return 1;
+    }
+    int changed = 0;
+    for (int i = 0; i < ri->size; i++) {
+        Range r = join(dst[i], src[i]);
+        if (widen && !is_empty(dst[i])) {
+            if (r.lo < dst[i].lo) r.lo = RANGE_MIN;
+            if (r.hi > dst[i].hi) r.hi = RANGE_MAX;
+        }
+        if (r.lo != dst[i].lo || r.hi != dst[i].hi) {
+            dst[i] = r;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+static void reset_cursor(RangeInfo *ri, const Range *state) {
+    memcpy(ri->cur, state, ri->size * sizeof(Range));
+    ri->dead = 0;
+    for (int t = 0; t <= ri->f->ntemps; t++) {
+        ri->origin[t] = -1;
+        ri->cmp[t] = NULL;
+    }
+}
+
+// Run block b from `state` and merge its outgoing edges into `in`
+static int propagate(RangeInfo *ri, int b, const Range *state, Range **in, char *reached, int widen) {
+    const IrBlock *block = ri->f->blocks[b];
+    reset_cursor(ri, state);
+    for (int j = 0; j + 1 < block->ninsns; j++) range_step(ri, &block->insns[j]);
+    const IrInsn *term = &block->insns[block->ninsns - 1];
+
+    int changed = 0;
+    Range *saved = xcalloc(ri->size, sizeof(Range));
+    memcpy(saved, ri->cur, ri->size * sizeof(Range));
+    for (int k = 0; k < 2; k++) {
+        int label;
+        if (term->op == IR_JUMP && k == 0) {
+            label = term->target;
+        } else if (term->op == IR_BRANCH) {
+            memcpy(ri->cur, saved, ri->size * sizeof(Range));
+            ri->dead = 0;
+            assume_branch(ri, term, k == 0);
+            label = k == 0 ? term->target : term->target2;
+        } else {
+            continue;
+        }
+        if (ri->dead) continue;
+        int s = ir_block_index(ri->f, label);
+        changed |= merge_into(ri, in[s], ri->cur, &reached[s], widen && s <= b);
+    }
+    free(saved);
+    return changed;
+}
+
+static void entry_state(RangeInfo *ri, Range *state) {
+    for (int i = 0; i < ri->size; i++) state[i] = full_range();
+    set_var_slots(ri, state, 0);
+    if (ri->f->is_main) {
+        // Variables start out as DC 0
+        for (int i = 0; i < ri->nslots_var; i++) state[i] = make_range(0, 0);
+    }
+}
+
+RangeInfo* range_analyze(const IrFunc *f) {
+    RangeInfo *ri = xcalloc(1, sizeof(RangeInfo));
+    ri->f = f;
+    ri->m = f->module;
+    ri->slot_of_var = xcalloc(ri->m->nvars, sizeof(int));
+    for (int v = 0; v < ri->m->nvars; v++) {
+        const IrVar *var = &ri->m->vars[v];
+        int visible = var->kind == IRV_GLOBAL ||
+                      (var->kind == IRV_LOCAL && !f->is_main && strcmp(var->proc, f->name) == 0);
+        ri->slot_of_var[v] = (visible && var->size == 0) ? ri->nslots_var++ : -1;
+    }
+    ri->slot_global = xcalloc(ri->nslots_var, 1);
+    for (int v = 0; v < ri->m->nvars; v++) {
+        if (ri->slot_of_var[v] >= 0) ri->slot_global[ri->slot_of_var[v]] = ri->m->vars[v].kind == IRV_GLOBAL;
+    }
+    ri->size = ri->nslots_var + f->ntemps + 1;
+    ri->cur = xcalloc(ri->size, sizeof(Range));
+    ri->origin = xcalloc(f->ntemps + 1, sizeof(int));
+    ri->cmp = xcalloc(f->ntemps + 1, sizeof(IrInsn*));
+
+    int n = f->nblocks;
+    ri->in = xcalloc(n, sizeof(Range*));
+    ri->reached = xcalloc(n, 1);
+    for (int b = 0; b < n; b++) ri->in[b] = xcalloc(ri->size, sizeof(Range));
+    Range *entry = xcalloc(ri->size, sizeof(Range));
+    entry_state(ri, entry);
+    memcpy(ri->in[0], entry, ri->size * sizeof(Range));
+    ri->reached[0] = 1;
+
+    // Widen on back edges until nothing changes
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int b = 0; b < n; b++) {
+            if (!ri->reached[b]) continue;
+            changed |= propagate(ri, b, ri->in[b], ri->in, ri->reached, 1);
+        }
+    }
+
+    // Then recompute every state from its predecessors a few times; each
+    // round stays a sound over-approximation and wins back precision
+    Range **next = xcalloc(n, sizeof(Range*));
+    char *next_reached = xcalloc(n, 1);
+    for (int b = 0; b < n; b++) next[b] = xcalloc(ri->size, sizeof(Range));
+    for (int round = 0; round < NARROW_ROUNDS; round++) {
+        memset(next_reached, 0, n);
+        memcpy(next[0], entry, ri->size * sizeof(Range));
+        next_reached[0] = 1;
+        for (int b = 0; b < n; b++) {
+            if (ri->reached[b]) propagate(ri, b, ri->in[b], next, next_reached, 0);
+        }
+        Range **swap = ri->in;
+        ri->in = next;
+        next = swap;
+        memcpy(ri->reached, next_reached, n);
+    }
+    for (int b = 0; b < n; b++) free(next[b]);
+    free(next);
+    free(next_reached);
+    free(entry);
+    return ri;
+}
+
+int range_enter(RangeInfo *ri, int b) {
+    if (!ri->reached[b]) return 0;
+    reset_cursor(ri, ri->in[b]);
+    return 1;
+}
+
+void range_free(RangeInfo *ri) {
+    if (!ri) return;
+    for (int b = 0; b < ri->f->nblocks; b++) free(ri->in[b]);
+    free(ri->in);
+    free(ri->reached);
+    free(ri->cur);
+    free(ri->origin);
+    free(ri->cmp);
+    free(ri->slot_of_var);
+    free(ri->slot_global);
+    free(ri);
+}
@@ -0,0 +1,41 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include "ir.h"
+
+// Value range analysis over one IR function.
+//
+// Every temp and every scalar variable the function can see directly
+// (globals and its own locals, as in SCCP) gets a signed 16-bit interval
+// at each point. Intervals follow assignments and arithmetic, the types
+// of variables (char and boolean values are small), branch conditions on
+// the edges they guard and bounds checks that have passed. Loops are
+// widened to reach a fixed point and then narrowed again.
+//
+// The result is read by walking a block: range_enter() positions the
+// cursor at the start of block b, range_get() gives the range of an
+// operand at the cursor and range_step() moves past one instruction.
+
+#define RANGE_MIN (-32768)
+#define RANGE_MAX 32767
+
+typedef struct {
+    int lo;
+    int hi;
+} Range;
+
+typedef struct RangeInfo RangeInfo;
+
+RangeInfo* range_analyze(const IrFunc *f);
+void range_free(RangeInfo *ri);
+
+// 0 if block b is never reached
+int range_enter(RangeInfo *ri, int b);
+Range range_get(const RangeInfo *ri, IrValue v);
+void range_step(RangeInfo *ri, const IrInsn *insn);
+
+// Bounds of ADD/SUB/MUL/DIV/NEG on operand ranges before wrapping to
+// 16 bits, as longs; the result may lie outside RANGE_MIN..RANGE_MAX
+void range_exact(IrOp op, Range a, Range b, long *lo, long *hi);
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "regalloc.h"
+#include "debug.h"
+
+// Instructions are numbered in block order; instruction i reads its
+// operands at 2i and writes its result at 2i+1, so a result may take the
+// register of an operand that dies in the same instruction.
+
+typedef struct {
+    int temp;
+    int start;
+    int end;
+    int crosses_call;
+} Interval;
+
+static void debug_regalloc_printf(const char *format, ...) {
+    if (debug_codegen) {
+        va_list args;
+        va_start(args, format);
+        printf("[REGALLOC] ");
+        vprintf(format, args);
+        va_end(args);
+    }
+}
+
+static void* xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Temp sets are byte arrays indexed by temp number
+
+static int set_union_into(char *dst, const char *src, int n) {
+    int changed = 0;
+    for (int i = 0; i <= n; i++) {
+        if (src[i] && !dst[i]) {
+            dst[i] = 1;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+// live_in/live_out for every block, one (ntemps + 1)-byte set each
+static void compute_liveness(const IrFunc *f, char **live_in, char **live_out) {
+    int n = f->ntemps;
+    char **use = xcalloc(f->nblocks, sizeof(char*));
+    char **def = xcalloc(f->nblocks, sizeof(char*));
+
+    for (int i = 0; i < f->nblocks; i++) {
+        IrBlock *b = f->blocks[i];
+        use[i] = xcalloc(n + 1, 1);
+        def[i] = xcalloc(n + 1, 1);
+        for (int j = 0; j < b->ninsns; j++) {
+            IrValue *uses[64];
+            int nuses = ir_uses(&b->insns[j], uses, 64);
+            for (int k = 0; k < nuses; k++) {
+                int t = uses[k]->value;
+                if (uses[k]->kind == IR_TEMP && !def[i][t]) use[i][t] = 1;
+            }
+            if (b->insns[j].dst > 0) def[i][b->insns[j].dst] = 1;
+        }
+    }
+
+    // Backward dataflow until nothing changes
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = f->nblocks - 1; i >= 0; i--) {
+            int succ[2];
+            int nsucc = ir_successors(f->blocks[i], succ);
+            for (int k = 0; k < nsucc; k++) {
+                int s = ir_block_index(f, succ[k]);
+                if (s >= 0) changed |= set_union_into(live_out[i], live_in[s], n);
+            }
+            for (int t = 1; t <= n; t++) {
+                char in = use[i][t] || (live_out[i][t] && !def[i][t]);
+                if (in && !live_in[i][t]) {
+                    live_in[i][t] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < f->nblocks; i++) {
+        free(use[i]);
+        free(def[i]);
+    }
+    free(use);
+    free(def);
+}
+
+static void extend(Interval *iv, int pos) {
+    if (iv->start < 0 || pos < iv->start) iv->start = pos;
+    if (pos > iv->end) iv->end = pos;
+}
+
+// One interval per temp covering every point where it is live
+static Interval* build_intervals(const IrFunc *f, int **calls_out, int *ncalls_out) {
+    int n = f->ntemps;
+    char **live_in = xcalloc(f->nblocks, sizeof(char*));
+    char **live_out = xcalloc(f->nblocks, sizeof(char*));
+    for (int i = 0; i < f->nblocks; i++) {
+        live_in[i] = xcalloc(n + 1, 1);
+        live_out[i] = xcalloc(n + 1, 1);
+    }
+    compute_liveness(f, live_in, live_out);
+
+    Interval *iv = xcalloc(n + 1, sizeof(Interval));
+    for (int t = 0; t <= n; t++) {
+        iv[t].temp = t;
+        iv[t].start = -1;
+        iv[t].end = -1;
+    }
+    int *calls = xcalloc(1, sizeof(int));
+    int ncalls = 0, ccap = 1;
+
+    int index = 0;
+    for (int i = 0; i < f->nblocks; i++) {
+        IrBlock *b = f->blocks[i];
+        int first = 2 * index;
+        for (int j = 0; j < b->ninsns; j++, index++) {
+            IrInsn *insn = &b->insns[j];
+            IrValue *uses[64];
+            int nuses = ir_uses(insn, uses, 64);
+            for (int k = 0; k < nuses; k++) {
+                if (uses[k]->kind == IR_TEMP) extend(&iv[uses[k]->value], 2 * index);
+            }
+            if (insn->dst > 0) extend(&iv[insn->dst], 2 * index + 1);
+            // Every call may change any register (see casl_emitter.c)
+            if (insn->op == IR_CALL || insn->op == IR_READ || insn->op == IR_READLN ||
+                insn->op == IR_WRITE || insn->op == IR_WRITESTR || insn->op == IR_WRITELN) {
+                if (ncalls == ccap) {
+                    ccap *= 2;
+                    calls = realloc(calls, ccap * sizeof(int));
+                }
+                calls[ncalls++] = index;
+            }
+        }
+        int last = 2 * index - 1;
+        for (int t = 1; t <= n; t++) {
+            if (live_in[i][t]) extend(&iv[t], first);
+            if (live_out[i][t]) extend(&iv[t], last);
+        }
+    }
+
+    // A value that is live on both sides of a call cannot stay in a register
+    for (int t = 1; t <= n; t++) {
+        for (int c = 0; c < ncalls && iv[t].start >= 0; c++) {
+            if (iv[t].start < 2 * calls[c] && iv[t].end > 2 * calls[c] + 1) {
+                iv[t].crosses_call = 1;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < f->nblocks; i++) {
+        free(live_in[i]);
+        free(live_out[i]);
+    }
+    free(live_in);
+    free(live_out);
+    *calls_out = calls;
+    *ncalls_out = ncalls;
+    return iv;
+}
+
+static int compare_start(const void *x, const void *y) {
+    const Interval *a = *(const Interval* const*)x;
+    const Interval *b = *(const Interval* const*)y;
+    if (a->start != b->start) return a->start - b->start;
+    return a->temp - b->temp;
+}
+
+static void spill(RegAlloc *ra, int t) {
+    ra->reg[t] = 0;
+    ra->slot[t] = ra->nslots++;
+}
+
+RegAlloc* regalloc_function(const IrFunc *f) {
+    int n = f->ntemps;
+    RegAlloc *ra = xcalloc(1, sizeof(RegAlloc));
+    ra->ntemps = n;
+    ra->reg = xcalloc(n + 1, sizeof(int));
+    ra->slot = xcalloc(n + 1, sizeof(int));
+    for (int t = 0; t <= n; t++) ra->slot[t] = -1;
+
+    int *calls, ncalls;
+    Interval *iv = build_intervals(f, &calls, &ncalls);
+
+    Interval **order = xcalloc(n + 1, sizeof(Interval*));
+    int count = 0;
+    for (int t = 1; t <= n; t++) {
+        if (iv[t].start >= 0) order[count++] = &iv[t];
+    }
+    qsort(order, count, sizeof(Interval*), compare_start);
+
+    // active[] holds the intervals currently in a register, by register
+    Interval *active[RA_LAST_REG + 1] = {0};
+    for (int i = 0; i < count; i++) {
+        Interval *cur = order[i];
+        if (cur->crosses_call) {
+            spill(ra, cur->temp);
+            continue;
+        }
+        // Free the registers of intervals that ended before this one
+        for (int r = RA_FIRST_REG; r <= RA_LAST_REG; r++) {
+            if (active[r] && active[r]->end < cur->start) active[r] = NULL;
+        }
+        int reg = 0;
+        for (int r = RA_FIRST_REG; r <= RA_LAST_REG && !reg; r++) {
+            if (!active[r]) reg = r;
+        }
+        if (!reg) {
+            // Spill whichever interval reaches furthest
+            int victim = RA_FIRST_REG;
+            for (int r = RA_FIRST_REG + 1; r <= RA_LAST_REG; r++) {
+                if (active[r]->end > active[victim]->end) victim = r;
+            }
+            if (active[victim]->end > cur->end) {
+                spill(ra, active[victim]->temp);
+                reg = victim;
+            } else {
+                spill(ra, cur->temp);
+                continue;
+            }
+        }
+        active[reg] = cur;
+        ra->reg[cur->temp] = reg;
+    }
+
+    debug_regalloc_printf("%s: %d temps, %d spilled\n",
+                          f->is_main ? "main" : f->name, count, ra->nslots);
+    free(order);
+    free(iv);
+    free(calls);
+    return ra;
+}
+
+void regalloc_free(RegAlloc *ra) {
+    if (!ra) return;
+    free(ra->reg);
+    free(ra->slot);
+    free(ra);
+}
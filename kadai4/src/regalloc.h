@@ -0,0 +1,26 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "ir.h"
+
+// Linear-scan register allocation of the temporaries of one IR function.
+//
+// Temporaries get GR3-GR7. GR1 and GR2 stay with the emitter: library
+// routines take their arguments there, and spilled or constant operands
+// are brought in through them. GR0 cannot index memory and is not used.
+// A temporary that does not get a register lives in a static word for its
+// whole lifetime (MPL procedures are not recursive).
+#define RA_FIRST_REG 3
+#define RA_LAST_REG  7
+
+typedef struct {
+    int *reg;     // reg[t]: GR holding temp t, 0 when it is spilled
+    int *slot;    // slot[t]: spill word of temp t (0-based), -1 if in a register
+    int nslots;
+    int ntemps;
+} RegAlloc;
+
+RegAlloc* regalloc_function(const IrFunc *f);
+void regalloc_free(RegAlloc *ra);
+
+#endif
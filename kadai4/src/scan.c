@@ -12,14 +12,14 @@
 static void debug_scan_printf(const char *format, ...);
 
 // Global variables
-static FILE *fp = NULL;
+static THREAD_LOCAL FILE *fp = NULL;
 extern int debug_scanner;
-char string_attr[MAXSTRSIZE];
-int num_attr;
-char cbuf = '\0';
-int linenum = 1;
+THREAD_LOCAL char string_attr[MAXSTRSIZE];
+THREAD_LOCAL int num_attr;
+THREAD_LOCAL char cbuf = '\0';
+THREAD_LOCAL int linenum = 1;
 extern keyword key[KEYWORDSIZE];
-static const char* current_filename = NULL;
+static THREAD_LOCAL const char* current_filename = NULL;
 
 static void debug_scan_printf(const char *format, ...) {
     if (debug_scanner) {
@@ -40,7 +40,7 @@ int skip_whitespace_and_comments(void);
 int check_token_size(int length);
 static int scan_number(void);
 
-Scanner scanner = {0};  // Initialize all fields to 0
+THREAD_LOCAL Scanner scanner = {0};  // Initialize all fields to 0
 
 int init_scan(const char *filename) {
     scanner.has_error = 0;
@@ -55,6 +55,29 @@ int init_scan(const char *filename) {
     return 0;
 }
 
+// Scan source text held in memory, numbering lines from first_line.
+// Used to re-parse a single procedure (see update_procedure_cross_reference).
+int init_scan_string(const char *text, int first_line) {
+    scanner.has_error = 0;
+    current_filename = NULL;
+#ifdef _WIN32
+    fp = tmpfile();
+    if (fp != NULL) {
+        fputs(text, fp);
+        rewind(fp);
+    }
+#else
+    fp = fmemopen((void *)text, strlen(text), "r");
+#endif
+    if (fp == NULL) {
+        error("Unable to scan text.");
+        return -1;
+    }
+    linenum = first_line;
+    cbuf = (char) fgetc(fp);
+    return 0;
+}
+
 const char* get_current_file(void) {
     return current_filename;
 }
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <ctype.h>
 #include "token.h"
+#include "tls.h"
 
 #define MAXSTRSIZE 1024
 #define S_ERROR -1
@@ -18,12 +19,13 @@ typedef struct {
     int has_error;
 } Scanner;
 
-extern Scanner scanner;
-extern int num_attr;
-extern char string_attr[MAXSTRSIZE];
+extern THREAD_LOCAL Scanner scanner;
+extern THREAD_LOCAL int num_attr;
+extern THREAD_LOCAL char string_attr[MAXSTRSIZE];
 
 // Function declarations
 int init_scan(const char *filename);
+int init_scan_string(const char *text, int first_line);
 int scan(void);
 int get_linenum(void);
 void end_scan(void);
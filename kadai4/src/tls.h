@@ -0,0 +1,13 @@
+#ifndef TLS_H
+#define TLS_H
+
+// Per-thread storage class for scanner, parser and symbol table state.
+// Project mode (see project.c) runs one file per worker thread, so every
+// global that describes "the file being compiled" must use this.
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#endif
@@ -0,0 +1,59 @@
+// Dump a .mxr cross-reference index written by `mpplc --mxr`.
+//
+//   mxrdump <file.mxr>              same text as the mpplc table
+//   mxrdump <file.mxr> name[:proc]  one symbol's row
+//
+// Build: gcc -I../src -o mxrdump mxrdump.c ../src/mxr.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mxr.h"
+#include "token.h"
+
+static void print_symbol(const MxrIndex *index, const MxrSymbol *sym) {
+    printf("%s", mxr_string(index, sym->name));
+    if (sym->scope != MXR_NO_SCOPE && sym->ttype != TPROCEDURE) {
+        printf(":%s", mxr_string(index, sym->scope));
+    }
+    printf("|%s|%u|", mxr_string(index, sym->type_name), sym->deflinenum);
+    MxrRefIter it;
+    int line;
+    mxr_refs_begin(index, sym, &it);
+    for (int first = 1; mxr_refs_next(&it, &line); first = 0) {
+        printf(first ? "%d" : ",%d", line);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: ./mxrdump <file.mxr> [name[:proc]]\n");
+        return 1;
+    }
+
+    MxrIndex *index = mxr_open(argv[1]);
+    if (!index) {
+        fprintf(stderr, "Error: %s is not a valid .mxr index\n", argv[1]);
+        return 1;
+    }
+
+    int result = 0;
+    if (argc == 2) {
+        mxr_print_table(index, stdout);
+    } else {
+        char *name = strdup(argv[2]);
+        char *scope = strchr(name, ':');
+        if (scope) *scope++ = '\0';
+        const MxrSymbol *sym = mxr_find(index, name, scope);
+        if (sym) {
+            print_symbol(index, sym);
+        } else {
+            fprintf(stderr, "%s: not found\n", argv[2]);
+            result = 1;
+        }
+        free(name);
+    }
+
+    mxr_close(index);
+    return result;
+}
@@ -0,0 +1,519 @@
+// Corpus-wide symbol queries over .mxr indexes written by `mpplc --mxr`.
+//
+//   mxrquery build <corpus.mxq> [-j N] <file.mxr>...
+//       Merge the per-file indexes into one inverted index sorted by name.
+//       Files are loaded on N worker threads. When <corpus.mxq> already
+//       exists, files whose size and nanosecond mtime are unchanged are
+//       copied from it and only the others are re-read.
+//   mxrquery query <corpus.mxq> <pattern>...
+//       name        exact match, any scope
+//       name*       prefix match
+//       name:proc   symbol declared in procedure proc
+//
+// Each hit prints as file|name[:proc]|type|defline|refs.
+//
+// Build: gcc -I../src -pthread -o mxrquery mxrquery.c ../src/mxr.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mxr.h"
+#include "token.h"
+
+#define MXQ_MAGIC   0x3151584Du  // "MXQ1"
+#define MXQ_VERSION 2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t files_offset;
+    uint32_t posting_count;
+    uint32_t postings_offset;
+    uint32_t strtab_offset;
+    uint32_t strtab_size;
+    uint32_t refdata_offset;
+    uint32_t refdata_size;
+} MxqHeader;
+
+typedef struct {
+    uint32_t path;
+    uint32_t size;
+    uint32_t mtime_lo;  // st_mtim in nanoseconds since the epoch
+    uint32_t mtime_hi;
+} MxqFile;
+
+// Sorted by (name, scope, file, deflinenum)
+typedef struct {
+    uint32_t name;
+    uint32_t scope;  // MXR_NO_SCOPE for globals
+    uint32_t type_name;
+    uint32_t ttype;
+    uint32_t file;
+    uint32_t deflinenum;
+    uint32_t ref_offset;
+    uint32_t ref_count;
+} MxqPosting;
+
+typedef struct {
+    const unsigned char *base;
+    size_t size;
+    const MxqHeader *header;
+    const MxqFile *files;
+    const MxqPosting *postings;
+} Corpus;
+
+// In-memory posting while building
+typedef struct {
+    char *name;
+    char *scope;  // NULL for globals
+    char *type_name;
+    int ttype;
+    int file;
+    int deflinenum;
+    int *refs;
+    int ref_count;
+} Posting;
+
+typedef struct {
+    char *path;
+    long long mtime;  // nanoseconds
+    long long size;
+    Posting *postings;
+    int count;
+    int reused;
+    int failed;
+} SourceFile;
+
+/* ---------- corpus reader ---------- */
+
+static int section_ok(const Corpus *c, uint32_t offset, size_t size) {
+    return offset <= c->size && size <= c->size - offset;
+}
+
+static int validate(Corpus *c) {
+    const MxqHeader *h = c->header;
+    if (h->magic != MXQ_MAGIC || h->version != MXQ_VERSION) return 0;
+    if (!section_ok(c, h->files_offset, (size_t)h->file_count * sizeof(MxqFile))) return 0;
+    if (!section_ok(c, h->postings_offset, (size_t)h->posting_count * sizeof(MxqPosting))) return 0;
+    if (!section_ok(c, h->strtab_offset, h->strtab_size) || h->strtab_size == 0) return 0;
+    if (c->base[h->strtab_offset + h->strtab_size - 1] != '\0') return 0;
+    if (!section_ok(c, h->refdata_offset, h->refdata_size)) return 0;
+
+    // print_posting() and reuse_from_corpus() index through these unchecked
+    const MxqPosting *postings = (const MxqPosting *)(c->base + h->postings_offset);
+    for (uint32_t i = 0; i < h->posting_count; i++) {
+        if (postings[i].file >= h->file_count) return 0;
+        if (postings[i].ref_offset > h->refdata_size) return 0;
+    }
+
+    c->files = (const MxqFile *)(c->base + h->files_offset);
+    c->postings = postings;
+    return 1;
+}
+
+static Corpus* corpus_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(MxqHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    Corpus *c = calloc(1, sizeof(Corpus));
+    if (!c) {
+        munmap(data, (size_t)st.st_size);
+        return NULL;
+    }
+    c->base = data;
+    c->size = (size_t)st.st_size;
+    c->header = (const MxqHeader *)data;
+
+    if (!validate(c)) {
+        munmap(data, c->size);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void corpus_close(Corpus *c) {
+    if (!c) return;
+    munmap((void *)c->base, c->size);
+    free(c);
+}
+
+static const char* corpus_string(const Corpus *c, uint32_t offset) {
+    if (offset >= c->header->strtab_size) return "";
+    return (const char *)(c->base + c->header->strtab_offset + offset);
+}
+
+static int* decode_refs(const unsigned char *p, const unsigned char *end, uint32_t count) {
+    int *refs = malloc((count ? count : 1) * sizeof(int));
+    if (!refs) return NULL;
+    int32_t line = 0, delta;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!mxr_get_varint(&p, end, &delta)) delta = 0;
+        line += delta;
+        refs[i] = line;
+    }
+    return refs;
+}
+
+/* ---------- loading ---------- */
+
+static int load_mxr(SourceFile *src, int file_index) {
+    MxrIndex *index = mxr_open(src->path);
+    if (!index) return 0;
+
+    uint32_t n = index->header->symbol_count;
+    src->postings = calloc(n ? n : 1, sizeof(Posting));
+    if (!src->postings) {
+        mxr_close(index);
+        return 0;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const MxrSymbol *sym = &index->symbols[i];
+        Posting *p = &src->postings[i];
+        p->name = strdup(mxr_string(index, sym->name));
+        p->scope = sym->scope == MXR_NO_SCOPE ? NULL : strdup(mxr_string(index, sym->scope));
+        p->type_name = strdup(mxr_string(index, sym->type_name));
+        p->ttype = (int)sym->ttype;
+        p->file = file_index;
+        p->deflinenum = (int)sym->deflinenum;
+        p->refs = malloc((sym->ref_count ? sym->ref_count : 1) * sizeof(int));
+        MxrRefIter it;
+        int line;
+        mxr_refs_begin(index, sym, &it);
+        while (p->refs && mxr_refs_next(&it, &line)) p->refs[p->ref_count++] = line;
+    }
+    src->count = (int)n;
+    mxr_close(index);
+    return 1;
+}
+
+// Copy one file's postings out of the previous corpus index
+static void reuse_from_corpus(SourceFile *src, const Corpus *c, uint32_t old_file, int file_index) {
+    const MxqHeader *h = c->header;
+    const unsigned char *refdata = c->base + h->refdata_offset;
+    int n = 0;
+    for (uint32_t i = 0; i < h->posting_count; i++) {
+        if (c->postings[i].file == old_file) n++;
+    }
+    src->postings = calloc(n ? n : 1, sizeof(Posting));
+    for (uint32_t i = 0; src->postings && i < h->posting_count; i++) {
+        const MxqPosting *q = &c->postings[i];
+        if (q->file != old_file) continue;
+        Posting *p = &src->postings[src->count++];
+        p->name = strdup(corpus_string(c, q->name));
+        p->scope = q->scope == MXR_NO_SCOPE ? NULL : strdup(corpus_string(c, q->scope));
+        p->type_name = strdup(corpus_string(c, q->type_name));
+        p->ttype = (int)q->ttype;
+        p->file = file_index;
+        p->deflinenum = (int)q->deflinenum;
+        p->refs = decode_refs(refdata + q->ref_offset, refdata + h->refdata_size, q->ref_count);
+        p->ref_count = p->refs ? (int)q->ref_count : 0;
+    }
+    src->reused = 1;
+}
+
+typedef struct {
+    SourceFile *files;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+} WorkQueue;
+
+static void* load_worker(void *arg) {
+    WorkQueue *queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int i = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (i >= queue->count) break;
+        SourceFile *src = &queue->files[i];
+        if (src->reused) continue;
+        if (!load_mxr(src, i)) src->failed = 1;
+    }
+    return NULL;
+}
+
+/* ---------- writing ---------- */
+
+static int compare_postings(const void *a, const void *b) {
+    const Posting *p1 = *(Posting *const *)a;
+    const Posting *p2 = *(Posting *const *)b;
+    int c = strcmp(p1->name, p2->name);
+    if (c != 0) return c;
+    if (!p1->scope != !p2->scope) return p1->scope ? 1 : -1;
+    if (p1->scope && (c = strcmp(p1->scope, p2->scope)) != 0) return c;
+    if (p1->file != p2->file) return p1->file - p2->file;
+    return p1->deflinenum - p2->deflinenum;
+}
+
+static int write_corpus(const char *path, SourceFile *files, int nfiles) {
+    int total = 0;
+    for (int i = 0; i < nfiles; i++) total += files[i].count;
+    Posting **sorted = malloc((total ? total : 1) * sizeof(Posting *));
+    if (!sorted) return -1;
+    int k = 0;
+    for (int i = 0; i < nfiles; i++) {
+        for (int j = 0; j < files[i].count; j++) sorted[k++] = &files[i].postings[j];
+    }
+    qsort(sorted, total, sizeof(Posting *), compare_postings);
+
+    MxrStringPool pool = {0};
+    MxrBuf refs = {0};
+    MxqFile *records = calloc(nfiles ? nfiles : 1, sizeof(MxqFile));
+    MxqPosting *postings = calloc(total ? total : 1, sizeof(MxqPosting));
+    if (!records || !postings) {
+        free(sorted);
+        free(records);
+        free(postings);
+        return -1;
+    }
+
+    mxr_pool_intern(&pool, "");
+    for (int i = 0; i < nfiles; i++) {
+        records[i].path = mxr_pool_intern(&pool, files[i].path);
+        records[i].size = (uint32_t)files[i].size;
+        records[i].mtime_lo = (uint32_t)files[i].mtime;
+        records[i].mtime_hi = (uint32_t)((unsigned long long)files[i].mtime >> 32);
+    }
+    for (int i = 0; i < total; i++) {
+        const Posting *p = sorted[i];
+        MxqPosting *q = &postings[i];
+        q->name = mxr_pool_intern(&pool, p->name);
+        q->scope = p->scope ? mxr_pool_intern(&pool, p->scope) : MXR_NO_SCOPE;
+        q->type_name = mxr_pool_intern(&pool, p->type_name);
+        q->ttype = (uint32_t)p->ttype;
+        q->file = (uint32_t)p->file;
+        q->deflinenum = (uint32_t)p->deflinenum;
+        q->ref_offset = (uint32_t)refs.size;
+        q->ref_count = (uint32_t)p->ref_count;
+        int previous = 0;
+        for (int r = 0; r < p->ref_count; r++) {
+            unsigned char tmp[8];
+            mxr_buf_append(&refs, tmp, mxr_put_varint(tmp, p->refs[r] - previous));
+            previous = p->refs[r];
+        }
+    }
+
+    MxrBuf out = {0};
+    MxqHeader header = {0};
+    mxr_buf_append(&out, &header, sizeof(header));
+    header.magic = MXQ_MAGIC;
+    header.version = MXQ_VERSION;
+    header.file_count = (uint32_t)nfiles;
+    header.files_offset = (uint32_t)out.size;
+    mxr_buf_append(&out, records, nfiles * sizeof(MxqFile));
+    header.posting_count = (uint32_t)total;
+    header.postings_offset = (uint32_t)out.size;
+    mxr_buf_append(&out, postings, total * sizeof(MxqPosting));
+    header.strtab_offset = (uint32_t)out.size;
+    header.strtab_size = (uint32_t)pool.strtab.size;
+    mxr_buf_append(&out, pool.strtab.data, pool.strtab.size);
+    mxr_buf_pad(&out);
+    header.refdata_offset = (uint32_t)out.size;
+    header.refdata_size = (uint32_t)refs.size;
+    mxr_buf_append(&out, refs.data, refs.size);
+    // Write to a temporary name so readers never see a partial index
+    int result = -1;
+    size_t tmplen = strlen(path) + 5;
+    char *tmp = out.failed || pool.strtab.failed || refs.failed ? NULL : malloc(tmplen);
+    if (tmp) {
+        memcpy(out.data, &header, sizeof(header));
+        snprintf(tmp, tmplen, "%s.tmp", path);
+        FILE *fp = fopen(tmp, "wb");
+        if (fp) {
+            int ok = fwrite(out.data, 1, out.size, fp) == out.size;
+            if (fclose(fp) == 0 && ok && rename(tmp, path) == 0) result = 0;
+            else remove(tmp);
+        }
+        free(tmp);
+    }
+
+    free(out.data);
+    mxr_pool_free(&pool);
+    free(refs.data);
+    free(records);
+    free(postings);
+    free(sorted);
+    return result;
+}
+
+/* ---------- commands ---------- */
+
+static int build(const char *corpus_path, int jobs, char **paths, int npaths) {
+    SourceFile *files = calloc(npaths ? npaths : 1, sizeof(SourceFile));
+    if (!files) return 1;
+
+    Corpus *old = corpus_open(corpus_path);
+    for (int i = 0; i < npaths; i++) {
+        SourceFile *src = &files[i];
+        struct stat st;
+        src->path = paths[i];
+        if (stat(paths[i], &st) < 0) {
+            src->failed = 1;
+            continue;
+        }
+        src->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        src->size = (long long)st.st_size;
+
+        // Unchanged since the last build: take its postings from the old index
+        for (uint32_t f = 0; old && f < old->header->file_count; f++) {
+            const MxqFile *rec = &old->files[f];
+            long long mtime = (long long)(((unsigned long long)rec->mtime_hi << 32) | rec->mtime_lo);
+            if (rec->size == (uint32_t)src->size && mtime == src->mtime &&
+                strcmp(corpus_string(old, rec->path), src->path) == 0) {
+                reuse_from_corpus(src, old, f, i);
+                break;
+            }
+        }
+    }
+    corpus_close(old);
+
+    WorkQueue queue = { files, npaths, 0, PTHREAD_MUTEX_INITIALIZER };
+    if (jobs > npaths) jobs = npaths;
+    if (jobs < 1) jobs = 1;
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    int started = 0;
+    for (int t = 0; threads && t < jobs; t++) {
+        if (pthread_create(&threads[t], NULL, load_worker, &queue) == 0) started++;
+    }
+    if (started == 0) load_worker(&queue);
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    free(threads);
+
+    int reused = 0, loaded = 0, failed = 0;
+    for (int i = 0; i < npaths; i++) {
+        if (files[i].failed) {
+            fprintf(stderr, "Warning: skipping %s (not a valid .mxr index)\n", files[i].path);
+            failed++;
+        } else if (files[i].reused) {
+            reused++;
+        } else {
+            loaded++;
+        }
+    }
+
+    int result = write_corpus(corpus_path, files, npaths);
+    if (result != 0) {
+        fprintf(stderr, "Error: Cannot write corpus index %s\n", corpus_path);
+    } else {
+        fprintf(stderr, "%s: %d files indexed, %d reused, %d skipped\n",
+                corpus_path, loaded, reused, failed);
+    }
+
+    for (int i = 0; i < npaths; i++) {
+        for (int j = 0; j < files[i].count; j++) {
+            Posting *p = &files[i].postings[j];
+            free(p->name);
+            free(p->scope);
+            free(p->type_name);
+            free(p->refs);
+        }
+        free(files[i].postings);
+    }
+    free(files);
+    return result != 0;
+}
+
+static void print_posting(const Corpus *c, const MxqPosting *q) {
+    const MxqHeader *h = c->header;
+    printf("%s|%s", corpus_string(c, c->files[q->file].path), corpus_string(c, q->name));
+    if (q->scope != MXR_NO_SCOPE && q->ttype != TPROCEDURE) {
+        printf(":%s", corpus_string(c, q->scope));
+    }
+    printf("|%s|%u|", corpus_string(c, q->type_name), q->deflinenum);
+
+    const unsigned char *p = c->base + h->refdata_offset + q->ref_offset;
+    const unsigned char *end = c->base + h->refdata_offset + h->refdata_size;
+    int32_t line = 0, delta;
+    for (uint32_t i = 0; i < q->ref_count && mxr_get_varint(&p, end, &delta); i++) {
+        line += delta;
+        printf(i == 0 ? "%d" : ",%d", line);
+    }
+    printf("\n");
+}
+
+// First posting whose name is >= key
+static uint32_t lower_bound(const Corpus *c, const char *key) {
+    uint32_t lo = 0, hi = c->header->posting_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (strcmp(corpus_string(c, c->postings[mid].name), key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int query(const Corpus *c, const char *pattern) {
+    char *name = strdup(pattern);
+    if (!name) return 0;
+    char *scope = strchr(name, ':');
+    if (scope) *scope++ = '\0';
+    size_t len = strlen(name);
+    int prefix = len > 0 && name[len - 1] == '*';
+    if (prefix) name[--len] = '\0';
+
+    int hits = 0;
+    for (uint32_t i = lower_bound(c, name); i < c->header->posting_count; i++) {
+        const MxqPosting *q = &c->postings[i];
+        const char *qname = corpus_string(c, q->name);
+        if (prefix ? strncmp(qname, name, len) != 0 : strcmp(qname, name) != 0) break;
+        if (scope && (q->scope == MXR_NO_SCOPE || strcmp(corpus_string(c, q->scope), scope) != 0)) {
+            continue;
+        }
+        print_posting(c, q);
+        hits++;
+    }
+    free(name);
+    return hits;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: ./mxrquery build <corpus.mxq> [-j N] <file.mxr>...\n");
+    fprintf(stderr, "       ./mxrquery query <corpus.mxq> <name|prefix*|name:proc>...\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+
+    if (strcmp(argv[1], "build") == 0) {
+        int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        int first = 3;
+        if (strcmp(argv[3], "-j") == 0 && argc > 4) {
+            jobs = atoi(argv[4]);
+            first = 5;
+        }
+        return build(argv[2], jobs, argv + first, argc - first);
+    }
+
+    if (strcmp(argv[1], "query") == 0) {
+        Corpus *c = corpus_open(argv[2]);
+        if (!c) {
+            fprintf(stderr, "Error: %s is not a valid corpus index\n", argv[2]);
+            return 1;
+        }
+        int hits = 0;
+        for (int i = 3; i < argc; i++) hits += query(c, argv[i]);
+        corpus_close(c);
+        return hits == 0;
+    }
+
+    usage();
+    return 1;
+}